@@ -1,5 +1,6 @@
 #include <glr/aabb_tree.h>
 #include <glr/obj.h>
+#include <glr/thread_pool.h>
 
 #ifdef GLRENDER_STATIC
 #   include <glad/glad.h>
@@ -7,8 +8,18 @@
 
 #include <glm/gtx/matrix_decompose.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define GLRENDER_SSE
+#endif
+
 #include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <functional>
 #include <stack>
+#include <type_traits>
 #include <iostream>
 #include <chrono>
 
@@ -35,50 +46,190 @@ GLRENDER_INLINE void AABBTree::assignObj(OBJ* obj)
     this->obj_ptr_ = obj;
 }
 
+GLRENDER_INLINE void AABBTree::buildType(treeBuildType build_type)
+{
+    this->build_type_ = build_type;
+}
+
+GLRENDER_INLINE treeBuildType AABBTree::buildType()
+{
+    return this->build_type_;
+}
+
+GLRENDER_INLINE void AABBTree::numBuildThreads(int num_threads)
+{
+    this->num_build_threads_ = num_threads;
+}
+
+GLRENDER_INLINE int AABBTree::numBuildThreads()
+{
+    return this->num_build_threads_;
+}
+
+GLRENDER_INLINE void AABBTree::maxLeafSize(uint32_t max_leaf_size)
+{
+    this->max_leaf_size_ = std::max(max_leaf_size, (uint32_t) 1);
+}
+
+GLRENDER_INLINE uint32_t AABBTree::maxLeafSize()
+{
+    return this->max_leaf_size_;
+}
+
+GLRENDER_INLINE void AABBTree::branchWidth(int width)
+{
+    this->branch_width_ = (width >= 4) ? 4 : 2;
+}
+
+GLRENDER_INLINE int AABBTree::branchWidth()
+{
+    return this->branch_width_;
+}
+
 GLRENDER_INLINE void AABBTree::calcTree()
 {
     clearTree();
 
-    std::vector<tinyobj::index_t*> f_idx_list;
+    buildTree();
+
+    initGLBuffers();
+}
+
+GLRENDER_INLINE bool AABBTree::refit()
+{
+    if (nodes_.empty())
+        return false;
 
-    for (int s = 0; s < obj_ptr_->shapes_.size(); s++)
+    // the triangle count changed so the ranges are no longer valid
+    if (obj_ptr_->tri_cache_.size() != prim_idx_.size())
     {
-        int index_offset = 0;
-        for (int f = 0; f < obj_ptr_->shapes_[s].mesh.num_face_vertices.size(); f++)
-        {
-            if (obj_ptr_->shapes_[s].mesh.num_face_vertices[f] != 3)
-            {
-                index_offset += obj_ptr_->shapes_[s].mesh.num_face_vertices[f];
-                continue;
-            }
+        calcTree();
+        return true;
+    }
 
-            for (int v = 0; v < 3; v++)
-            {
-                f_idx_list.push_back(&(obj_ptr_->shapes_[s].mesh.indices[index_offset + v]));
-            }
+    auto t1 = std::chrono::high_resolution_clock::now();
 
-            index_offset += 3;
-        }
+    calcBoundsBottomUp();
+    calcWideNodes();
+
+    // the gaps stored along a collisionQuery front were measured
+    // on the old bounds
+    build_count_ += 1;
+
+    sah_cost_ = calcSAHCost();
+
+    bool is_rebuilt = false;
+    if (sah_cost_ > rebuild_threshold_ * build_sah_cost_)
+    {
+        calcTree();
+        is_rebuilt = true;
     }
 
-    head_ = calcTree(f_idx_list);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<float, std::milli> refit_time = t2 - t1;
+    refit_time_ = refit_time.count();
 
-    initGLBuffers();
+    return is_rebuilt;
+}
+
+GLRENDER_INLINE void AABBTree::rebuildThreshold(float threshold)
+{
+    this->rebuild_threshold_ = threshold;
+}
+
+GLRENDER_INLINE float AABBTree::rebuildThreshold()
+{
+    return this->rebuild_threshold_;
 }
 
 GLRENDER_INLINE void AABBTree::clearTree()
 {
-    clearTree(head_);
     glRelease();
-    head_ = NULL;
+    build_count_ += 1;
+    std::vector<AABBNode>().swap(nodes_);
+    std::vector<AABBWideNode>().swap(wide_nodes_);
+    std::vector<uint32_t>().swap(prim_idx_);
+    std::vector<bool>().swap(is_intersect_);
     num_aabb_ = 0;
     total_mem_ = 0;
     num_primitives_ = 0;
+    sah_cost_ = 0;
+    build_sah_cost_ = 0;
+    build_time_ = 0;
+    refit_time_ = 0;
+    num_leaves_ = 0;
+    avg_leaf_size_ = 0;
     N_v_ = 0;
     C_v_ = 0;
+    N_p_ = 0;
+    C_p_ = 0;
     num_leaf_overlap_ = 0;
 }
 
+GLRENDER_INLINE bool AABBTree::saveTree(const std::string& path, uint64_t mesh_hash)
+{
+    if (path.empty() || nodes_.empty())
+        return false;
+
+    return treeCache::write(path, cacheHeader(mesh_hash), nodes_.data(), prim_idx_.data());
+}
+
+GLRENDER_INLINE bool AABBTree::loadTree(const std::string& path, uint64_t mesh_hash)
+{
+    static_assert(std::is_trivially_copyable<AABBNode>::value, "AABBNode is written to the tree cache as raw bytes");
+
+    if (path.empty() || obj_ptr_->tri_cache_.size() == 0)
+        return false;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    treeCache::mappedFile file;
+    if (!file.open(path) || !treeCache::validate(file, cacheHeader(mesh_hash)))
+        return false;
+
+    clearTree();
+
+    treeCacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    const char* data = file.data() + sizeof(header);
+
+    num_primitives_ = header.num_primitives_;
+
+    nodes_.resize(header.num_nodes_);
+    std::memcpy(nodes_.data(), data, nodes_.size() * sizeof(AABBNode));
+    data += nodes_.size() * sizeof(AABBNode);
+
+    prim_idx_.resize(header.num_primitives_);
+    std::memcpy(prim_idx_.data(), data, prim_idx_.size() * sizeof(uint32_t));
+
+    file.close();
+
+    calcDiagnostics();
+
+    auto t2 = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<float, std::milli> build_time = t2 - t1;
+    build_time_ = build_time.count();
+
+    initGLBuffers();
+
+    return true;
+}
+
+GLRENDER_INLINE treeCacheHeader AABBTree::cacheHeader(uint64_t mesh_hash)
+{
+    treeCacheHeader header;
+    header.version_ = treeCache::VERSION;
+    header.tree_type_ = treeCache::AABB_TREE;
+    header.build_type_ = build_type_;
+    header.max_leaf_size_ = max_leaf_size_;
+    header.node_size_ = sizeof(AABBNode);
+    header.mesh_hash_ = mesh_hash;
+    header.num_nodes_ = nodes_.size();
+    header.num_primitives_ = obj_ptr_->tri_cache_.size();
+
+    return header;
+}
+
 GLRENDER_INLINE void AABBTree::draw()
 {
     AABBTree::aabb_shader_.use();
@@ -105,14 +256,7 @@ GLRENDER_INLINE void AABBTree::initGLBuffers()
     vao_list_.clear();
     vbo_list_.clear();
 
-    initGLBuffers(head_);
-
-    is_loaded_into_gl_ = true;
-}
-
-GLRENDER_INLINE void AABBTree::initGLBuffers(AABBNode* node)
-{
-    if (node==NULL)
+    if (nodes_.empty())
         return;
 
 	std::vector<float> vertex_data;
@@ -129,21 +273,12 @@ GLRENDER_INLINE void AABBTree::initGLBuffers(AABBNode* node)
 
     glm::vec3 v1, v2, v3, v4;
 
-    std::stack<AABBNode*> node_stack;
-
-    node_stack.push(node);
-
-    // int num_AABB = 0;
-    while (!node_stack.empty())
+    for (uint32_t n = 0; n < nodes_.size(); n++)
     {
-        node = node_stack.top();
-        node_stack.pop();
-        // num_AABB += 1;
-        // printf("\rAABBs added to GPU: %i", num_AABB);
-        // fflush(stdout);
+        const AABBNode* node = &nodes_[n];
         glm::vec3 color;
         float scale = 1;
-        if (node->is_intersect)
+        if (is_intersect_[n])
         {
             color = glm::vec3(0, 1, 0);
             scale = 1.01;
@@ -151,11 +286,6 @@ GLRENDER_INLINE void AABBTree::initGLBuffers(AABBNode* node)
         else
             color = glm::vec3(0, 0, 0);
 
-        if (node->left_ != NULL)
-            node_stack.push(node->left_);
-        if (node->right_ != NULL)
-            node_stack.push(node->right_);
-
         // top
         v1 = node->center_ + glm::vec3(0,node->extent_.y,0) + glm::vec3(node->extent_.x, 0, -node->extent_.z);
         v1 *= scale;
@@ -273,7 +403,7 @@ GLRENDER_INLINE void AABBTree::initGLBuffers(AABBNode* node)
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
 
-    // printf("\n");
+    is_loaded_into_gl_ = true;
 }
 
 GLRENDER_INLINE void AABBTree::glRelease()
@@ -295,466 +425,1810 @@ GLRENDER_INLINE AABBTree::~AABBTree()
     clearTree();
 }
 
-GLRENDER_INLINE AABBNode* AABBTree::calcTree(std::vector<tinyobj::index_t*> f_idx_list)
+GLRENDER_INLINE void AABBTree::buildTree()
 {
-    if (f_idx_list.size() == 0)
-        return NULL;
+    if (obj_ptr_->tri_cache_.size() == 0)
+        return;
 
-    AABBNode* head = new AABBNode;
+    auto t1 = std::chrono::high_resolution_clock::now();
 
-    std::stack<AABBNode*> node_stack;
-    std::stack<std::vector<tinyobj::index_t*>> f_idx_list_stack;
+    num_primitives_ = obj_ptr_->tri_cache_.size();
 
-    node_stack.push(head);
-    f_idx_list_stack.push(f_idx_list);
+    prim_idx_.resize(num_primitives_);
+    for (uint32_t f = 0; f < prim_idx_.size(); f++)
+        prim_idx_[f] = f;
 
-    num_aabb_ = 0;
-    total_mem_ = 0;
-    num_primitives_ = f_idx_list.size()/3;
+    std::unique_ptr<threadPool> pool;
+    if (num_build_threads_ != 1)
+        pool.reset(new threadPool(num_build_threads_));
 
-    while (!node_stack.empty())
-    {
-        AABBNode* node = node_stack.top();
-        node_stack.pop();
-        num_aabb_ += 1;
-        total_mem_ += sizeof(*node);
+    if (build_type_ == MORTON_SPLIT)
+        calcMortonCodes(pool.get());
 
-        node->tree_ = this;
+    AABBSubTree tree;
 
-        f_idx_list = f_idx_list_stack.top();
-        f_idx_list_stack.pop();
+    calcSubTree(0, num_primitives_, pool.get(), &tree);
+    if (pool)
+        pool->wait();
 
-        float minP[3];
-        float maxP[3];
+    if (tree.sub_trees_.empty())
+        nodes_ = std::move(tree.nodes_);
+    else
+    {
+        nodes_.reserve(2*num_primitives_ - 1);
+        spliceSubTree(&tree);
+    }
 
-        glm::vec3 p;
-        for (int i = 0; i < 3; i++)
-        {
-            p[i] = obj_ptr_->attrib_.vertices[3 * f_idx_list[0]->vertex_index + i];
-        }
-        // p = glm::vec3(obj_ptr_->modelMatrix() * glm::vec4(p, 1.0f));
-        for (int i = 0; i < 3; i++)
-        {
-            minP[i] = p[i];
-            maxP[i] = p[i];
-        }
+    if (build_type_ == MORTON_SPLIT)
+    {
+        calcBoundsBottomUp();
+        std::vector<uint32_t>().swap(morton_codes_);
+    }
 
-        int f_num = f_idx_list.size()/3;
-        for (int f = 0; f < f_num; f++)
-        {
-            for (int v = 0; v < 3; v++)
-            {
-                for (int i = 0; i < 3; i++)
-                {
-                    p[i] = obj_ptr_->attrib_.vertices[3 * f_idx_list[3*f + v]->vertex_index + i];
-                }
-                // p = glm::vec3(obj_ptr_->modelMatrix() * glm::vec4(p, 1.0f));
-                for (int i = 0; i < 3; i++)
-                {
-                    float v_i = p[i];
-                    if (v_i > maxP[i])
-                        maxP[i] = v_i;
-                    if (v_i < minP[i])
-                        minP[i] = v_i;
-                }
-            }
-        }
+    calcDiagnostics();
 
-        glm::vec3 center{
-            (maxP[0] + minP[0])/2,
-            (maxP[1] + minP[1])/2,
-            (maxP[2] + minP[2])/2
-        };
+    auto t2 = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<float, std::milli> build_time = t2 - t1;
+    build_time_ = build_time.count();
+}
 
-        node->center_ = center;
+GLRENDER_INLINE void AABBTree::calcDiagnostics()
+{
+    calcWideNodes();
 
-        glm::vec3 extent{
-            (maxP[0] - minP[0])/2,
-            (maxP[1] - minP[1])/2,
-            (maxP[2] - minP[2])/2
-        };
+    is_intersect_.assign(nodes_.size(), false);
 
-        node->extent_ = extent;
+    num_aabb_ = nodes_.size();
+    num_leaves_ = 0;
+    for (const AABBNode& node : nodes_)
+    {
+        if (node.isLeaf())
+            num_leaves_ += 1;
+    }
+    avg_leaf_size_ = num_primitives_ / (float) num_leaves_;
+    total_mem_ = num_aabb_ * sizeof(AABBNode) + wide_nodes_.size() * sizeof(AABBWideNode) + prim_idx_.size() * sizeof(uint32_t);
+    sah_cost_ = calcSAHCost();
+    build_sah_cost_ = sah_cost_;
+}
 
-        if (f_num == 1)
-            continue;
+GLRENDER_INLINE void AABBTree::calcSubTree(uint32_t begin, uint32_t end, threadPool* pool, AABBSubTree* sub_tree)
+{
+    struct BuildEntry
+    {
+        uint32_t parent;
+        bool is_left;
+        uint32_t begin, end;
+        AABBSubTree* spawned; // set when another task builds this subtree
+    };
 
-        enum PlaneSep {
-            XY,
-            YZ,
-            ZX
-        };
-
-        PlaneSep plane_sep;
-        if (extent.x >= extent.y && extent.x >= extent.z)
-            plane_sep = YZ;
-        else if (extent.y >= extent.x && extent.y >= extent.z)
-            plane_sep = ZX;
-        else if (extent.z >= extent.x && extent.z >= extent.y)
-            plane_sep = XY;
-
-        float delta; // loacation of splitting plane
-        std::vector<float> axis_vals;
-        for (int f = 0; f < f_num; f++)
-        {
-            glm::vec3 centroid{
-                0,
-                0,
-                0
-            };
-
-            for (int v = 0; v < 3; v++)
-            {
-                glm::vec3 tmp{
-                    obj_ptr_->attrib_.vertices[3 * f_idx_list[3*f + v]->vertex_index + 0],
-                    obj_ptr_->attrib_.vertices[3 * f_idx_list[3*f + v]->vertex_index + 1],
-                    obj_ptr_->attrib_.vertices[3 * f_idx_list[3*f + v]->vertex_index + 2]
-                };
+    std::vector<AABBNode>& nodes = sub_tree->nodes_;
+    nodes.reserve(2*(end - begin));
 
-                // tmp = glm::vec3(obj_ptr_->modelMatrix() * glm::vec4(tmp, 1.0f));
+    std::stack<BuildEntry> entry_stack;
+    entry_stack.push({AABBNode::NULL_IDX, true, begin, end, NULL});
 
-                centroid += tmp;
-            }
+    while (!entry_stack.empty())
+    {
+        BuildEntry entry = entry_stack.top();
+        entry_stack.pop();
 
-            centroid /= 3;
+        // nodes are added in depth first order
+        uint32_t node_idx = nodes.size();
+        nodes.push_back(AABBNode());
 
-            switch (plane_sep)
-            {
-            case YZ:
-                axis_vals.push_back(centroid.x);
-                break;
-            case ZX:
-                axis_vals.push_back(centroid.y);
-                break;
-            case XY:
-                axis_vals.push_back(centroid.z);
-                break;
-            }
+        if (entry.parent != AABBNode::NULL_IDX)
+        {
+            if (entry.is_left)
+                nodes[entry.parent].left_ = node_idx;
+            else
+                nodes[entry.parent].right_ = node_idx;
         }
 
-        std::sort(axis_vals.data(), axis_vals.data() + axis_vals.size());
-        if (axis_vals.size()%2 == 1)
+        AABBNode* node = &nodes[node_idx];
+        node->begin_ = entry.begin;
+        node->end_ = entry.end;
+
+        if (entry.spawned != NULL)
         {
-            delta = axis_vals[axis_vals.size()/2];
+            sub_tree->slots_.push_back(node_idx);
+            sub_tree->sub_trees_.emplace_back(entry.spawned);
+            continue;
         }
-        else
+
+        // morton trees get their bounds once the whole tree is built
+        if (build_type_ != MORTON_SPLIT)
         {
-            delta = axis_vals[axis_vals.size()/2 - 1] + axis_vals[axis_vals.size()/2];
-            delta /= 2;
+            glm::vec3 min_p, max_p;
+            calcNodeBounds(node, min_p, max_p);
         }
-        bool split_evenly = false;
-        if (axis_vals[0] == axis_vals[axis_vals.size() - 1])
-            split_evenly = true;
 
-        std::vector<tinyobj::index_t*> f_idx_list_l;
-        std::vector<tinyobj::index_t*> f_idx_list_r;
-        for (int f = 0; f < f_num; f++)
+        if (entry.end - entry.begin <= max_leaf_size_)
+            continue;
+
+        uint32_t mid;
+        if (build_type_ == SAH_SPLIT)
+            mid = splitSAH(entry.begin, entry.end);
+        else if (build_type_ == MORTON_SPLIT)
+            mid = splitMorton(entry.begin, entry.end);
+        else
+            mid = splitMedian(entry.begin, entry.end, node->extent_);
+
+        // large subtrees are handed to the pool, the split only depends
+        // on the triangles in the range so the tree is the same as a serial build
+        //
+        // the right child is pushed first so the left child is popped next
+        // and ends up directly after its parent
+        uint32_t child_ranges[2][2] = {{mid, entry.end}, {entry.begin, mid}};
+        for (int c = 0; c < 2; c++)
         {
+            uint32_t child_begin = child_ranges[c][0];
+            uint32_t child_end = child_ranges[c][1];
+            bool is_left = (c == 1);
 
-            if (split_evenly)
-            {
-                for (int v = 0; v < 3; v++)
-                    if (f < f_num/2)
-                        f_idx_list_l.push_back(f_idx_list[3*f + v]);
-                    else
-                        f_idx_list_r.push_back(f_idx_list[3*f + v]);
+            if (child_begin == child_end)
                 continue;
-            }
-            
-            glm::vec3 centroid{
-                0,
-                0,
-                0
-            };
-
-            for (int v = 0; v < 3; v++)
-            {
-                glm::vec3 tmp{
-                    obj_ptr_->attrib_.vertices[3 * f_idx_list[3*f + v]->vertex_index + 0],
-                    obj_ptr_->attrib_.vertices[3 * f_idx_list[3*f + v]->vertex_index + 1],
-                    obj_ptr_->attrib_.vertices[3 * f_idx_list[3*f + v]->vertex_index + 2]
-                };
-
-                // tmp = glm::vec3(obj_ptr_->modelMatrix() * glm::vec4(tmp, 1.0f));
-
-                centroid += tmp;
-            }
-
-            centroid /= 3;
 
-            switch (plane_sep)
+            if (pool != NULL && child_end - child_begin >= PARALLEL_MIN_PRIMITIVES)
             {
-            case YZ:
-                if ( (centroid.x >= delta && axis_vals[0] != delta) || centroid.x > delta )
-                    for (int v = 0; v < 3; v++)
-                        f_idx_list_r.push_back(f_idx_list[3*f + v]);
-                else
-                    for (int v = 0; v < 3; v++)
-                        f_idx_list_l.push_back(f_idx_list[3*f + v]);
-                break;
-            case ZX:
-                if ( (centroid.y >= delta && axis_vals[0] != delta) || centroid.y > delta )
-                    for (int v = 0; v < 3; v++)
-                        f_idx_list_r.push_back(f_idx_list[3*f + v]);
-                else
-                    for (int v = 0; v < 3; v++)
-                        f_idx_list_l.push_back(f_idx_list[3*f + v]);
-                break;
-            case XY:
-                if ( (centroid.z >= delta && axis_vals[0] != delta) || centroid.z > delta )
-                    for (int v = 0; v < 3; v++)
-                        f_idx_list_r.push_back(f_idx_list[3*f + v]);
-                else
-                    for (int v = 0; v < 3; v++)
-                        f_idx_list_l.push_back(f_idx_list[3*f + v]);
-                break;
+                AABBSubTree* spawned = new AABBSubTree;
+                pool->submit([this, spawned, child_begin, child_end, pool] () {
+                    calcSubTree(child_begin, child_end, pool, spawned);
+                });
+                entry_stack.push({node_idx, is_left, child_begin, child_end, spawned});
             }
+            else
+                entry_stack.push({node_idx, is_left, child_begin, child_end, NULL});
         }
+    }
+}
 
+GLRENDER_INLINE void AABBTree::spliceSubTree(AABBSubTree* sub_tree)
+{
+    std::vector<uint32_t> global_idx(sub_tree->nodes_.size());
 
-        if (f_idx_list_l.size() != 0)
-        {
-            node->left_ = new AABBNode;
-            f_idx_list_stack.push(f_idx_list_l);
-            node_stack.push(node->left_);
-        }
-        if (f_idx_list_r.size() != 0)
+    size_t slot = 0;
+    for (uint32_t n = 0; n < sub_tree->nodes_.size(); n++)
+    {
+        global_idx[n] = nodes_.size();
+
+        if (slot < sub_tree->slots_.size() && sub_tree->slots_[slot] == n)
         {
-            node->right_ = new AABBNode;
-            f_idx_list_stack.push(f_idx_list_r);
-            node_stack.push(node->right_);
+            spliceSubTree(sub_tree->sub_trees_[slot].get());
+            slot += 1;
         }
+        else
+            nodes_.push_back(sub_tree->nodes_[n]);
     }
 
-    return head;
+    // placeholders have no children of their own so only
+    // nodes built by this task need their children remapped
+    for (uint32_t n = 0; n < sub_tree->nodes_.size(); n++)
+    {
+        const AABBNode& node = sub_tree->nodes_[n];
+        if (node.left_ != AABBNode::NULL_IDX)
+            nodes_[global_idx[n]].left_ = global_idx[node.left_];
+        if (node.right_ != AABBNode::NULL_IDX)
+            nodes_[global_idx[n]].right_ = global_idx[node.right_];
+    }
 }
 
-GLRENDER_INLINE void AABBTree::clearTree(AABBNode* node)
+GLRENDER_INLINE void AABBTree::calcNodeBounds(AABBNode* node, glm::vec3& min_p, glm::vec3& max_p)
 {
-    if (node == NULL)
-        return;
-    
-    clearTree(node->left_);
-    clearTree(node->right_);
+    const triangleCache& tris = obj_ptr_->tri_cache_;
 
-    delete node;
-};
+    // node bounds are the union of the cached triangle bounds
+    float minP[3];
+    float maxP[3];
 
-GLRENDER_INLINE bool AABBTree::intersectTest(AABBTree* other_tree)
-{
+    for (int i = 0; i < 3; i++)
+    {
+        const float* tri_min = tris.min_[i].data();
+        const float* tri_max = tris.max_[i].data();
 
-    this->clearIntersectTest();
-    other_tree->clearIntersectTest();
+        minP[i] = tri_min[prim_idx_[node->begin_]];
+        maxP[i] = tri_max[prim_idx_[node->begin_]];
+        for (uint32_t f = node->begin_ + 1; f < node->end_; f++)
+        {
+            minP[i] = std::min(minP[i], tri_min[prim_idx_[f]]);
+            maxP[i] = std::max(maxP[i], tri_max[prim_idx_[f]]);
+        }
+    }
 
-    std::stack<AABBNode*> node_stack;
-    std::stack<glm::vec3*> axes_stack;
+    glm::vec3 center{
+        (maxP[0] + minP[0])/2,
+        (maxP[1] + minP[1])/2,
+        (maxP[2] + minP[2])/2
+    };
 
-    node_stack.push(this->head_);
-    node_stack.push(other_tree->head_);
+    node->center_ = center;
 
-    bool is_intersect = false;
+    glm::vec3 extent{
+        (maxP[0] - minP[0])/2,
+        (maxP[1] - minP[1])/2,
+        (maxP[2] - minP[2])/2
+    };
 
-    glm::vec3 scale_A;
-    glm::quat rot_A;
-    glm::vec3 trans_A;
-    glm::vec3 skew_A;
-    glm::vec4 persp_A;
-    glm::decompose(this->obj_ptr_->modelMatrix(), scale_A, rot_A, trans_A, skew_A, persp_A);
-    glm::vec3 A1 = rot_A * glm::vec3(1, 0, 0);
-    glm::vec3 A2 = rot_A * glm::vec3(0, 1, 0);
-    glm::vec3 A3 = rot_A * glm::vec3(0, 0, 1);
-    glm::vec3 axes_this[3] {A1, A2, A3};
-    axes_stack.push(axes_this);
-
-    glm::vec3 scale_B;
-    glm::quat rot_B;
-    glm::vec3 trans_B;
-    glm::vec3 skew_B;
-    glm::vec4 persp_B;
-    glm::decompose(other_tree->obj_ptr_->modelMatrix(), scale_B, rot_B, trans_B, skew_B, persp_B);
-    glm::vec3 B1 = rot_B * glm::vec3(1, 0, 0);
-    glm::vec3 B2 = rot_B * glm::vec3(0, 1, 0);
-    glm::vec3 B3 = rot_B * glm::vec3(0, 0, 1);
-    glm::vec3 axes_other[3] {B1, B2, B3};
-    axes_stack.push(axes_other);
+    node->extent_ = extent;
 
-    N_v_ = 0;
-    C_v_ = 0;
-    num_leaf_overlap_ = 0;
+    min_p = glm::vec3(minP[0], minP[1], minP[2]);
+    max_p = glm::vec3(maxP[0], maxP[1], maxP[2]);
+}
 
-    while (!node_stack.empty())
+GLRENDER_INLINE void AABBTree::calcBoundsBottomUp()
+{
+    std::vector<glm::vec3> min_p(nodes_.size());
+    std::vector<glm::vec3> max_p(nodes_.size());
+
+    // children are always stored after their parent
+    for (uint32_t n = nodes_.size(); n-- > 0;)
     {
-        AABBNode* A = node_stack.top();
-        node_stack.pop();
-        glm::vec3* axis_A = axes_stack.top();
-        axes_stack.pop();
+        AABBNode& node = nodes_[n];
 
-        AABBNode* B = node_stack.top();
-        node_stack.pop();
-        glm::vec3* axis_B = axes_stack.top();
-        axes_stack.pop();
-        
-        if (A == NULL || B == NULL)
+        if (node.isLeaf())
+        {
+            calcNodeBounds(&node, min_p[n], max_p[n]);
             continue;
+        }
 
-        if (A->left_ == NULL && A->right_ == NULL && B->left_ == NULL && B->right_ == NULL)
+        min_p[n] = glm::vec3(FLT_MAX);
+        max_p[n] = glm::vec3(-FLT_MAX);
+        uint32_t children[2] = {node.left_, node.right_};
+        for (uint32_t child : children)
         {
-            A = A;
+            if (child == AABBNode::NULL_IDX)
+                continue;
+            min_p[n] = glm::min(min_p[n], min_p[child]);
+            max_p[n] = glm::max(max_p[n], max_p[child]);
         }
 
-        N_v_ += 1;
+        node.center_ = (max_p[n] + min_p[n])/2.f;
+        node.extent_ = (max_p[n] - min_p[n])/2.f;
+    }
+}
 
-        auto t1 = std::chrono::high_resolution_clock::now();
-        bool is_box_overlap = intersectTest(A, axis_A, B, axis_B);
-        auto t2 = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<float, std::milli> time_overlap_test = t2 - t1;
+GLRENDER_INLINE void AABBTree::calcWideNodes()
+{
+    std::vector<AABBWideNode>().swap(wide_nodes_);
 
-        C_v_ += time_overlap_test.count();
+    if (branch_width_ != 4 || nodes_.empty() || nodes_[0].isLeaf())
+        return;
 
-        if (is_box_overlap)
+    struct WideEntry
+    {
+        uint32_t node; // binary node whose descendants fill the wide node
+        uint32_t wide;
+    };
+
+    wide_nodes_.reserve(nodes_.size()/3 + 1);
+    wide_nodes_.push_back(AABBWideNode());
+
+    std::stack<WideEntry> entry_stack;
+    entry_stack.push({0, 0});
+
+    while (!entry_stack.empty())
+    {
+        WideEntry entry = entry_stack.top();
+        entry_stack.pop();
+
+        uint32_t children[4];
+        int num_children = 0;
+
+        const AABBNode& node = nodes_[entry.node];
+        if (node.left_ != AABBNode::NULL_IDX)
+            children[num_children++] = node.left_;
+        if (node.right_ != AABBNode::NULL_IDX)
+            children[num_children++] = node.right_;
+
+        // open the inner child with the largest surface area until
+        // there are four children or only leaves are left
+        while (num_children < 4)
         {
-            if (A->left_ == NULL && A->right_ == NULL && B->left_ == NULL && B->right_ == NULL)
+            int open = -1;
+            float max_area = -1;
+            for (int c = 0; c < num_children; c++)
             {
-                A->is_intersect = true;
-                B->is_intersect = true;
-                is_intersect = true;
-                num_leaf_overlap_ += 1;
-            }
+                const AABBNode& child = nodes_[children[c]];
+                if (child.isLeaf())
+                    continue;
 
-            if ( (A->left_ != NULL || A->right_ != NULL) && ( A->volume() > B->volume() || (B->left_ == NULL && B->right_ == NULL) ) )
-            {
-                if (A->left_ != NULL)
+                float area = surfaceArea(child.center_ - child.extent_, child.center_ + child.extent_);
+                if (area > max_area)
                 {
-                    node_stack.push(B);
-                    axes_stack.push(axis_B);
-                    node_stack.push(A->left_);
-                    axes_stack.push(axis_A);
+                    max_area = area;
+                    open = c;
                 }
+            }
 
-                if (A->right_ != NULL)
-                {
-                    node_stack.push(B);
-                    axes_stack.push(axis_B);
-                    node_stack.push(A->right_);
-                    axes_stack.push(axis_A);
-                }
+            if (open < 0)
+                break;
+
+            const AABBNode& opened = nodes_[children[open]];
+            uint32_t left = opened.left_;
+            uint32_t right = opened.right_;
+            if (left != AABBNode::NULL_IDX && right != AABBNode::NULL_IDX)
+            {
+                children[open] = left;
+                children[num_children++] = right;
             }
             else
-            {
-                if (B->left_ != NULL)
-                {
-                    node_stack.push(A);
-                    axes_stack.push(axis_A);
-                    node_stack.push(B->left_);
-                    axes_stack.push(axis_B);
-                }
+                children[open] = (left != AABBNode::NULL_IDX) ? left : right;
+        }
 
-                if (B->right_ != NULL)
-                {
-                    node_stack.push(A);
-                    axes_stack.push(axis_A);
-                    node_stack.push(B->right_);
-                    axes_stack.push(axis_B);
-                }
+        AABBWideNode& wide = wide_nodes_[entry.wide];
+        wide.num_children_ = num_children;
+        for (int c = 0; c < 4; c++)
+        {
+            bool is_child = (c < num_children);
+            for (int i = 0; i < 3; i++)
+            {
+                wide.center_[i][c] = is_child ? nodes_[children[c]].center_[i] : 0.0f;
+                wide.extent_[i][c] = is_child ? nodes_[children[c]].extent_[i] : 0.0f;
             }
+            wide.node_[c] = is_child ? children[c] : AABBNode::NULL_IDX;
+            wide.wide_[c] = AABBNode::NULL_IDX;
+        }
+
+        // pushed in reverse so the first child's wide node comes next
+        for (int c = num_children; c-- > 0;)
+        {
+            if (nodes_[children[c]].isLeaf())
+                continue;
+
+            uint32_t wide_idx = wide_nodes_.size();
+            wide_nodes_[entry.wide].wide_[c] = wide_idx;
+            wide_nodes_.push_back(AABBWideNode());
+            entry_stack.push({children[c], wide_idx});
         }
     }
+}
+
+GLRENDER_INLINE uint32_t AABBTree::splitMedian(uint32_t begin, uint32_t end, glm::vec3 extent)
+{
+    int axis; // normal of the splitting plane
+    if (extent.x >= extent.y && extent.x >= extent.z)
+        axis = 0;
+    else if (extent.y >= extent.x && extent.y >= extent.z)
+        axis = 1;
+    else
+        axis = 2;
+
+    uint32_t* first = prim_idx_.data() + begin;
+    uint32_t* last = prim_idx_.data() + end;
+    uint32_t f_num = end - begin;
+
+    const float* centroid = obj_ptr_->tri_cache_.centroid_[axis].data();
+    auto axis_val = [centroid] (uint32_t f) {
+        return centroid[f];
+    };
+
+    // only the median is needed, not a full sort
+    uint32_t* median = first + f_num/2;
+    std::nth_element(first, median, last, [&axis_val] (uint32_t a, uint32_t b) {
+        return axis_val(a) < axis_val(b);
+    });
+
+    float delta = axis_val(*median); // loacation of splitting plane
+    float min_val = delta;
+    float max_val = delta;
+    float lower_val = -FLT_MAX; // largest value below the median
+    for (uint32_t* f = first; f != last; f++)
+    {
+        float val = axis_val(*f);
+        min_val = std::min(min_val, val);
+        max_val = std::max(max_val, val);
+        if (f < median)
+            lower_val = std::max(lower_val, val);
+    }
 
-    C_v_ /= (float) N_v_;
+    if (f_num%2 == 0)
+        delta = (lower_val + delta) / 2;
 
-    other_tree->N_v_ = this->N_v_;
-    other_tree->C_v_ = this->C_v_;
-    other_tree->num_leaf_overlap_ = this->num_leaf_overlap_;
-    
-    return is_intersect;
+    // all centroids are the same so just split the range in half
+    if (min_val == max_val)
+        return begin + f_num/2;
+
+    uint32_t* split = std::partition(first, last, [&] (uint32_t f) {
+        float val = axis_val(f);
+        return !( (val >= delta && min_val != delta) || val > delta );
+    });
+
+    return begin + (split - first);
 }
 
-//doesn't support scaled matrix yet
-GLRENDER_INLINE bool AABBTree::intersectTest(AABBNode* A, glm::vec3 axis_A[3], AABBNode* B, glm::vec3 axis_B[3])
+GLRENDER_INLINE uint32_t AABBTree::splitSAH(uint32_t begin, uint32_t end)
 {
+    const triangleCache& tris = obj_ptr_->tri_cache_;
 
-    glm::vec3 L; // separating axis
+    glm::vec3 c_min(FLT_MAX);
+    glm::vec3 c_max(-FLT_MAX);
 
     for (int i = 0; i < 3; i++)
     {
-        L = axis_A[i];
-        L = glm::normalize(L);
+        const float* centroid = tris.centroid_[i].data();
+        for (uint32_t f = begin; f < end; f++)
+        {
+            c_min[i] = std::min(c_min[i], centroid[prim_idx_[f]]);
+            c_max[i] = std::max(c_max[i], centroid[prim_idx_[f]]);
+        }
+    }
 
-        float r_A = std::abs( glm::dot(A->extent_.x * axis_A[0], L) );
-        r_A += std::abs( glm::dot(A->extent_.y * axis_A[1], L) );
-        r_A += std::abs( glm::dot(A->extent_.z * axis_A[2], L) );
+    struct SAHBin
+    {
+        glm::vec3 min_{FLT_MAX};
+        glm::vec3 max_{-FLT_MAX};
+        int count_ = 0;
+    };
+
+    // every axis is binned in the same pass over the triangles
+    SAHBin bins[3][SAH_NUM_BINS];
+    glm::vec3 bin_scale;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float c_extent = c_max[axis] - c_min[axis];
+        bin_scale[axis] = c_extent > 0 ? SAH_NUM_BINS / c_extent : 0;
+    }
 
-        float r_B = std::abs( glm::dot(B->extent_.x * axis_B[0], L) );
-        r_B += std::abs( glm::dot(B->extent_.y * axis_B[1], L) );
-        r_B += std::abs( glm::dot(B->extent_.z * axis_B[2], L) );
+    for (uint32_t f = begin; f < end; f++)
+    {
+        uint32_t t = prim_idx_[f];
+        glm::vec3 f_min = tris.minP(t);
+        glm::vec3 f_max = tris.maxP(t);
+        glm::vec3 c = tris.centroid(t);
 
-        glm::vec3 T = glm::vec3(B->tree_->obj_ptr_->modelMatrix() * glm::vec4(B->center_,1)) - glm::vec3(A->tree_->obj_ptr_->modelMatrix() * glm::vec4(A->center_,1));
+        for (int axis = 0; axis < 3; axis++)
+        {
+            int b = std::min((int) ((c[axis] - c_min[axis]) * bin_scale[axis]), SAH_NUM_BINS - 1);
+            bins[axis][b].min_ = glm::min(bins[axis][b].min_, f_min);
+            bins[axis][b].max_ = glm::max(bins[axis][b].max_, f_max);
+            bins[axis][b].count_ += 1;
+        }
+    }
 
-        if ( std::abs(glm::dot(T, L)) > (r_A + r_B) )
-            return false;
+    float best_cost = FLT_MAX;
+    int best_axis = -1;
+    int best_split = 0;
 
-        L = axis_B[i];
-        L = glm::normalize(L);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (bin_scale[axis] == 0)
+            continue;
 
-        r_A = std::abs( glm::dot(A->extent_.x * axis_A[0], L) );
-        r_A += std::abs( glm::dot(A->extent_.y * axis_A[1], L) );
-        r_A += std::abs( glm::dot(A->extent_.z * axis_A[2], L) );
+        // sweep from the right to get the cost of every right hand side
+        float area_r[SAH_NUM_BINS];
+        int count_r[SAH_NUM_BINS];
+        SAHBin acc;
+        for (int b = SAH_NUM_BINS - 1; b > 0; b--)
+        {
+            acc.min_ = glm::min(acc.min_, bins[axis][b].min_);
+            acc.max_ = glm::max(acc.max_, bins[axis][b].max_);
+            acc.count_ += bins[axis][b].count_;
+            area_r[b] = surfaceArea(acc.min_, acc.max_);
+            count_r[b] = acc.count_;
+        }
 
-        r_B = std::abs( glm::dot(B->extent_.x * axis_B[0], L) );
-        r_B += std::abs( glm::dot(B->extent_.y * axis_B[1], L) );
-        r_B += std::abs( glm::dot(B->extent_.z * axis_B[2], L) );
+        // sweep from the left and evaluate each split plane between bins
+        acc = SAHBin();
+        for (int b = 1; b < SAH_NUM_BINS; b++)
+        {
+            acc.min_ = glm::min(acc.min_, bins[axis][b-1].min_);
+            acc.max_ = glm::max(acc.max_, bins[axis][b-1].max_);
+            acc.count_ += bins[axis][b-1].count_;
 
-        T = glm::vec3(B->tree_->obj_ptr_->modelMatrix() * glm::vec4(B->center_,1)) - glm::vec3(A->tree_->obj_ptr_->modelMatrix() * glm::vec4(A->center_,1));
+            if (acc.count_ == 0 || count_r[b] == 0)
+                continue;
 
-        if ( std::abs(glm::dot(T, L)) > (r_A + r_B) )
-            return false;
+            float cost = surfaceArea(acc.min_, acc.max_) * acc.count_ + area_r[b] * count_r[b];
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = b;
+            }
+        }
     }
 
-    for (int i = 0; i < 3; i++)
-    {    
-        for (int j = 0; j < 3; j++)
-        {
-            L = glm::cross(axis_A[i], axis_B[j]);
-            if (glm::length(L) == 0)
-                continue;
-            L = glm::normalize(L);
-
-            float r_A = std::abs( glm::dot(A->extent_.x * axis_A[0], L) );
-            r_A += std::abs( glm::dot(A->extent_.y * axis_A[1], L) );
-            r_A += std::abs( glm::dot(A->extent_.z * axis_A[2], L) );
+    // all centroids are the same so just split the range in half
+    if (best_axis == -1)
+        return begin + (end - begin)/2;
 
-            float r_B = std::abs( glm::dot(B->extent_.x * axis_B[0], L) );
-            r_B += std::abs( glm::dot(B->extent_.y * axis_B[1], L) );
-            r_B += std::abs( glm::dot(B->extent_.z * axis_B[2], L) );
+    uint32_t* first = prim_idx_.data() + begin;
+    uint32_t* last = prim_idx_.data() + end;
 
-            glm::vec3 T = glm::vec3(B->tree_->obj_ptr_->modelMatrix() * glm::vec4(B->center_,1)) - glm::vec3(A->tree_->obj_ptr_->modelMatrix() * glm::vec4(A->center_,1));
+    const float* centroid = tris.centroid_[best_axis].data();
+    uint32_t* split = std::partition(first, last, [&] (uint32_t f) {
+        int b = std::min((int) ((centroid[f] - c_min[best_axis]) * bin_scale[best_axis]), SAH_NUM_BINS - 1);
+        return b < best_split;
+    });
 
-            if ( std::abs(glm::dot(T, L)) > (r_A + r_B) )
-                return false;
-        }
-    }
+    return begin + (split - first);
+}
 
-    return true;    
+GLRENDER_INLINE uint32_t AABBTree::splitMorton(uint32_t begin, uint32_t end)
+{
+    uint32_t first_code = morton_codes_[begin];
+    uint32_t last_code = morton_codes_[end - 1];
+
+    // identical codes so just split the range in half
+    if (first_code == last_code)
+        return begin + (end - begin)/2;
+
+    // the codes are sorted so the highest bit that differs between the
+    // first and last code is 0 for the left child and 1 for the right
+    uint32_t diff = first_code ^ last_code;
+    uint32_t bit = 1u << 31;
+    while ((diff & bit) == 0)
+        bit >>= 1;
+
+    const uint32_t* first = morton_codes_.data() + begin;
+    const uint32_t* last = morton_codes_.data() + end;
+    const uint32_t* split = std::partition_point(first, last, [bit] (uint32_t code) {
+        return (code & bit) == 0;
+    });
+
+    return begin + (split - first);
 }
 
-GLRENDER_INLINE void AABBTree::clearIntersectTest()
+GLRENDER_INLINE void AABBTree::calcMortonCodes(threadPool* pool)
 {
-    std::stack<AABBNode*> node_stack;
-    node_stack.push(head_);
+    const triangleCache& tris = obj_ptr_->tri_cache_;
 
-    while (!node_stack.empty())
+    glm::vec3 c_min(FLT_MAX);
+    glm::vec3 c_max(-FLT_MAX);
+
+    for (int i = 0; i < 3; i++)
+    {
+        const float* centroid = tris.centroid_[i].data();
+        for (uint32_t f = 0; f < tris.size(); f++)
+        {
+            c_min[i] = std::min(c_min[i], centroid[f]);
+            c_max[i] = std::max(c_max[i], centroid[f]);
+        }
+    }
+
+    glm::vec3 c_scale;
+    for (int i = 0; i < 3; i++)
+        c_scale[i] = c_max[i] > c_min[i] ? 1.f / (c_max[i] - c_min[i]) : 0;
+
+    morton_codes_.resize(num_primitives_);
+    for (uint32_t f = 0; f < morton_codes_.size(); f++)
+        morton_codes_[f] = mortonCode((tris.centroid(prim_idx_[f]) - c_min) * c_scale);
+
+    radixSort(morton_codes_, prim_idx_, pool);
+}
+
+GLRENDER_INLINE uint32_t AABBTree::mortonCode(glm::vec3 p)
+{
+    // spread the lower 10 bits of x so there are two zeros between each bit
+    auto expandBits = [] (uint32_t x) {
+        x = (x * 0x00010001u) & 0xFF0000FFu;
+        x = (x * 0x00000101u) & 0x0F00F00Fu;
+        x = (x * 0x00000011u) & 0xC30C30C3u;
+        x = (x * 0x00000005u) & 0x49249249u;
+        return x;
+    };
+
+    uint32_t code = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        float v = std::min(std::max(p[i] * 1024.f, 0.f), 1023.f);
+        code |= expandBits((uint32_t) v) << (2 - i);
+    }
+
+    return code;
+}
+
+GLRENDER_INLINE void AABBTree::radixSort(std::vector<uint32_t>& keys, std::vector<uint32_t>& values, threadPool* pool)
+{
+    const int RADIX_BITS = 8;
+    const int RADIX_SIZE = 1 << RADIX_BITS;
+
+    size_t n = keys.size();
+
+    // every chunk is counted and scattered by its own task, chunks
+    // are written in order so the sort stays stable
+    int num_chunks = 1;
+    if (pool != NULL && n >= PARALLEL_MIN_PRIMITIVES)
+        num_chunks = pool->numThreads();
+    size_t chunk_size = (n + num_chunks - 1) / num_chunks;
+
+    std::vector<uint32_t> keys_tmp(n);
+    std::vector<uint32_t> values_tmp(n);
+    std::vector<size_t> offsets(num_chunks * RADIX_SIZE);
+
+    auto forEachChunk = [&] (const std::function<void(size_t, size_t, int)>& task) {
+        for (int c = 0; c < num_chunks; c++)
+        {
+            size_t begin = std::min(c * chunk_size, n);
+            size_t end = std::min(begin + chunk_size, n);
+            if (num_chunks == 1)
+                task(begin, end, c);
+            else
+                pool->submit([&task, begin, end, c] () {task(begin, end, c);});
+        }
+        if (num_chunks > 1)
+            pool->wait();
+    };
+
+    // morton codes only use the lower 30 bits
+    for (int shift = 0; shift < 30; shift += RADIX_BITS)
+    {
+        std::fill(offsets.begin(), offsets.end(), 0);
+
+        forEachChunk([&] (size_t begin, size_t end, int c) {
+            size_t* count = &offsets[c * RADIX_SIZE];
+            for (size_t k = begin; k < end; k++)
+                count[(keys[k] >> shift) & (RADIX_SIZE - 1)] += 1;
+        });
+
+        // turn the counts into where each chunk writes each digit
+        size_t sum = 0;
+        for (int d = 0; d < RADIX_SIZE; d++)
+        {
+            for (int c = 0; c < num_chunks; c++)
+            {
+                size_t count = offsets[c * RADIX_SIZE + d];
+                offsets[c * RADIX_SIZE + d] = sum;
+                sum += count;
+            }
+        }
+
+        forEachChunk([&] (size_t begin, size_t end, int c) {
+            size_t* offset = &offsets[c * RADIX_SIZE];
+            for (size_t k = begin; k < end; k++)
+            {
+                size_t dst = offset[(keys[k] >> shift) & (RADIX_SIZE - 1)]++;
+                keys_tmp[dst] = keys[k];
+                values_tmp[dst] = values[k];
+            }
+        });
+
+        keys.swap(keys_tmp);
+        values.swap(values_tmp);
+    }
+}
+
+GLRENDER_INLINE float AABBTree::calcSAHCost()
+{
+    if (nodes_.empty())
+        return 0;
+
+    float root_area = surfaceArea(nodes_[0].center_ - nodes_[0].extent_, nodes_[0].center_ + nodes_[0].extent_);
+
+    float cost = 0;
+
+    for (const AABBNode& node : nodes_)
+    {
+        float area = surfaceArea(node.center_ - node.extent_, node.center_ + node.extent_);
+
+        if (node.isLeaf())
+            cost += SAH_INTERSECT_COST * area * (node.end_ - node.begin_);
+        else
+            cost += SAH_TRAVERSAL_COST * area;
+    }
+
+    // a flat mesh along an axis plane still has area, only a
+    // single point or line can give zero here
+    if (root_area == 0)
+        return cost;
+
+    return cost / root_area;
+}
+
+GLRENDER_INLINE float AABBTree::surfaceArea(glm::vec3 min_p, glm::vec3 max_p)
+{
+    glm::vec3 d = max_p - min_p;
+    return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+GLRENDER_INLINE bool AABBTree::intersectTest(const AABBTree* other_tree, collisionQuery& query) const
+{
+    query.reset(this->nodes_.size(), other_tree->nodes_.size());
+
+    if (this->nodes_.empty() || other_tree->nodes_.empty())
+        return false;
+
+    bool is_intersect = false;
+
+    glm::mat4 model_A = this->obj_ptr_->modelMatrix();
+    glm::mat4 model_B = other_tree->obj_ptr_->modelMatrix();
+    glm::vec3 axis_A[3];
+    glm::vec3 axis_B[3];
+    objectAxes(model_A, axis_A);
+    objectAxes(model_B, axis_B);
+
+    AABBPairFrame frame = calcPairFrame(axis_A, model_A, axis_B, model_B);
+
+    bool is_wide = !this->wide_nodes_.empty() && !other_tree->wide_nodes_.empty();
+
+    if (query.pool_ != NULL)
+        is_intersect = intersectTestParallel(other_tree, frame, is_wide, query);
+    else if (query.keep_front_)
+        is_intersect = intersectTestFront(other_tree, frame, query);
+    else if (is_wide)
+    {
+        // pairs given to intersectTestWide() are known to overlap
+        query.N_v_ += 1;
+        if (intersectTest(this->nodes_[0], other_tree->nodes_[0], frame))
+            is_intersect = intersectTestWide(other_tree, frame, {0, 0, 0, 0}, query, NULL);
+    }
+    else
+        is_intersect = intersectTestBinary(other_tree, frame, {0, 0, 0, 0}, query, NULL);
+
+    query.finish();
+
+    return is_intersect;
+}
+
+GLRENDER_INLINE bool AABBTree::intersectTestBinary(const AABBTree* other_tree, const AABBPairFrame& frame, NodePair start, collisionQuery& query, std::vector<NodePair>* split) const
+{
+    bool is_intersect = false;
+
+    // node pairs, the first index is from this tree
+    // and the second from other_tree
+    std::stack<uint32_t> node_stack;
+
+    node_stack.push(start.a_node);
+    node_stack.push(start.b_node);
+
+    auto push_pair = [&] (uint32_t a_idx, uint32_t b_idx, bool is_split) {
+        if (is_split)
+            split->push_back({a_idx, 0, b_idx, 0});
+        else
+        {
+            node_stack.push(a_idx);
+            node_stack.push(b_idx);
+        }
+    };
+
+    while (!node_stack.empty())
+    {
+        uint32_t b_idx = node_stack.top();
+        node_stack.pop();
+        uint32_t a_idx = node_stack.top();
+        node_stack.pop();
+
+        const AABBNode& A = this->nodes_[a_idx];
+        const AABBNode& B = other_tree->nodes_[b_idx];
+
+        // children of a pair too big for one task go to split
+        bool is_split = (split != NULL && (A.end_ - A.begin_) + (B.end_ - B.begin_) >= PARALLEL_MIN_PRIMITIVES);
+
+        query.N_v_ += 1;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+        bool is_box_overlap = intersectTest(A, B, frame);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<float, std::milli> time_overlap_test = t2 - t1;
+
+        query.C_v_ += time_overlap_test.count();
+
+        if (is_box_overlap)
+        {
+            if (A.isLeaf() && B.isLeaf())
+            {
+                // overlapping leaves only count if their triangles do
+                if (!intersectLeaves(A, other_tree, B, frame, query))
+                    continue;
+
+                query.markLeaves(a_idx, b_idx);
+                is_intersect = true;
+                continue;
+            }
+
+            // descend into the bigger volume
+            if ( !A.isLeaf() && ( A.volume() > B.volume() || B.isLeaf() ) )
+            {
+                if (A.left_ != AABBNode::NULL_IDX)
+                    push_pair(A.left_, b_idx, is_split);
+                if (A.right_ != AABBNode::NULL_IDX)
+                    push_pair(A.right_, b_idx, is_split);
+            }
+            else
+            {
+                if (B.left_ != AABBNode::NULL_IDX)
+                    push_pair(a_idx, B.left_, is_split);
+                if (B.right_ != AABBNode::NULL_IDX)
+                    push_pair(a_idx, B.right_, is_split);
+            }
+        }
+    }
+
+    // split holds the children in push order, the stack would have
+    // visited them the other way round
+    if (split != NULL)
+        std::reverse(split->begin(), split->end());
+
+    return is_intersect;
+}
+
+GLRENDER_INLINE bool AABBTree::intersectTestFront(const AABBTree* other_tree, const AABBPairFrame& frame, collisionQuery& query) const
+{
+    if (!query.isFrontValid(this, this->build_count_, other_tree, other_tree->build_count_))
+        query.resetFront(this, this->build_count_, other_tree, other_tree->build_count_);
+
+    // every point of either tree is within its radius of its origin
+    const AABBNode& root_A = this->nodes_[0];
+    const AABBNode& root_B = other_tree->nodes_[0];
+    float radius_A = glm::length(root_A.center_) + glm::length(root_A.extent_);
+    float radius_B = glm::length(root_B.center_) + glm::length(root_B.extent_);
+    float motion = query.frontMotion(frame.M_A_, radius_A, frame.M_B_, frame.T_, radius_B);
+
+    const std::vector<collisionQuery::frontPair>& front = query.front_;
+    bool is_from_root = (front.size() == 1 && front[0].a_node_ == 0 && front[0].b_node_ == 0);
+
+    // objects that moved apart are caught by the roots alone
+    // instead of every pair of a deep front
+    if (!is_from_root)
+    {
+        query.N_v_ += 1;
+        float gap;
+        int axis = separatingAxis(root_A, root_B, frame, -1, gap);
+        if (axis >= 0)
+        {
+            query.resetFront(this, this->build_count_, other_tree, other_tree->build_count_);
+            query.front_[0] = {0, 0, axis, gap, query.frontMotion(frame.M_A_, radius_A, frame.M_B_, frame.T_, radius_B)};
+            return false;
+        }
+    }
+
+    bool is_intersect = false;
+
+    std::vector<collisionQuery::frontPair>& next_front = query.nextFront();
+
+    // pushed from the back so pairs come off the stack in the order
+    // they were found, which is the order a full traversal visits them
+    std::stack<collisionQuery::frontPair> pair_stack;
+    for (auto pair = front.rbegin(); pair != front.rend(); ++pair)
+        pair_stack.push(*pair);
+
+    while (!pair_stack.empty())
+    {
+        collisionQuery::frontPair pair = pair_stack.top();
+        pair_stack.pop();
+
+        // the objects have not moved far enough to close the gap yet
+        if (pair.gap_ > 0 && motion - pair.motion_ < pair.gap_)
+        {
+            next_front.push_back(pair);
+            query.num_front_skipped_ += 1;
+            continue;
+        }
+
+        const AABBNode& A = this->nodes_[pair.a_node_];
+        const AABBNode& B = other_tree->nodes_[pair.b_node_];
+
+        query.N_v_ += 1;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+        float gap = 0;
+        int axis = separatingAxis(A, B, frame, pair.axis_, gap);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<float, std::milli> time_overlap_test = t2 - t1;
+
+        query.C_v_ += time_overlap_test.count();
+
+        // separated pairs and leaf pairs are where the traversal stops
+        if (axis >= 0)
+        {
+            next_front.push_back({pair.a_node_, pair.b_node_, axis, gap, motion});
+            continue;
+        }
+
+        if (A.isLeaf() && B.isLeaf())
+        {
+            // overlapping leaves whose triangles are apart get a gap too
+            float leaf_gap = 0;
+            if (intersectLeaves(A, other_tree, B, frame, query))
+            {
+                query.markLeaves(pair.a_node_, pair.b_node_);
+                is_intersect = true;
+            }
+            else
+                leaf_gap = leafGap(leafOf(A), other_tree->leafOf(B), frame.M_A_, frame.M_B_, frame.T_);
+
+            next_front.push_back({pair.a_node_, pair.b_node_, -1, leaf_gap, motion});
+            continue;
+        }
+
+        // descend into the bigger volume, children in the same
+        // order as intersectTestBinary()
+        if ( !A.isLeaf() && ( A.volume() > B.volume() || B.isLeaf() ) )
+        {
+            if (A.left_ != AABBNode::NULL_IDX)
+                pair_stack.push({A.left_, pair.b_node_, -1, 0, 0});
+            if (A.right_ != AABBNode::NULL_IDX)
+                pair_stack.push({A.right_, pair.b_node_, -1, 0, 0});
+        }
+        else
+        {
+            if (B.left_ != AABBNode::NULL_IDX)
+                pair_stack.push({pair.a_node_, B.left_, -1, 0, 0});
+            if (B.right_ != AABBNode::NULL_IDX)
+                pair_stack.push({pair.a_node_, B.right_, -1, 0, 0});
+        }
+    }
+
+    query.swapFront(is_from_root);
+
+    return is_intersect;
+}
+
+GLRENDER_INLINE bool AABBTree::intersectTestParallel(const AABBTree* other_tree, const AABBPairFrame& frame, bool is_wide, collisionQuery& query) const
+{
+    // one task per pair of the traversal front, each with its own
+    // query and contact buffer, pairs covering fewer triangles than
+    // PARALLEL_MIN_PRIMITIVES are traversed by a single task
+    struct PairTask
+    {
+        NodePair pair_;
+        collisionQuery query_;
+        std::vector<contactPair> contacts_;
+        bool is_intersect_ = false;
+
+        // in the order the serial traversal visits them
+        std::vector<std::unique_ptr<PairTask>> children_;
+    };
+
+    threadPool* pool = query.pool_;
+
+    std::function<void(PairTask*)> run_task = [&] (PairTask* task) {
+        task->query_.list_leaves_ = query.mark_nodes_;
+        if (query.contacts_ != NULL)
+        {
+            task->query_.contacts_ = &task->contacts_;
+            task->query_.max_contacts_ = query.max_contacts_;
+        }
+
+        std::vector<NodePair> split;
+        if (is_wide)
+            task->is_intersect_ = intersectTestWide(other_tree, frame, task->pair_, task->query_, &split);
+        else
+            task->is_intersect_ = intersectTestBinary(other_tree, frame, task->pair_, task->query_, &split);
+
+        for (const NodePair& pair : split)
+        {
+            task->children_.push_back(std::unique_ptr<PairTask>(new PairTask()));
+            task->children_.back()->pair_ = pair;
+        }
+        for (auto& child : task->children_)
+        {
+            PairTask* child_task = child.get();
+            pool->submit([&run_task, child_task] () {run_task(child_task);});
+        }
+    };
+
+    if (is_wide)
+    {
+        // pairs given to intersectTestWide() are known to overlap
+        query.N_v_ += 1;
+        if (!intersectTest(this->nodes_[0], other_tree->nodes_[0], frame))
+            return false;
+    }
+
+    PairTask root;
+    root.pair_ = {0, 0, 0, 0};
+    run_task(&root);
+    pool->wait();
+
+    // merged depth first so the results are the ones of the serial
+    // traversal, whichever thread ran each task
+    bool is_intersect = false;
+
+    std::stack<const PairTask*> task_stack;
+    task_stack.push(&root);
+
+    while (!task_stack.empty())
+    {
+        const PairTask* task = task_stack.top();
+        task_stack.pop();
+
+        const collisionQuery& task_query = task->query_;
+        query.N_v_ += task_query.N_v_;
+        query.C_v_ += task_query.C_v_;
+        query.N_p_ += task_query.N_p_;
+        query.C_p_ += task_query.C_p_;
+        query.num_leaf_overlap_ += task_query.num_leaf_overlap_;
+
+        for (size_t l = 0; l < task_query.leaf_pairs_.size(); l += 2)
+        {
+            query.is_intersect_A_[task_query.leaf_pairs_[l]] = true;
+            query.is_intersect_B_[task_query.leaf_pairs_[l + 1]] = true;
+        }
+
+        for (const contactPair& contact : task->contacts_)
+        {
+            if (!query.isCollecting())
+                break;
+            query.contacts_->push_back(contact);
+        }
+
+        is_intersect = is_intersect || task->is_intersect_;
+
+        for (size_t c = task->children_.size(); c-- > 0;)
+            task_stack.push(task->children_[c].get());
+    }
+
+    return is_intersect;
+}
+
+GLRENDER_INLINE bool AABBTree::intersectTest(AABBTree* other_tree)
+{
+    collisionQuery query;
+    return intersectTestAndMark(other_tree, query);
+}
+
+GLRENDER_INLINE bool AABBTree::contactTest(AABBTree* other_tree, std::vector<contactPair>& contacts, size_t max_contacts)
+{
+    collisionQuery query(&contacts, max_contacts);
+    return intersectTestAndMark(other_tree, query);
+}
+
+GLRENDER_INLINE bool AABBTree::intersectTestAndMark(AABBTree* other_tree, collisionQuery& query)
+{
+    query.mark_nodes_ = true;
+    bool is_intersect = intersectTest(other_tree, query);
+
+    this->is_intersect_.swap(query.is_intersect_A_);
+    other_tree->is_intersect_.swap(query.is_intersect_B_);
+
+    for (AABBTree* tree : {this, other_tree})
+    {
+        tree->N_v_ = query.N_v_;
+        tree->C_v_ = query.C_v_;
+        tree->N_p_ = query.N_p_;
+        tree->C_p_ = query.C_p_;
+        tree->num_leaf_overlap_ = query.num_leaf_overlap_;
+    }
+
+    return is_intersect;
+}
+
+GLRENDER_INLINE float AABBTree::distanceTest(const AABBTree* other_tree, distanceQuery& query) const
+{
+    if (this->nodes_.empty() || other_tree->nodes_.empty())
+    {
+        query.reset();
+        return query.distance_;
+    }
+
+    return distanceTest(other_tree, this->obj_ptr_->modelMatrix(), other_tree->obj_ptr_->modelMatrix(), query);
+}
+
+GLRENDER_INLINE float AABBTree::distanceTest(const AABBTree* other_tree, const glm::mat4& model_A, const glm::mat4& model_B, distanceQuery& query) const
+{
+    query.reset();
+
+    if (this->nodes_.empty() || other_tree->nodes_.empty())
+        return query.distance_;
+
+    glm::vec3 axis_A[3];
+    glm::vec3 axis_B[3];
+    objectAxes(model_A, axis_A);
+    objectAxes(model_B, axis_B);
+
+    AABBPairFrame frame = calcPairFrame(axis_A, model_A, axis_B, model_B);
+
+    // closest points found so far, in A's frame
+    glm::vec3 point_A;
+    glm::vec3 point_B;
+
+    std::vector<distanceQuery::nodePair>& queue = query.queue_;
+
+    query.N_v_ += 1;
+    queue.push_back({distanceBound(this->nodes_[0], other_tree->nodes_[0], frame), 0, 0});
+
+    while (!queue.empty())
+    {
+        std::pop_heap(queue.begin(), queue.end());
+        distanceQuery::nodePair pair = queue.back();
+        queue.pop_back();
+
+        // every pair left is at least this far apart
+        if (pair.bound_ >= query.distance_)
+            break;
+
+        const AABBNode& A = this->nodes_[pair.a_node_];
+        const AABBNode& B = other_tree->nodes_[pair.b_node_];
+
+        if (A.isLeaf() && B.isLeaf())
+        {
+            distanceLeaves(leafOf(A), other_tree->leafOf(B), frame.M_A_, frame.M_B_, frame.T_, query, point_A, point_B);
+            if (query.distance_ <= query.tolerance_)
+                break;
+            continue;
+        }
+
+        // descend into the bigger volume
+        bool open_A = !A.isLeaf() && ( A.volume() > B.volume() || B.isLeaf() );
+        const AABBNode& opened = open_A ? A : B;
+
+        for (uint32_t child : {opened.left_, opened.right_})
+        {
+            if (child == AABBNode::NULL_IDX)
+                continue;
+
+            uint32_t a_idx = open_A ? child : pair.a_node_;
+            uint32_t b_idx = open_A ? pair.b_node_ : child;
+
+            query.N_v_ += 1;
+            float bound = distanceBound(this->nodes_[a_idx], other_tree->nodes_[b_idx], frame);
+            if (bound >= query.distance_)
+                continue;
+
+            queue.push_back({bound, a_idx, b_idx});
+            std::push_heap(queue.begin(), queue.end());
+        }
+
+        query.max_queue_size_ = std::max(query.max_queue_size_, (int) queue.size());
+    }
+
+    if (query.distance_ < query.max_distance_)
+    {
+        glm::vec3 origin = glm::vec3(model_A[3]);
+        query.point_A_ = origin + axis_A[0] * point_A.x + axis_A[1] * point_A.y + axis_A[2] * point_A.z;
+        query.point_B_ = origin + axis_A[0] * point_B.x + axis_A[1] * point_B.y + axis_A[2] * point_B.z;
+    }
+
+    return query.distance_;
+}
+
+GLRENDER_INLINE leafTriangles AABBTree::leafOf(const AABBNode& node) const
+{
+    return {&obj_ptr_->tri_cache_, prim_idx_.data(), node.begin_, node.end_};
+}
+
+GLRENDER_INLINE void AABBTree::objectAxes(const glm::mat4& model, glm::vec3 axes[3])
+{
+    glm::vec3 scale;
+    glm::quat rot;
+    glm::vec3 trans;
+    glm::vec3 skew;
+    glm::vec4 persp;
+    glm::decompose(model, scale, rot, trans, skew, persp);
+
+    axes[0] = rot * glm::vec3(1, 0, 0);
+    axes[1] = rot * glm::vec3(0, 1, 0);
+    axes[2] = rot * glm::vec3(0, 0, 1);
+}
+
+GLRENDER_INLINE bool AABBTree::raycast(const glm::vec3& origin, const glm::vec3& dir, float t_max, rayHit& hit) const
+{
+    return traceRay(origin, dir, t_max, false, hit);
+}
+
+GLRENDER_INLINE bool AABBTree::raycastAny(const glm::vec3& origin, const glm::vec3& dir, float t_max) const
+{
+    rayHit hit;
+    return traceRay(origin, dir, t_max, true, hit);
+}
+
+GLRENDER_INLINE bool AABBTree::traceRay(const glm::vec3& origin, const glm::vec3& dir, float t_max, bool any_hit, rayHit& hit) const
+{
+    if (this->nodes_.empty())
+        return false;
+
+    // the ray goes into the object's frame instead of every triangle
+    // into the world, t is the same along both rays
+    glm::mat4 inv_model = glm::inverse(this->obj_ptr_->modelMatrix());
+    glm::vec3 local_origin = glm::vec3(inv_model * glm::vec4(origin, 1.0f));
+    glm::vec3 local_dir = glm::vec3(inv_model * glm::vec4(dir, 0.0f));
+
+    float t_best = t_max;
+    return traceSubTree(0, local_origin, local_dir, any_hit, t_best, hit);
+}
+
+GLRENDER_INLINE bool AABBTree::traceSubTree(uint32_t start, const glm::vec3& origin, const glm::vec3& dir, bool any_hit, float& t_best, rayHit& hit) const
+{
+    glm::vec3 inv_dir = 1.0f / dir;
+    bool is_hit = false;
+
+    // a node and where the ray enters its box
+    struct rayEntry
+    {
+        uint32_t node;
+        float t_enter;
+    };
+
+    std::stack<rayEntry> entries;
+
+    float t_start;
+    if (rayBoxTest(this->nodes_[start], origin, inv_dir, t_best, t_start))
+        entries.push({start, t_start});
+
+    while (!entries.empty())
+    {
+        rayEntry entry = entries.top();
+        entries.pop();
+
+        // a closer hit was found since the box was pushed
+        if (entry.t_enter > t_best)
+            continue;
+
+        const AABBNode& node = this->nodes_[entry.node];
+
+        if (node.isLeaf())
+        {
+            if (rayLeaf(node, origin, dir, any_hit, t_best, hit))
+            {
+                is_hit = true;
+                if (any_hit)
+                    return true;
+            }
+            continue;
+        }
+
+        // the nearer child goes on top so it is visited first
+        float t_left = FLT_MAX;
+        float t_right = FLT_MAX;
+        bool is_left = (node.left_ != AABBNode::NULL_IDX) && rayBoxTest(this->nodes_[node.left_], origin, inv_dir, t_best, t_left);
+        bool is_right = (node.right_ != AABBNode::NULL_IDX) && rayBoxTest(this->nodes_[node.right_], origin, inv_dir, t_best, t_right);
+
+        if (is_left && is_right && t_left <= t_right)
+        {
+            entries.push({node.right_, t_right});
+            entries.push({node.left_, t_left});
+        }
+        else
+        {
+            if (is_left)
+                entries.push({node.left_, t_left});
+            if (is_right)
+                entries.push({node.right_, t_right});
+        }
+    }
+
+    return is_hit;
+}
+
+GLRENDER_INLINE bool AABBTree::rayLeaf(const AABBNode& node, const glm::vec3& origin, const glm::vec3& dir, bool any_hit, float& t_best, rayHit& hit) const
+{
+    const triangleCache& tris = this->obj_ptr_->tri_cache_;
+    bool is_hit = false;
+
+    for (uint32_t f = node.begin_; f < node.end_; f++)
+    {
+        uint32_t t_idx = this->prim_idx_[f];
+        glm::vec3 tri[3] = {tris.vertex(t_idx, 0), tris.vertex(t_idx, 1), tris.vertex(t_idx, 2)};
+
+        float t, u, v;
+        if (!rayTriangleIntersect(origin, dir, tri, t_best, t, u, v))
+            continue;
+
+        is_hit = true;
+        t_best = t;
+        hit = {t, tris.shape_idx_[t_idx], tris.face_idx_[t_idx], u, v};
+        if (any_hit)
+            break;
+    }
+
+    return is_hit;
+}
+
+GLRENDER_INLINE bool AABBTree::rayBoxTest(const AABBNode& node, const glm::vec3& origin, const glm::vec3& inv_dir, float t_max, float& t_enter)
+{
+    // slab test, an axis the ray is parallel to has an infinite
+    // inv_dir and gives -inf, inf when the origin is inside the slab
+    float t_min = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        float t_0 = (node.center_[i] - node.extent_[i] - origin[i]) * inv_dir[i];
+        float t_1 = (node.center_[i] + node.extent_[i] - origin[i]) * inv_dir[i];
+        if (t_0 > t_1)
+            std::swap(t_0, t_1);
+
+        // written so a NaN from 0 * inf leaves the interval alone
+        t_min = (t_0 > t_min) ? t_0 : t_min;
+        t_max = (t_1 < t_max) ? t_1 : t_max;
+        if (t_min > t_max)
+            return false;
+    }
+
+    t_enter = t_min;
+    return true;
+}
+
+GLRENDER_INLINE int AABBTree::raycastBatch(rayQuery& query) const
+{
+    query.reset();
+
+    size_t num_rays = query.origins_.size();
+    if (this->nodes_.empty() || num_rays == 0)
+        return 0;
+
+    glm::mat4 inv_model = glm::inverse(this->obj_ptr_->modelMatrix());
+
+    size_t num_packets = (num_rays + RAY_PACKET_SIZE - 1) / RAY_PACKET_SIZE;
+    query.num_packets_ = (int) num_packets;
+
+    // traces packets [begin, end), every packet writes its own hits
+    auto trace = [this, &query, &inv_model, num_rays] (size_t begin, size_t end, int& num_diverged) {
+        for (size_t p = begin; p < end; p++)
+        {
+            size_t first = p * RAY_PACKET_SIZE;
+            int num_packet_rays = (int) std::min<size_t>(RAY_PACKET_SIZE, num_rays - first);
+
+            glm::vec3 origin[RAY_PACKET_SIZE];
+            glm::vec3 dir[RAY_PACKET_SIZE];
+            for (int k = 0; k < num_packet_rays; k++)
+            {
+                origin[k] = glm::vec3(inv_model * glm::vec4(query.origins_[first + k], 1.0f));
+                dir[k] = glm::vec3(inv_model * glm::vec4(query.dirs_[first + k], 0.0f));
+            }
+
+            tracePacket(origin, dir, num_packet_rays, query.t_max_, query.any_hit_, &query.hits_[first], num_diverged);
+        }
+    };
+
+    // more chunks than threads since the cost of a packet depends
+    // on how much of the mesh it passes through
+    size_t num_chunks = 1;
+    if (query.pool_ != NULL && num_packets >= 64)
+        num_chunks = std::min<size_t>(num_packets, 8 * query.pool_->numThreads());
+
+    std::vector<int> num_diverged(num_chunks, 0);
+    if (num_chunks == 1)
+    {
+        trace(0, num_packets, num_diverged[0]);
+    }
+    else
+    {
+        for (size_t c = 0; c < num_chunks; c++)
+        {
+            size_t begin = num_packets * c / num_chunks;
+            size_t end = num_packets * (c + 1) / num_chunks;
+            int* chunk_diverged = &num_diverged[c];
+            query.pool_->submit([&trace, begin, end, chunk_diverged] () {trace(begin, end, *chunk_diverged);});
+        }
+        query.pool_->wait();
+    }
+
+    for (int n : num_diverged)
+        query.num_diverged_ += n;
+    for (const rayHit& hit : query.hits_)
+        query.num_hits_ += (hit.distance_ < FLT_MAX);
+
+    return query.num_hits_;
+}
+
+GLRENDER_INLINE void AABBTree::tracePacket(const glm::vec3 origin[RAY_PACKET_SIZE], const glm::vec3 dir[RAY_PACKET_SIZE], int num_rays, float t_max, bool any_hit, rayHit hits[], int& num_diverged) const
+{
+    // structure of arrays for rayBoxTest4(), unused lanes and rays
+    // that are done get a negative t_best so no box takes them
+    float lane_origin[3][RAY_PACKET_SIZE] = {};
+    float lane_inv_dir[3][RAY_PACKET_SIZE] = {};
+    float t_best[RAY_PACKET_SIZE];
+    for (int k = 0; k < RAY_PACKET_SIZE; k++)
+    {
+        t_best[k] = (k < num_rays) ? t_max : -1.0f;
+        for (int i = 0; (k < num_rays) && (i < 3); i++)
+        {
+            lane_origin[i][k] = origin[k][i];
+            lane_inv_dir[i][k] = 1.0f / dir[k][i];
+        }
+    }
+
+    std::stack<uint32_t> node_stack;
+    node_stack.push(0);
+
+    while (!node_stack.empty())
     {
-        AABBNode* node = node_stack.top();
+        uint32_t node_idx = node_stack.top();
         node_stack.pop();
 
-        if (node == NULL)
+        const AABBNode& node = this->nodes_[node_idx];
+
+        int mask = rayBoxTest4(node, lane_origin, lane_inv_dir, t_best);
+        if (mask == 0)
+            continue;
+
+        int first_lane = 0;
+        while (!(mask & (1 << first_lane)))
+            first_lane++;
+
+        // a single ray left gains nothing from the packet, it
+        // finishes the subtree with the ordered scalar traversal
+        if (mask == (1 << first_lane) && !node.isLeaf())
+        {
+            num_diverged++;
+            if (traceSubTree(node_idx, origin[first_lane], dir[first_lane], any_hit, t_best[first_lane], hits[first_lane]) && any_hit)
+                t_best[first_lane] = -1.0f;
+            continue;
+        }
+
+        if (node.isLeaf())
+        {
+            for (int k = first_lane; k < RAY_PACKET_SIZE; k++)
+            {
+                if ((mask & (1 << k)) && rayLeaf(node, origin[k], dir[k], any_hit, t_best[k], hits[k]) && any_hit)
+                    t_best[k] = -1.0f;
+            }
+            continue;
+        }
+
+        // the child nearer along the first ray goes on top
+        uint32_t near_child = node.left_;
+        uint32_t far_child = node.right_;
+        if (near_child != AABBNode::NULL_IDX && far_child != AABBNode::NULL_IDX &&
+            glm::dot(this->nodes_[far_child].center_ - this->nodes_[near_child].center_, dir[first_lane]) < 0)
+            std::swap(near_child, far_child);
+
+        if (far_child != AABBNode::NULL_IDX)
+            node_stack.push(far_child);
+        if (near_child != AABBNode::NULL_IDX)
+            node_stack.push(near_child);
+    }
+}
+
+GLRENDER_INLINE int AABBTree::rayBoxTest4(const AABBNode& node, const float origin[3][RAY_PACKET_SIZE], const float inv_dir[3][RAY_PACKET_SIZE], const float t_max[RAY_PACKET_SIZE])
+{
+    // rayBoxTest() on four rays at once, returns the mask of the
+    // rays entering the box before their t_max
+#ifdef GLRENDER_SSE
+    __m128 t_min = _mm_setzero_ps();
+    __m128 t_far = _mm_loadu_ps(t_max);
+    for (int i = 0; i < 3; i++)
+    {
+        __m128 o = _mm_loadu_ps(origin[i]);
+        __m128 inv_d = _mm_loadu_ps(inv_dir[i]);
+        __m128 t_0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.center_[i] - node.extent_[i]), o), inv_d);
+        __m128 t_1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.center_[i] + node.extent_[i]), o), inv_d);
+
+        __m128 is_swap = _mm_cmpgt_ps(t_0, t_1);
+        __m128 t_lo = _mm_or_ps(_mm_and_ps(is_swap, t_1), _mm_andnot_ps(is_swap, t_0));
+        __m128 t_hi = _mm_or_ps(_mm_and_ps(is_swap, t_0), _mm_andnot_ps(is_swap, t_1));
+
+        // max and min return their second argument for a NaN,
+        // which leaves the interval alone like rayBoxTest() does
+        t_min = _mm_max_ps(t_lo, t_min);
+        t_far = _mm_min_ps(t_hi, t_far);
+    }
+
+    return _mm_movemask_ps(_mm_cmple_ps(t_min, t_far));
+#else
+    int hit_mask = 0;
+    for (int c = 0; c < RAY_PACKET_SIZE; c++)
+    {
+        glm::vec3 o(origin[0][c], origin[1][c], origin[2][c]);
+        glm::vec3 inv_d(inv_dir[0][c], inv_dir[1][c], inv_dir[2][c]);
+        float t_enter;
+        if (rayBoxTest(node, o, inv_d, t_max[c], t_enter))
+            hit_mask |= (1 << c);
+    }
+
+    return hit_mask;
+#endif
+}
+
+// the model matrices may scale but not shear, a box scaled along
+// the object axes is still a box along them with scaled extents
+GLRENDER_INLINE AABBPairFrame AABBTree::calcPairFrame(glm::vec3 axis_A[3], const glm::mat4& model_A, glm::vec3 axis_B[3], const glm::mat4& model_B)
+{
+    AABBPairFrame frame;
+
+    glm::vec3 T = glm::vec3(model_B[3]) - glm::vec3(model_A[3]);
+    for (int i = 0; i < 3; i++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            frame.M_A_[i][k] = glm::dot(axis_A[i], glm::vec3(model_A[k]));
+            frame.M_B_[i][k] = glm::dot(axis_A[i], glm::vec3(model_B[k]));
+            frame.R_[i][k] = glm::dot(axis_A[i], axis_B[k]);
+            frame.abs_R_[i][k] = std::abs(frame.R_[i][k]) + SAT_EPSILON;
+        }
+        frame.T_[i] = glm::dot(axis_A[i], T);
+        frame.scale_A_[i] = glm::length(glm::vec3(model_A[i]));
+        frame.scale_B_[i] = glm::length(glm::vec3(model_B[i]));
+    }
+
+    return frame;
+}
+
+GLRENDER_INLINE bool AABBTree::intersectTest(const AABBNode& A, const AABBNode& B, const AABBPairFrame& frame)
+{
+    float e_A[3];
+    float e_B[3];
+    scaledExtents(A, B, frame, e_A, e_B);
+    float t[3];
+    centerOffset(A, B, frame, t);
+
+    return separatingAxisTest(e_A, e_B, t, frame.R_, frame.abs_R_);
+}
+
+GLRENDER_INLINE void AABBTree::centerOffset(const AABBNode& A, const AABBNode& B, const AABBPairFrame& frame, float t[3])
+{
+    for (int i = 0; i < 3; i++)
+    {
+        t[i] = frame.T_[i];
+        for (int k = 0; k < 3; k++)
+            t[i] += frame.M_B_[i][k] * B.center_[k] - frame.M_A_[i][k] * A.center_[k];
+    }
+}
+
+GLRENDER_INLINE void AABBTree::scaledExtents(const AABBNode& A, const AABBNode& B, const AABBPairFrame& frame, float e_A[3], float e_B[3])
+{
+    for (int i = 0; i < 3; i++)
+    {
+        e_A[i] = A.extent_[i] * frame.scale_A_[i];
+        e_B[i] = B.extent_[i] * frame.scale_B_[i];
+    }
+}
+
+GLRENDER_INLINE int AABBTree::separatingAxis(const AABBNode& A, const AABBNode& B, const AABBPairFrame& frame, int first_axis, float& gap)
+{
+    float e_A[3];
+    float e_B[3];
+    scaledExtents(A, B, frame, e_A, e_B);
+    float t[3];
+    centerOffset(A, B, frame, t);
+
+    return glr::separatingAxis(e_A, e_B, t, frame.R_, frame.abs_R_, first_axis, gap);
+}
+
+GLRENDER_INLINE float AABBTree::distanceBound(const AABBNode& A, const AABBNode& B, const AABBPairFrame& frame)
+{
+    float e_A[3];
+    float e_B[3];
+    scaledExtents(A, B, frame, e_A, e_B);
+    float t[3];
+    centerOffset(A, B, frame, t);
+
+    return boxDistanceBound(e_A, e_B, t, frame.R_, frame.abs_R_);
+}
+
+GLRENDER_INLINE bool AABBTree::intersectTestWide(const AABBTree* other_tree, const AABBPairFrame& frame, NodePair start, collisionQuery& query, std::vector<NodePair>* split) const
+{
+    // every pair on the stack is known to overlap
+    std::stack<NodePair> pair_stack;
+    pair_stack.push(start);
+
+    bool is_intersect = false;
+
+    // the box that is not opened, copied to every lane
+    float center[3][4];
+    float extent[3][4];
+
+    while (!pair_stack.empty())
+    {
+        NodePair entry = pair_stack.top();
+        pair_stack.pop();
+
+        const AABBNode& A = this->nodes_[entry.a_node];
+        const AABBNode& B = other_tree->nodes_[entry.b_node];
+
+        if (A.isLeaf() && B.isLeaf())
+        {
+            // overlapping leaves only count if their triangles do
+            if (!intersectLeaves(A, other_tree, B, frame, query))
+                continue;
+
+            query.markLeaves(entry.a_node, entry.b_node);
+            is_intersect = true;
             continue;
+        }
+
+        // open the bigger volume
+        bool open_A = !A.isLeaf() && ( A.volume() > B.volume() || B.isLeaf() );
+
+        // children of a pair too big for one task go to split
+        bool is_split = (split != NULL && (A.end_ - A.begin_) + (B.end_ - B.begin_) >= PARALLEL_MIN_PRIMITIVES);
+
+        const AABBWideNode& wide = open_A ? this->wide_nodes_[entry.a_wide] : other_tree->wide_nodes_[entry.b_wide];
+        const AABBNode& single = open_A ? B : A;
+        for (int i = 0; i < 3; i++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                center[i][c] = single.center_[i];
+                extent[i][c] = single.extent_[i];
+            }
+        }
+
+        query.N_v_ += wide.num_children_;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+        int overlap_mask;
+        if (open_A)
+            overlap_mask = intersectTest4(wide.center_, wide.extent_, center, extent, frame);
+        else
+            overlap_mask = intersectTest4(center, extent, wide.center_, wide.extent_, frame);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<float, std::milli> time_overlap_test = t2 - t1;
+
+        query.C_v_ += time_overlap_test.count();
+
+        for (int c = wide.num_children_; c-- > 0;)
+        {
+            if (!(overlap_mask & (1 << c)))
+                continue;
+
+            NodePair child;
+            if (open_A)
+                child = {wide.node_[c], wide.wide_[c], entry.b_node, entry.b_wide};
+            else
+                child = {entry.a_node, entry.a_wide, wide.node_[c], wide.wide_[c]};
+
+            if (is_split)
+                split->push_back(child);
+            else
+                pair_stack.push(child);
+        }
+    }
+
+    // split holds the children in push order, the stack would have
+    // visited them the other way round
+    if (split != NULL)
+        std::reverse(split->begin(), split->end());
+
+    return is_intersect;
+}
+
+GLRENDER_INLINE int AABBTree::intersectTest4(const float center_A[3][4], const float extent_A[3][4], const float center_B[3][4], const float extent_B[3][4], const AABBPairFrame& frame)
+{
+    // separatingAxisTest() on four box pairs at once, without the
+    // early outs since a lane only stops when every lane has
+#ifdef GLRENDER_SSE
+    __m128 e_A[3], e_B[3], t[3];
+    for (int i = 0; i < 3; i++)
+    {
+        e_A[i] = _mm_mul_ps(_mm_loadu_ps(extent_A[i]), _mm_set1_ps(frame.scale_A_[i]));
+        e_B[i] = _mm_mul_ps(_mm_loadu_ps(extent_B[i]), _mm_set1_ps(frame.scale_B_[i]));
+    }
+
+    // B's center minus A's center
+    for (int i = 0; i < 3; i++)
+    {
+        t[i] = _mm_set1_ps(frame.T_[i]);
+        for (int k = 0; k < 3; k++)
+        {
+            t[i] = _mm_add_ps(t[i], _mm_mul_ps(_mm_set1_ps(frame.M_B_[i][k]), _mm_loadu_ps(center_B[k])));
+            t[i] = _mm_sub_ps(t[i], _mm_mul_ps(_mm_set1_ps(frame.M_A_[i][k]), _mm_loadu_ps(center_A[k])));
+        }
+    }
+
+    const __m128 sign_bit = _mm_set1_ps(-0.0f);
+    auto R = [&frame] (int i, int j) {return _mm_set1_ps(frame.R_[i][j]);};
+    auto abs_R = [&frame] (int i, int j) {return _mm_set1_ps(frame.abs_R_[i][j]);};
+
+    __m128 is_separated = _mm_setzero_ps();
+
+    // A's axes
+    for (int i = 0; i < 3; i++)
+    {
+        __m128 r = e_A[i];
+        for (int j = 0; j < 3; j++)
+            r = _mm_add_ps(r, _mm_mul_ps(abs_R(i, j), e_B[j]));
+
+        __m128 dist = _mm_andnot_ps(sign_bit, t[i]);
+        is_separated = _mm_or_ps(is_separated, _mm_cmpgt_ps(dist, r));
+    }
+
+    // B's axes
+    for (int j = 0; j < 3; j++)
+    {
+        __m128 r = e_B[j];
+        __m128 dist = _mm_setzero_ps();
+        for (int i = 0; i < 3; i++)
+        {
+            r = _mm_add_ps(r, _mm_mul_ps(abs_R(i, j), e_A[i]));
+            dist = _mm_add_ps(dist, _mm_mul_ps(R(i, j), t[i]));
+        }
+
+        dist = _mm_andnot_ps(sign_bit, dist);
+        is_separated = _mm_or_ps(is_separated, _mm_cmpgt_ps(dist, r));
+    }
+
+    // cross products of A's axis i and B's axis j
+    for (int i = 0; i < 3; i++)
+    {
+        int i1 = (i + 1) % 3;
+        int i2 = (i + 2) % 3;
+        for (int j = 0; j < 3; j++)
+        {
+            int j1 = (j + 1) % 3;
+            int j2 = (j + 2) % 3;
+
+            __m128 r = _mm_add_ps(_mm_mul_ps(e_A[i1], abs_R(i2, j)), _mm_mul_ps(e_A[i2], abs_R(i1, j)));
+            r = _mm_add_ps(r, _mm_add_ps(_mm_mul_ps(e_B[j1], abs_R(i, j2)), _mm_mul_ps(e_B[j2], abs_R(i, j1))));
+
+            __m128 dist = _mm_sub_ps(_mm_mul_ps(t[i2], R(i1, j)), _mm_mul_ps(t[i1], R(i2, j)));
+            dist = _mm_andnot_ps(sign_bit, dist);
+            is_separated = _mm_or_ps(is_separated, _mm_cmpgt_ps(dist, r));
+        }
+    }
+
+    return ~_mm_movemask_ps(is_separated) & 0xF;
+#else
+    int overlap_mask = 0;
+    for (int c = 0; c < 4; c++)
+    {
+        float e_A[3], e_B[3], t[3];
+        for (int i = 0; i < 3; i++)
+        {
+            e_A[i] = extent_A[i][c] * frame.scale_A_[i];
+            e_B[i] = extent_B[i][c] * frame.scale_B_[i];
+            t[i] = frame.T_[i];
+            for (int k = 0; k < 3; k++)
+                t[i] += frame.M_B_[i][k] * center_B[k][c] - frame.M_A_[i][k] * center_A[k][c];
+        }
+
+        if (separatingAxisTest(e_A, e_B, t, frame.R_, frame.abs_R_))
+            overlap_mask |= (1 << c);
+    }
+
+    return overlap_mask;
+#endif
+}
+
+GLRENDER_INLINE bool AABBTree::intersectLeaves(const AABBNode& A, const AABBTree* other_tree, const AABBNode& B, const AABBPairFrame& frame, collisionQuery& query) const
+{
+    const triangleCache& tris_A = this->obj_ptr_->tri_cache_;
+    const triangleCache& tris_B = other_tree->obj_ptr_->tri_cache_;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    // B's triangles are moved into A's frame a batch at a time,
+    // b[c][i][k] is axis i of corner c of the k-th triangle
+    float b[3][3][TRIANGLE_BATCH_SIZE] = {};
+    bool is_overlap = false;
+
+    // every hit is listed until the contact buffer is full,
+    // after that only the first hit matters
+    for (uint32_t f_B = B.begin_; f_B < B.end_; f_B += TRIANGLE_BATCH_SIZE)
+    {
+        int num_b = (int) std::min<uint32_t>(TRIANGLE_BATCH_SIZE, B.end_ - f_B);
+        for (int k = 0; k < num_b; k++)
+        {
+            uint32_t t_B = other_tree->prim_idx_[f_B + k];
+            for (int c = 0; c < 3; c++)
+            {
+                glm::vec3 v = tris_B.vertex(t_B, c);
+                for (int i = 0; i < 3; i++)
+                    b[c][i][k] = frame.T_[i] + frame.M_B_[i][0] * v.x + frame.M_B_[i][1] * v.y + frame.M_B_[i][2] * v.z;
+            }
+        }
+
+        for (uint32_t f_A = A.begin_; f_A < A.end_; f_A++)
+        {
+            uint32_t t_A = this->prim_idx_[f_A];
+            glm::vec3 a[3];
+            for (int c = 0; c < 3; c++)
+            {
+                glm::vec3 v = tris_A.vertex(t_A, c);
+                for (int i = 0; i < 3; i++)
+                    a[c][i] = frame.M_A_[i][0] * v.x + frame.M_A_[i][1] * v.y + frame.M_A_[i][2] * v.z;
+            }
+
+            query.N_p_ += num_b;
+            bool find_all = query.isCollecting();
+            int hit_mask = triangleIntersectBatch(a, b, num_b, find_all);
+            if (hit_mask == 0)
+                continue;
+
+            is_overlap = true;
+            if (!find_all)
+                break;
 
-        node->is_intersect = false;
+            for (int k = 0; k < num_b && query.isCollecting(); k++)
+            {
+                if (hit_mask & (1 << k))
+                {
+                    uint32_t t_B = other_tree->prim_idx_[f_B + k];
+                    query.contacts_->push_back({tris_A.shape_idx_[t_A], tris_A.face_idx_[t_A],
+                                          tris_B.shape_idx_[t_B], tris_B.face_idx_[t_B]});
+                }
+            }
+        }
 
-        node_stack.push(node->left_);
-        node_stack.push(node->right_);
+        if (is_overlap && !query.isCollecting())
+            break;
     }
+
+    auto t2 = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<float, std::milli> time_prim_test = t2 - t1;
+
+    query.C_p_ += time_prim_test.count();
+
+    return is_overlap;
 }
 
 } // namespace glr
@@ -9,8 +9,15 @@
 #include <glr/tinyobjloader/tiny_obj_loader.h>
 
 #include <glr/shader.h>
+#include <glr/tree_cache.h>
+#include <glr/collision_query.h>
+#include <glr/pair_test.h>
+#include <glr/triangle_intersect.h>
 
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
 
 
 namespace glr
@@ -18,20 +25,111 @@ namespace glr
 
 // forward declarations
 class OBJ;
-struct AABBNode;
+class threadPool;
+
+typedef enum{
+    MEDIAN_SPLIT, // split at the centroid median of the longest axis
+    SAH_SPLIT, // binned surface area heuristic
+    MORTON_SPLIT // linear BVH, split on the morton codes of the centroids
+} treeBuildType;
+
+struct AABBNode
+{
+    static const uint32_t NULL_IDX = 0xFFFFFFFF;
+
+    glm::vec3 extent_{0.0f, 0.0f, 0.0f};
+
+    glm::vec3 center_{0.0f, 0.0f, 0.0f};
+
+    // indices into AABBTree::nodes_, the left child
+    // is always stored right after its parent
+    uint32_t left_ = NULL_IDX, right_ = NULL_IDX;
+
+    // range of AABBTree::prim_idx_ holding the triangles under this node
+    uint32_t begin_ = 0, end_ = 0;
+
+    bool isLeaf() const {return (left_ == NULL_IDX && right_ == NULL_IDX);}
+
+    float volume() const {return (extent_.x * extent_.y * extent_.z * 2);}
+};
+
+// up to four children of an inner node, collapsed from the levels
+// below it in the binary tree and stored as structure of arrays
+// so one box can be tested against every child at once
+struct AABBWideNode
+{
+    float center_[3][4];
+    float extent_[3][4];
+
+    // the child in AABBTree::nodes_ and the wide node holding
+    // its own children, AABBNode::NULL_IDX for leaves
+    uint32_t node_[4];
+    uint32_t wide_[4];
+
+    uint32_t num_children_ = 0;
+};
+
+// B's boxes seen from A's frame, set up once per intersectTest()
+// so the node pair tests only read precomputed values
+struct AABBPairFrame
+{
+    // maps local centers of A and B into A's rotated frame
+    float M_A_[3][3];
+    float M_B_[3][3];
+    float T_[3];
+
+    // B's axes in A's frame and their absolute values plus
+    // AABBTree::SAT_EPSILON so near parallel axes are not separating
+    float R_[3][3];
+    float abs_R_[3][3];
+
+    // scale of each model matrix along its own axes, node extents
+    // are multiplied by it before every box test
+    float scale_A_[3];
+    float scale_B_[3];
+};
+
+// part of a tree built by one task of a parallel build,
+// spliced into AABBTree::nodes_ once every task is done
+struct AABBSubTree
+{
+    std::vector<AABBNode> nodes_;
+
+    // placeholder nodes for subtrees built by other tasks
+    std::vector<uint32_t> slots_;
+    std::vector<std::unique_ptr<AABBSubTree>> sub_trees_;
+};
 
 class AABBTree
 {
     public:
-        AABBNode* head_ = NULL;
+        // depth first order, nodes_[0] is the root
+        std::vector<AABBNode> nodes_;
+
+        // empty unless branchWidth() is 4, wide_nodes_[0] holds the
+        // children of nodes_[0]
+        std::vector<AABBWideNode> wide_nodes_;
+
+        // triangle indices into OBJ::tri_cache_, partitioned
+        // in place while building so every node owns a range
+        std::vector<uint32_t> prim_idx_;
 
         // diagnostics
         int num_aabb_;
         int num_primitives_;
         float total_mem_;
-
+        float sah_cost_ = 0; // surface area heuristic cost of the tree (lower is better)
+        float build_time_ = 0; // time taken by the last calcTree() in ms
+        float refit_time_ = 0; // time taken by the last refit() in ms, including any rebuild
+        int num_leaves_ = 0;
+        float avg_leaf_size_ = 0; // average number of triangles in a leaf
+
+        // results of the last intersectTest() or contactTest() run
+        // without a collisionQuery, queries keep their own copy
         int N_v_; // number of volume overlap tests
         float C_v_; // average time cost of volume overlap test
+        int N_p_ = 0; // number of triangle pair tests
+        float C_p_ = 0; // average time cost of a triangle pair test
         int num_leaf_overlap_ = 0; // number of leaf volumes that overlap
 
     public:
@@ -40,13 +138,89 @@ class AABBTree
         AABBTree(OBJ* obj);
 
         void assignObj(OBJ* obj);
+
+        // how the tree is split when calcTree() is called
+        void buildType(treeBuildType build_type);
+
+        treeBuildType buildType();
+
+        // number of threads used by calcTree(), 0 uses
+        // every hardware thread and 1 builds serially
+        void numBuildThreads(int num_threads);
+
+        int numBuildThreads();
+
+        // leaves hold up to max_leaf_size triangles, overlapping
+        // leaves then test the bounds of each triangle pair
+        void maxLeafSize(uint32_t max_leaf_size);
+
+        uint32_t maxLeafSize();
+
+        // 4 collapses the tree into wide_nodes_ after every build and
+        // intersectTest() then tests a box against up to four children
+        // at once when both trees are wide, 2 (the default) keeps the
+        // binary traversal
+        void branchWidth(int width);
+
+        int branchWidth();
         
         void calcTree();
 
+        // recomputes the bounds for the current triangles (see
+        // OBJ::refit()) and keeps the topology, the tree is rebuilt
+        // instead once its SAH cost grows past rebuildThreshold() times
+        // the cost right after the last build, returns true if rebuilt
+        //
+        // the GL buffers are not updated, see initGLBuffers()
+        bool refit();
+
+        void rebuildThreshold(float threshold);
+
+        float rebuildThreshold();
+
         void clearTree();
 
+        // writes the built tree to a treeCache file
+        bool saveTree(const std::string& path, uint64_t mesh_hash);
+
+        // replaces the tree with the one cached at path if it was built
+        // from the same triangles and settings, returns false otherwise
+        bool loadTree(const std::string& path, uint64_t mesh_hash);
+
+        // only reads both trees, safe to run from several threads at
+        // once as long as each has its own query and no tree is being
+        // built or refit, lists contacts if query.contacts_ is set
+        bool intersectTest(const AABBTree *other_tree, collisionQuery& query) const;
+
+        // single threaded shorthands, the intersecting leaves and the
+        // diagnostics are kept in both trees for drawing
         bool intersectTest(AABBTree *other_tree);
 
+        // also lists up to max_contacts intersecting triangle pairs,
+        // contacts is cleared first but keeps its capacity, so
+        // reserving max_contacts once avoids allocating per query
+        bool contactTest(AABBTree *other_tree, std::vector<contactPair>& contacts, size_t max_contacts);
+
+        // minimum distance between the two meshes, closest points and
+        // diagnostics go to query, thread safe like intersectTest()
+        float distanceTest(const AABBTree* other_tree, distanceQuery& query) const;
+
+        // distanceTest() with the objects at model_A and model_B
+        // instead of their modelMatrix(), see OBJ::timeOfImpact()
+        float distanceTest(const AABBTree* other_tree, const glm::mat4& model_A, const glm::mat4& model_B, distanceQuery& query) const;
+
+        // closest triangle hit by origin + t * dir with 0 <= t <= t_max,
+        // both in world space so the object's modelMatrix() is applied,
+        // thread safe like intersectTest()
+        bool raycast(const glm::vec3& origin, const glm::vec3& dir, float t_max, rayHit& hit) const;
+
+        // stops at the first triangle hit instead, for occlusion tests
+        bool raycastAny(const glm::vec3& origin, const glm::vec3& dir, float t_max) const;
+
+        // casts every ray of query, RAY_PACKET_SIZE consecutive rays
+        // at a time, returns the number of rays that hit
+        int raycastBatch(rayQuery& query) const;
+
         void draw();
 
         void glRelease();
@@ -62,45 +236,168 @@ class AABBTree
     private:
         OBJ* obj_ptr_ = NULL;
 
+        treeBuildType build_type_ = MEDIAN_SPLIT;
+        int num_build_threads_ = 1;
+        uint32_t max_leaf_size_ = 1;
+        int branch_width_ = 2;
+
+        float rebuild_threshold_ = 1.5f;
+        float build_sah_cost_ = 0; // sah_cost_ right after the last build
+
+        // bumped by clearTree() and refit(), a collisionQuery front
+        // is only valid for the bounds it was found on
+        uint32_t build_count_ = 0;
+
+        // subtrees with fewer triangles are built by the task that split them,
+        // node pairs covering fewer are traversed by a single query task
+        static const int PARALLEL_MIN_PRIMITIVES = 4096;
+
+        // SAH parameters
+        static const int SAH_NUM_BINS = 16;
+        static constexpr float SAH_TRAVERSAL_COST = 1.0f;
+        static constexpr float SAH_INTERSECT_COST = 1.0f;
+
+        // added to |R| in the separating axis tests
+        static constexpr float SAT_EPSILON = 1e-6f;
+
+        // rays traced together by raycastBatch(), one SSE register wide
+        static const int RAY_PACKET_SIZE = 4;
+
         // static AABB shader
         static std::string aabb_vs_code_;
         static std::string aabb_fs_code_;
         static shader aabb_shader_;
 
+        // morton code of each triangle in prim_idx_, only kept while building
+        std::vector<uint32_t> morton_codes_;
+
+        // one bit per node, set for intersecting leaves by the
+        // intersectTest() and contactTest() without a query
+        std::vector<bool> is_intersect_;
+
         std::vector<unsigned int> vao_list_;
         std::vector<unsigned int> vbo_list_;
         bool is_loaded_into_gl_ = false;
 
     private:
         
-        AABBNode* calcTree(std::vector<tinyobj::index_t*> f_idx_list);
+        void buildTree();
 
-        void clearTree(AABBNode* node);
+        // fills the diagnostics once nodes_ and prim_idx_ are set
+        void calcDiagnostics();
 
-        bool intersectTest(AABBNode* A, glm::vec3 axis_A[3], AABBNode* B, glm::vec3 axis_B[3]);
+        treeCacheHeader cacheHeader(uint64_t mesh_hash);
 
-        void clearIntersectTest();
+        void calcSubTree(uint32_t begin, uint32_t end, threadPool* pool, AABBSubTree* sub_tree);
 
-        void initGLBuffers();
+        void spliceSubTree(AABBSubTree* sub_tree);
 
-        void initGLBuffers(AABBNode* node);
-};
+        // bounds of a node from the triangles in its range
+        void calcNodeBounds(AABBNode* node, glm::vec3& min_p, glm::vec3& max_p);
 
-struct AABBNode
-{
-    AABBTree* tree_ = NULL;
+        // bounds of every node, children first
+        void calcBoundsBottomUp();
 
-    AABBNode *left_ = NULL, *right_ = NULL;
+        // collapses nodes_ into wide_nodes_, clears them for binary trees
+        void calcWideNodes();
 
-    glm::vec3 extent_{0.0f, 0.0f, 0.0f};
+        // both splits partition prim_idx_[begin, end) in place and
+        // return where the right child's range starts
+        uint32_t splitMedian(uint32_t begin, uint32_t end, glm::vec3 extent);
 
-    glm::vec3 center_{0.0f, 0.0f, 0.0f};
+        uint32_t splitSAH(uint32_t begin, uint32_t end);
 
-    bool is_intersect = false;
+        uint32_t splitMorton(uint32_t begin, uint32_t end);
 
-    float volume() {return (extent_.x * extent_.y * extent_.z * 2);}
-};
+        // fills morton_codes_ and sorts prim_idx_ by them
+        void calcMortonCodes(threadPool* pool);
+
+        // 30 bit code of a point in the unit cube
+        static uint32_t mortonCode(glm::vec3 p);
+
+        // stable LSD radix sort of keys, values are moved with their keys
+        static void radixSort(std::vector<uint32_t>& keys, std::vector<uint32_t>& values, threadPool* pool);
+
+        float calcSAHCost();
+
+        static float surfaceArea(glm::vec3 min_p, glm::vec3 max_p);
+
+        static AABBPairFrame calcPairFrame(glm::vec3 axis_A[3], const glm::mat4& model_A, glm::vec3 axis_B[3], const glm::mat4& model_B);
 
+        static bool intersectTest(const AABBNode& A, const AABBNode& B, const AABBPairFrame& frame);
+
+        // B's center minus A's center in A's frame
+        static void centerOffset(const AABBNode& A, const AABBNode& B, const AABBPairFrame& frame, float t[3]);
+
+        // half sizes of both boxes under their model scale
+        static void scaledExtents(const AABBNode& A, const AABBNode& B, const AABBPairFrame& frame, float e_A[3], float e_B[3]);
+
+        static int separatingAxis(const AABBNode& A, const AABBNode& B, const AABBPairFrame& frame, int first_axis, float& gap);
+
+        static float distanceBound(const AABBNode& A, const AABBNode& B, const AABBPairFrame& frame);
+
+        // the triangles under node, for the leaf tests of pair_test.h
+        leafTriangles leafOf(const AABBNode& node) const;
+
+        // rotation of an object as the world directions of its axes
+        static void objectAxes(const glm::mat4& model, glm::vec3 axes[3]);
+
+        bool traceRay(const glm::vec3& origin, const glm::vec3& dir, float t_max, bool any_hit, rayHit& hit) const;
+
+        // depth first from start with the nearer child first, boxes
+        // entered past t_best are skipped, the ray is in the object's
+        // frame and t_best is lowered by every closer hit
+        bool traceSubTree(uint32_t start, const glm::vec3& origin, const glm::vec3& dir, bool any_hit, float& t_best, rayHit& hit) const;
+
+        // the triangles of a leaf closer than t_best
+        bool rayLeaf(const AABBNode& node, const glm::vec3& origin, const glm::vec3& dir, bool any_hit, float& t_best, rayHit& hit) const;
+
+        // sets t_enter to where the ray enters the box if it does before t_max
+        static bool rayBoxTest(const AABBNode& node, const glm::vec3& origin, const glm::vec3& inv_dir, float t_max, float& t_enter);
+
+        // traces the first num_rays rays together, down to the nodes
+        // where only one of them is left
+        void tracePacket(const glm::vec3 origin[RAY_PACKET_SIZE], const glm::vec3 dir[RAY_PACKET_SIZE], int num_rays, float t_max, bool any_hit, rayHit hits[], int& num_diverged) const;
+
+        static int rayBoxTest4(const AABBNode& node, const float origin[3][RAY_PACKET_SIZE], const float inv_dir[3][RAY_PACKET_SIZE], const float t_max[RAY_PACKET_SIZE]);
+
+        // a pair of nodes met by the traversal, a_wide and b_wide are
+        // the wide nodes holding their children, only used over wide_nodes_
+        struct NodePair
+        {
+            uint32_t a_node, a_wide; // this tree
+            uint32_t b_node, b_wide; // other_tree
+        };
+
+        // depth first traversal from start, with split set the children
+        // of pairs covering PARALLEL_MIN_PRIMITIVES or more triangles are
+        // added to it in visiting order instead of being traversed
+        bool intersectTestBinary(const AABBTree* other_tree, const AABBPairFrame& frame, NodePair start, collisionQuery& query, std::vector<NodePair>* split) const;
+
+        // intersectTestBinary() from the front kept by query from the
+        // last query instead of the roots, see collisionQuery::keep_front_
+        bool intersectTestFront(const AABBTree* other_tree, const AABBPairFrame& frame, collisionQuery& query) const;
+
+        // splits the traversal into tasks on query.pool_, each with its own
+        // results, merged in the order the serial traversal would find them
+        bool intersectTestParallel(const AABBTree* other_tree, const AABBPairFrame& frame, bool is_wide, collisionQuery& query) const;
+
+        // exact triangle test of two overlapping leaves
+        bool intersectLeaves(const AABBNode& A, const AABBTree* other_tree, const AABBNode& B, const AABBPairFrame& frame, collisionQuery& query) const;
+
+        // intersectTestBinary() over wide_nodes_, the bigger box is opened
+        // and all its children tested at once, start is known to overlap
+        bool intersectTestWide(const AABBTree* other_tree, const AABBPairFrame& frame, NodePair start, collisionQuery& query, std::vector<NodePair>* split) const;
+
+        // mask of the lanes where the boxes overlap, the centers are
+        // local to each tree and moved into A's frame by frame
+        static int intersectTest4(const float center_A[3][4], const float extent_A[3][4], const float center_B[3][4], const float extent_B[3][4], const AABBPairFrame& frame);
+
+        // runs the query and keeps its results in both trees
+        bool intersectTestAndMark(AABBTree* other_tree, collisionQuery& query);
+
+        void initGLBuffers();
+};
 
 } // namespace glr
 
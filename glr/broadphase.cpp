@@ -0,0 +1,431 @@
+#include <glr/broadphase.h>
+
+#include <glr/obj.h>
+#include <glr/thread_pool.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+
+namespace glr
+{
+
+GLRENDER_INLINE void sweepAndPrune::add(OBJ* obj)
+{
+    uint32_t slot;
+    if (!free_slots_.empty())
+    {
+        slot = free_slots_.back();
+        free_slots_.pop_back();
+        objs_[slot] = obj;
+    }
+    else
+    {
+        slot = objs_.size();
+        objs_.push_back(obj);
+        min_p_.push_back(glm::vec3(0.0f));
+        max_p_.push_back(glm::vec3(0.0f));
+    }
+
+    // past every other end, the first update() sorts them in and
+    // picks up the pairs on the way down
+    min_p_[slot] = glm::vec3(FLT_MAX);
+    max_p_[slot] = glm::vec3(FLT_MAX);
+    for (int i = 0; i < 3; i++)
+    {
+        ends_[i].push_back({FLT_MAX, slot, true});
+        ends_[i].push_back({FLT_MAX, slot, false});
+    }
+}
+
+GLRENDER_INLINE void sweepAndPrune::remove(OBJ* obj)
+{
+    uint32_t slot = std::find(objs_.begin(), objs_.end(), obj) - objs_.begin();
+    if (obj == NULL || slot == objs_.size())
+        return;
+
+    for (int i = 0; i < 3; i++)
+    {
+        ends_[i].erase(std::remove_if(ends_[i].begin(), ends_[i].end(),
+                                      [slot](const endPoint& end) {return end.slot_ == slot;}),
+                       ends_[i].end());
+    }
+
+    for (auto it = pairs_.begin(); it != pairs_.end();)
+    {
+        if ((uint32_t) (*it >> 32) == slot || (uint32_t) *it == slot)
+            it = pairs_.erase(it);
+        else
+            ++it;
+    }
+
+    objs_[slot] = NULL;
+    free_slots_.push_back(slot);
+}
+
+GLRENDER_INLINE void sweepAndPrune::clear()
+{
+    objs_.clear();
+    free_slots_.clear();
+    min_p_.clear();
+    max_p_.clear();
+    for (int i = 0; i < 3; i++)
+        ends_[i].clear();
+    pairs_.clear();
+}
+
+GLRENDER_INLINE void sweepAndPrune::update()
+{
+    num_swaps_ = 0;
+
+    for (uint32_t s = 0; s < objs_.size(); s++)
+    {
+        if (objs_[s] != NULL)
+            objs_[s]->worldBounds(min_p_[s], max_p_[s]);
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        for (size_t e = 0; e < ends_[i].size(); e++)
+        {
+            endPoint& end = ends_[i][e];
+            end.value_ = end.is_min_ ? min_p_[end.slot_][i] : max_p_[end.slot_][i];
+        }
+
+        sortAxis(i);
+    }
+
+    num_pairs_ = pairs_.size();
+}
+
+GLRENDER_INLINE void sweepAndPrune::overlappingPairs(std::vector<std::pair<OBJ*, OBJ*>>& pairs) const
+{
+    // sorted so the pairs do not come out in hash order
+    std::vector<uint64_t> keys(pairs_.begin(), pairs_.end());
+    std::sort(keys.begin(), keys.end());
+
+    pairs.clear();
+    pairs.reserve(keys.size());
+    for (size_t p = 0; p < keys.size(); p++)
+        pairs.push_back(std::make_pair(objs_[keys[p] >> 32], objs_[(uint32_t) keys[p]]));
+}
+
+GLRENDER_INLINE void sweepAndPrune::sortAxis(int axis)
+{
+    std::vector<endPoint>& ends = ends_[axis];
+
+    for (size_t e = 1; e < ends.size(); e++)
+    {
+        endPoint end = ends[e];
+
+        size_t j = e;
+        while (j > 0 && end.value_ < ends[j - 1].value_)
+        {
+            const endPoint& prev = ends[j - 1];
+
+            if (end.is_min_ && !prev.is_min_)
+            {
+                if (isOverlap(end.slot_, prev.slot_))
+                    pairs_.insert(pairKey(end.slot_, prev.slot_));
+            }
+            else if (!end.is_min_ && prev.is_min_)
+            {
+                pairs_.erase(pairKey(end.slot_, prev.slot_));
+            }
+
+            ends[j] = prev;
+            j--;
+            num_swaps_++;
+        }
+
+        ends[j] = end;
+    }
+}
+
+GLRENDER_INLINE bool sweepAndPrune::isOverlap(uint32_t a, uint32_t b) const
+{
+    for (int i = 0; i < 3; i++)
+    {
+        if (min_p_[a][i] > max_p_[b][i] || min_p_[b][i] > max_p_[a][i])
+            return false;
+    }
+
+    return true;
+}
+
+GLRENDER_INLINE uint64_t sweepAndPrune::pairKey(uint32_t a, uint32_t b)
+{
+    if (a > b)
+        std::swap(a, b);
+
+    return ((uint64_t) a << 32) | b;
+}
+
+GLRENDER_INLINE void spatialHashGrid::cellSize(float cell_size)
+{
+    cell_size_ = cell_size;
+}
+
+GLRENDER_INLINE float spatialHashGrid::cellSize() const
+{
+    return cell_size_;
+}
+
+GLRENDER_INLINE void spatialHashGrid::update(const std::vector<OBJ*>& objs)
+{
+    objs_ = objs;
+    min_p_.resize(objs_.size());
+    max_p_.resize(objs_.size());
+
+    size_t num_chunks = (pool_ != NULL && objs_.size() >= 4096) ? pool_->numThreads() : 1;
+    parallelFor(objs_.size(), num_chunks, [this] (size_t, size_t begin, size_t end) {
+        for (size_t o = begin; o < end; o++)
+            objs_[o]->worldBounds(min_p_[o], max_p_[o]);
+    });
+
+    build();
+}
+
+GLRENDER_INLINE void spatialHashGrid::overlappingPairs(std::vector<std::pair<OBJ*, OBJ*>>& pairs) const
+{
+    pairs.clear();
+    pairs.reserve(pairs_.size());
+    for (size_t p = 0; p < pairs_.size(); p++)
+        pairs.push_back(std::make_pair(objs_[pairs_[p].first], objs_[pairs_[p].second]));
+}
+
+GLRENDER_INLINE void spatialHashGrid::build()
+{
+    uint32_t num_objs = objs_.size();
+
+    // every pass splits the objects or buckets into one chunk per
+    // thread, each chunk keeps its own histogram so the sort stays
+    // stable without atomics
+    size_t num_chunks = (pool_ != NULL && num_objs >= 4096) ? pool_->numThreads() : 1;
+
+    is_large_.assign(num_objs, 0);
+
+    std::vector<size_t> chunk_offset(num_chunks + 1, 0);
+    parallelFor(num_objs, num_chunks, [this, &chunk_offset] (size_t c, size_t begin, size_t end) {
+        size_t num_entries = 0;
+        for (size_t o = begin; o < end; o++)
+        {
+            int32_t lo[3], hi[3];
+            if (!cellRange(o, lo, hi))
+            {
+                is_large_[o] = 1;
+                continue;
+            }
+            num_entries += (size_t) (hi[0] - lo[0] + 1) * (hi[1] - lo[1] + 1) * (hi[2] - lo[2] + 1);
+        }
+        chunk_offset[c + 1] = num_entries;
+    });
+    for (size_t c = 0; c < num_chunks; c++)
+        chunk_offset[c + 1] += chunk_offset[c];
+
+    large_objs_.clear();
+    for (uint32_t o = 0; o < num_objs; o++)
+    {
+        if (is_large_[o])
+            large_objs_.push_back(o);
+    }
+
+    size_t num_entries = chunk_offset[num_chunks];
+
+    // about one entry per bucket
+    uint32_t num_buckets = 1;
+    while (num_buckets < num_entries)
+        num_buckets *= 2;
+    uint32_t mask = num_buckets - 1;
+
+    unsorted_.resize(num_entries);
+    entries_.resize(num_entries);
+    chunk_counts_.resize(num_chunks);
+
+    parallelFor(num_objs, num_chunks, [this, &chunk_offset, num_buckets, mask] (size_t c, size_t begin, size_t end) {
+        std::vector<uint32_t>& counts = chunk_counts_[c];
+        counts.assign(num_buckets, 0);
+
+        size_t e = chunk_offset[c];
+        for (size_t o = begin; o < end; o++)
+        {
+            int32_t lo[3], hi[3];
+            if (is_large_[o] || !cellRange(o, lo, hi))
+                continue;
+
+            cellEntry entry;
+            entry.obj_idx_ = o;
+            for (entry.cell_[2] = lo[2]; entry.cell_[2] <= hi[2]; entry.cell_[2]++)
+            {
+                for (entry.cell_[1] = lo[1]; entry.cell_[1] <= hi[1]; entry.cell_[1]++)
+                {
+                    for (entry.cell_[0] = lo[0]; entry.cell_[0] <= hi[0]; entry.cell_[0]++)
+                    {
+                        unsorted_[e++] = entry;
+                        counts[hashCell(entry.cell_, mask)]++;
+                    }
+                }
+            }
+        }
+    });
+
+    // chunk c of a bucket goes after chunks 0 to c - 1, the counts
+    // become the next free slot of each chunk
+    bucket_start_.resize(num_buckets + 1);
+    uint32_t start = 0;
+    for (uint32_t b = 0; b < num_buckets; b++)
+    {
+        bucket_start_[b] = start;
+        for (size_t c = 0; c < num_chunks; c++)
+        {
+            uint32_t count = chunk_counts_[c][b];
+            chunk_counts_[c][b] = start;
+            start += count;
+        }
+    }
+    bucket_start_[num_buckets] = start;
+
+    parallelFor(num_objs, num_chunks, [this, &chunk_offset, mask] (size_t c, size_t, size_t) {
+        std::vector<uint32_t>& next = chunk_counts_[c];
+        for (size_t e = chunk_offset[c]; e < chunk_offset[c + 1]; e++)
+            entries_[next[hashCell(unsorted_[e].cell_, mask)]++] = unsorted_[e];
+    });
+
+    // entries of other cells can share a bucket, only entries of
+    // the same cell are paired
+    std::vector<std::vector<std::pair<uint32_t, uint32_t>>> chunk_pairs(num_chunks);
+    parallelFor(num_buckets, num_chunks, [this, &chunk_pairs] (size_t c, size_t begin, size_t end) {
+        std::vector<std::pair<uint32_t, uint32_t>>& pairs = chunk_pairs[c];
+        for (size_t b = begin; b < end; b++)
+        {
+            for (uint32_t i = bucket_start_[b]; i < bucket_start_[b + 1]; i++)
+            {
+                const cellEntry& entry_a = entries_[i];
+                uint32_t a = entry_a.obj_idx_;
+
+                for (uint32_t j = i + 1; j < bucket_start_[b + 1]; j++)
+                {
+                    const cellEntry& entry_b = entries_[j];
+                    if (entry_a.cell_[0] != entry_b.cell_[0] || entry_a.cell_[1] != entry_b.cell_[1] || entry_a.cell_[2] != entry_b.cell_[2])
+                        continue;
+
+                    uint32_t b_idx = entry_b.obj_idx_;
+                    if (!isOverlap(a, b_idx))
+                        continue;
+
+                    int32_t home[3];
+                    cellOf(glm::max(min_p_[a], min_p_[b_idx]), home);
+                    if (home[0] != entry_a.cell_[0] || home[1] != entry_a.cell_[1] || home[2] != entry_a.cell_[2])
+                        continue;
+
+                    pairs.push_back(std::make_pair(std::min(a, b_idx), std::max(a, b_idx)));
+                }
+            }
+        }
+    });
+
+    // objects kept out of the grid against the ones in it, and
+    // against each other from the lower one
+    if (!large_objs_.empty())
+    {
+        parallelFor(num_objs, num_chunks, [this, &chunk_pairs] (size_t c, size_t begin, size_t end) {
+            std::vector<std::pair<uint32_t, uint32_t>>& pairs = chunk_pairs[c];
+            for (size_t o = begin; o < end; o++)
+            {
+                for (size_t l = 0; l < large_objs_.size(); l++)
+                {
+                    uint32_t a = large_objs_[l];
+                    if (is_large_[o] && o <= a)
+                        continue;
+
+                    if (isOverlap(o, a))
+                        pairs.push_back(std::make_pair(std::min((uint32_t) o, a), std::max((uint32_t) o, a)));
+                }
+            }
+        });
+    }
+
+    pairs_.clear();
+    for (size_t c = 0; c < num_chunks; c++)
+        pairs_.insert(pairs_.end(), chunk_pairs[c].begin(), chunk_pairs[c].end());
+
+    num_entries_ = num_entries;
+    num_large_ = large_objs_.size();
+    num_pairs_ = pairs_.size();
+}
+
+GLRENDER_INLINE bool spatialHashGrid::cellRange(uint32_t obj, int32_t lo[3], int32_t hi[3]) const
+{
+    // in double so huge or far away boxes cannot overflow, the
+    // negated test also catches NaN bounds
+    double num_cells = 1;
+    double cell_lo[3];
+    double cell_hi[3];
+    for (int i = 0; i < 3; i++)
+    {
+        cell_lo[i] = cellCoord(min_p_[obj][i]);
+        cell_hi[i] = cellCoord(max_p_[obj][i]);
+        if (!(cell_lo[i] >= INT32_MIN && cell_hi[i] <= INT32_MAX && cell_lo[i] <= cell_hi[i]))
+            return false;
+
+        num_cells *= cell_hi[i] - cell_lo[i] + 1;
+    }
+
+    if (num_cells > max_cells_)
+        return false;
+
+    for (int i = 0; i < 3; i++)
+    {
+        lo[i] = (int32_t) cell_lo[i];
+        hi[i] = (int32_t) cell_hi[i];
+    }
+
+    return true;
+}
+
+GLRENDER_INLINE bool spatialHashGrid::isOverlap(uint32_t a, uint32_t b) const
+{
+    for (int i = 0; i < 3; i++)
+    {
+        if (min_p_[a][i] > max_p_[b][i] || min_p_[b][i] > max_p_[a][i])
+            return false;
+    }
+
+    return true;
+}
+
+GLRENDER_INLINE double spatialHashGrid::cellCoord(float x) const
+{
+    return std::floor(x / (double) cell_size_);
+}
+
+GLRENDER_INLINE void spatialHashGrid::cellOf(const glm::vec3& p, int32_t cell[3]) const
+{
+    for (int i = 0; i < 3; i++)
+        cell[i] = (int32_t) cellCoord(p[i]);
+}
+
+GLRENDER_INLINE uint32_t spatialHashGrid::hashCell(const int32_t cell[3], uint32_t mask)
+{
+    return (((uint32_t) cell[0] * 73856093u) ^ ((uint32_t) cell[1] * 19349663u) ^ ((uint32_t) cell[2] * 83492791u)) & mask;
+}
+
+GLRENDER_INLINE void spatialHashGrid::parallelFor(size_t num, size_t num_chunks, const std::function<void(size_t, size_t, size_t)>& task)
+{
+    if (num_chunks <= 1)
+    {
+        task(0, 0, num);
+        return;
+    }
+
+    for (size_t c = 0; c < num_chunks; c++)
+    {
+        size_t begin = num * c / num_chunks;
+        size_t end = num * (c + 1) / num_chunks;
+        pool_->submit([&task, c, begin, end] () {task(c, begin, end);});
+    }
+    pool_->wait();
+}
+
+} // namespace glr
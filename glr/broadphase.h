@@ -0,0 +1,183 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+#include "glr_inline.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace glr
+{
+
+class OBJ;
+class threadPool;
+
+typedef enum{
+    SWEEP_AND_PRUNE, // sweepAndPrune, for scenes where objects move a little per frame
+    SPATIAL_HASH // spatialHashGrid, for many objects of about the same size
+} broadphaseType;
+
+// Sweep and prune over the world space boxes of a set of objects,
+// see OBJ::worldBounds()
+//
+// The box ends are kept sorted along each axis and re-sorted with
+// an insertion sort on every update(), which is close to linear
+// when the objects only moved a little since the last one. The
+// overlapping pairs are tracked as ends swap, a min end moving
+// below a max end may start an overlap and a max end moving below
+// a min end ends one.
+class sweepAndPrune
+{
+    public:
+        // diagnostics of the last update()
+        int num_swaps_ = 0; // end swaps done by the insertion sorts
+        int num_pairs_ = 0; // overlapping pairs
+
+    public:
+        // the object is sorted in at the next update()
+        void add(OBJ* obj);
+
+        void remove(OBJ* obj);
+
+        void clear();
+
+        // recomputes every box and re-sorts the ends
+        void update();
+
+        // pairs whose boxes overlapped at the last update(), in the
+        // same order from one call to the next
+        void overlappingPairs(std::vector<std::pair<OBJ*, OBJ*>>& pairs) const;
+
+    private:
+        // one end of a box along one axis
+        struct endPoint
+        {
+            float value_;
+            uint32_t slot_;
+            bool is_min_;
+        };
+
+        // NULL for removed objects until add() reuses the slot
+        std::vector<OBJ*> objs_;
+        std::vector<uint32_t> free_slots_;
+
+        // boxes of the last update(), per slot
+        std::vector<glm::vec3> min_p_;
+        std::vector<glm::vec3> max_p_;
+
+        std::vector<endPoint> ends_[3];
+
+        // lower slot in the high 32 bits
+        std::unordered_set<uint64_t> pairs_;
+
+        void sortAxis(int axis);
+
+        bool isOverlap(uint32_t a, uint32_t b) const;
+
+        static uint64_t pairKey(uint32_t a, uint32_t b);
+};
+
+// Uniform grid over the world space boxes of a set of objects,
+// hashed into buckets and rebuilt from scratch on every update()
+//
+// Meant for swarms of similar sized objects where keeping a sorted
+// or tree structure up to date costs more than a rebuild. Each
+// object gets an entry in every cell its box touches, and a counting
+// sort lays out the entries of each bucket next to each other. A pair
+// is only reported from the cell holding the min corner of the overlap
+// of both boxes, so it comes out once however many cells the boxes
+// share. Cells about as large as the typical box keep every object in
+// at most 8 cells, a box much larger than a cell touches many.
+//
+// Boxes touching more than max_cells_ cells, like a ground plane,
+// or lying outside the range of the cell coordinates are kept out
+// of the grid and tested against every other object instead.
+class spatialHashGrid
+{
+    public:
+        // set to build on this pool, not from one of its tasks
+        threadPool* pool_ = NULL;
+
+        uint32_t max_cells_ = 1024;
+
+        // diagnostics of the last update()
+        int num_entries_ = 0; // object and cell pairs
+        int num_large_ = 0; // objects kept out of the grid
+        int num_pairs_ = 0; // overlapping pairs
+
+    public:
+        void cellSize(float cell_size);
+
+        float cellSize() const;
+
+        void update(const std::vector<OBJ*>& objs);
+
+        // pairs whose boxes overlapped at the last update(), the
+        // object that comes first in objs comes first in each pair
+        void overlappingPairs(std::vector<std::pair<OBJ*, OBJ*>>& pairs) const;
+
+    private:
+        struct cellEntry
+        {
+            int32_t cell_[3];
+            uint32_t obj_idx_;
+        };
+
+        float cell_size_ = 1.0f;
+
+        std::vector<OBJ*> objs_;
+        std::vector<glm::vec3> min_p_;
+        std::vector<glm::vec3> max_p_;
+
+        // the entries of bucket b are entries_[bucket_start_[b], bucket_start_[b + 1])
+        std::vector<uint32_t> bucket_start_;
+        std::vector<cellEntry> entries_;
+
+        // counting sort scratch, unsorted entries and a bucket
+        // histogram per chunk of objects
+        std::vector<cellEntry> unsorted_;
+        std::vector<std::vector<uint32_t>> chunk_counts_;
+
+        // objects kept out of the grid, in objs_ order, and a flag
+        // per object
+        std::vector<uint32_t> large_objs_;
+        std::vector<uint8_t> is_large_;
+
+        // indices into objs_, lower index first
+        std::vector<std::pair<uint32_t, uint32_t>> pairs_;
+
+        // builds the buckets from min_p_ and max_p_
+        void build();
+
+        // false if the object is kept out of the grid
+        bool cellRange(uint32_t obj, int32_t lo[3], int32_t hi[3]) const;
+
+        bool isOverlap(uint32_t a, uint32_t b) const;
+
+        // cell of a coordinate, computed the same way for the cell
+        // ranges and for the cell a pair is reported from, or a pair
+        // on a cell border could be reported from a cell neither
+        // box was entered in
+        double cellCoord(float x) const;
+
+        // cell of a point inside the range of the cell coordinates
+        void cellOf(const glm::vec3& p, int32_t cell[3]) const;
+
+        // Teschner 2003, mask is the number of buckets - 1
+        static uint32_t hashCell(const int32_t cell[3], uint32_t mask);
+
+        // runs task(c, begin, end) for num_chunks ranges of [0, num)
+        void parallelFor(size_t num, size_t num_chunks, const std::function<void(size_t, size_t, size_t)>& task);
+};
+
+} // namespace glr
+
+#ifndef GLRENDER_STATIC
+#   include <glr/broadphase.cpp>
+#endif
+
+#endif
@@ -0,0 +1,161 @@
+#include <glr/collision_query.h>
+
+#include <cmath>
+#include <cstring>
+
+namespace glr
+{
+
+GLRENDER_INLINE collisionQuery::collisionQuery(std::vector<contactPair>* contacts, size_t max_contacts)
+    : contacts_(contacts), max_contacts_(max_contacts)
+{
+}
+
+GLRENDER_INLINE void collisionQuery::reset(size_t num_nodes_A, size_t num_nodes_B)
+{
+    if (mark_nodes_)
+    {
+        is_intersect_A_.assign(num_nodes_A, false);
+        is_intersect_B_.assign(num_nodes_B, false);
+    }
+    else
+    {
+        is_intersect_A_.clear();
+        is_intersect_B_.clear();
+    }
+
+    if (contacts_ != NULL)
+        contacts_->clear();
+    leaf_pairs_.clear();
+
+    N_v_ = 0;
+    C_v_ = 0;
+    N_p_ = 0;
+    C_p_ = 0;
+    num_leaf_overlap_ = 0;
+    num_front_skipped_ = 0;
+}
+
+GLRENDER_INLINE void collisionQuery::markLeaves(uint32_t a_idx, uint32_t b_idx)
+{
+    if (mark_nodes_)
+    {
+        is_intersect_A_[a_idx] = true;
+        is_intersect_B_[b_idx] = true;
+    }
+    if (list_leaves_)
+    {
+        leaf_pairs_.push_back(a_idx);
+        leaf_pairs_.push_back(b_idx);
+    }
+
+    num_leaf_overlap_ += 1;
+}
+
+GLRENDER_INLINE void collisionQuery::finish()
+{
+    if (N_v_ > 0)
+        C_v_ /= (float) N_v_;
+    if (N_p_ > 0)
+        C_p_ /= (float) N_p_;
+}
+
+GLRENDER_INLINE bool collisionQuery::isFrontValid(const void* tree_A, uint32_t build_A, const void* tree_B, uint32_t build_B) const
+{
+    if (front_.empty() || tree_A != front_tree_A_ || tree_B != front_tree_B_ ||
+        build_A != front_build_A_ || build_B != front_build_B_)
+        return false;
+
+    return (front_.size() <= front_growth_ * front_base_size_);
+}
+
+GLRENDER_INLINE void collisionQuery::resetFront(const void* tree_A, uint32_t build_A, const void* tree_B, uint32_t build_B)
+{
+    front_.assign(1, {0, 0, -1, 0, 0});
+    front_tree_A_ = tree_A;
+    front_tree_B_ = tree_B;
+    front_build_A_ = build_A;
+    front_build_B_ = build_B;
+    front_base_size_ = 1;
+    has_motion_ = false;
+    front_motion_ = 0;
+}
+
+GLRENDER_INLINE float collisionQuery::frontMotion(const float M_A[3][3], float radius_A, const float M_B[3][3], const float T[3], float radius_B)
+{
+    // a point v of B moves by dM_B v + dT, so by at most the Frobenius
+    // norm of dM_B times |v| plus |dT|, and a point of A by dM_A v, as
+    // A's frame only follows its rotation and not its scale
+    if (has_motion_)
+    {
+        float dM_A_sq = 0;
+        float dM_B_sq = 0;
+        float dT_sq = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                dM_A_sq += (M_A[i][k] - motion_M_A_[i][k]) * (M_A[i][k] - motion_M_A_[i][k]);
+                dM_B_sq += (M_B[i][k] - motion_M_B_[i][k]) * (M_B[i][k] - motion_M_B_[i][k]);
+            }
+            dT_sq += (T[i] - motion_T_[i]) * (T[i] - motion_T_[i]);
+        }
+        front_motion_ += std::sqrt(dM_A_sq) * radius_A + std::sqrt(dM_B_sq) * radius_B + std::sqrt(dT_sq);
+    }
+
+    std::memcpy(motion_M_A_, M_A, sizeof(motion_M_A_));
+    std::memcpy(motion_M_B_, M_B, sizeof(motion_M_B_));
+    std::memcpy(motion_T_, T, sizeof(motion_T_));
+    has_motion_ = true;
+
+    return front_motion_;
+}
+
+GLRENDER_INLINE std::vector<collisionQuery::frontPair>& collisionQuery::nextFront()
+{
+    next_front_.clear();
+    return next_front_;
+}
+
+GLRENDER_INLINE void collisionQuery::swapFront(bool is_from_root)
+{
+    front_.swap(next_front_);
+    if (is_from_root)
+        front_base_size_ = front_.size();
+}
+
+GLRENDER_INLINE void distanceQuery::reset()
+{
+    distance_ = max_distance_;
+    point_A_ = glm::vec3(0);
+    point_B_ = glm::vec3(0);
+    closest_ = contactPair();
+
+    N_v_ = 0;
+    N_p_ = 0;
+    max_queue_size_ = 0;
+    queue_.clear();
+}
+
+GLRENDER_INLINE void impactQuery::reset()
+{
+    time_ = FLT_MAX;
+    point_A_ = glm::vec3(0);
+    point_B_ = glm::vec3(0);
+    closest_ = contactPair();
+
+    num_iterations_ = 0;
+    motion_bound_ = 0;
+}
+
+GLRENDER_INLINE void rayQuery::reset()
+{
+    rayHit miss = {FLT_MAX, 0, 0, 0, 0};
+    hits_.assign(origins_.size(), miss);
+
+    num_hits_ = 0;
+    num_packets_ = 0;
+    num_diverged_ = 0;
+}
+
+} // namespace glr
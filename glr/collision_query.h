@@ -0,0 +1,275 @@
+#ifndef COLLISIONQUERY_H
+#define COLLISIONQUERY_H
+#include "glr_inline.h"
+
+#include <glr/triangle_intersect.h>
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace glr
+{
+
+class threadPool;
+
+// State of one intersection query between two trees
+//
+// Trees are only read while a query runs and everything the query
+// writes lives here, so any number of threads can test the same
+// trees at once as long as each has its own collisionQuery. Keeping
+// one per thread also keeps the node flags and the contact buffer
+// from reallocating every query.
+class collisionQuery
+{
+    public:
+        // set to fill is_intersect_A_ and is_intersect_B_,
+        // only needed to draw the result
+        bool mark_nodes_ = false;
+
+        // one flag per node of the tree the query is run on (A) and of
+        // the tree it is tested against (B), set for intersecting leaves
+        std::vector<bool> is_intersect_A_;
+        std::vector<bool> is_intersect_B_;
+
+        // intersecting triangle pairs are listed here if it is set,
+        // up to max_contacts_ of them
+        std::vector<contactPair>* contacts_ = NULL;
+        size_t max_contacts_ = 0;
+
+        // set to split the traversal into tasks on this pool, the
+        // results match the serial ones whichever thread ran what, the
+        // query must not be run from a task of the same pool
+        threadPool* pool_ = NULL;
+
+        // set by the parallel traversal for its tasks, intersecting
+        // leaves are listed in leaf_pairs_ as (A, B) node indices
+        // instead of being flagged
+        bool list_leaves_ = false;
+        std::vector<uint32_t> leaf_pairs_;
+
+        // set to keep the front of the traversal, the node pairs it
+        // stopped at, and start the next query of the same two trees
+        // from there instead of the roots, which saves most of the work
+        // when the objects barely moved, only used by the serial binary
+        // traversal and dropped once either tree is rebuilt or refit
+        bool keep_front_ = false;
+
+        // the front is rebuilt from the roots once it holds this many
+        // times the pairs it had right after the last rebuild
+        float front_growth_ = 2.0f;
+
+        // pair of the front and the axis that separated it the last
+        // time, tried first on the next query, -1 if it overlapped
+        //
+        // gap_ is how far apart the boxes were along that axis, or the
+        // triangles of an overlapping leaf pair, and motion_ the value
+        // of frontMotion() then, the pair is known to still be apart
+        // without a test while they have moved less than gap_ since
+        struct frontPair
+        {
+            uint32_t a_node_;
+            uint32_t b_node_;
+            int axis_;
+            float gap_;
+            float motion_;
+        };
+
+        std::vector<frontPair> front_;
+
+        // diagnostics
+        int N_v_ = 0; // number of volume overlap tests
+        float C_v_ = 0; // average time cost of volume overlap test
+        int N_p_ = 0; // number of triangle pair tests
+        float C_p_ = 0; // average time cost of a triangle pair test
+        int num_leaf_overlap_ = 0; // number of leaf volumes that overlap
+        int num_front_skipped_ = 0; // front pairs known to be apart without a test
+
+    public:
+        collisionQuery() {}
+
+        // lists contacts into the given buffer
+        collisionQuery(std::vector<contactPair>* contacts, size_t max_contacts);
+
+        // clears the results of the last query, called by the trees
+        void reset(size_t num_nodes_A, size_t num_nodes_B);
+
+        // true while contacts_ has room for more pairs
+        bool isCollecting() const {return contacts_ != NULL && contacts_->size() < max_contacts_;}
+
+        // records two intersecting leaves
+        void markLeaves(uint32_t a_idx, uint32_t b_idx);
+
+        // turns the summed times into averages
+        void finish();
+
+        // true if front_ was built on these trees as they are now
+        bool isFrontValid(const void* tree_A, uint32_t build_A, const void* tree_B, uint32_t build_B) const;
+
+        // restarts the front at the root pair of the given trees
+        void resetFront(const void* tree_A, uint32_t build_A, const void* tree_B, uint32_t build_B);
+
+        // M_A maps A's local points and M_B and T map B's into A's frame,
+        // returns how far any point of B within radius_B of its origin
+        // may have moved relative to any point of A within radius_A of
+        // its own over the queries since resetFront()
+        float frontMotion(const float M_A[3][3], float radius_A, const float M_B[3][3], const float T[3], float radius_B);
+
+        // empty buffer for the front found by the running query
+        std::vector<frontPair>& nextFront();
+
+        // makes the front in nextFront() the current one
+        void swapFront(bool is_from_root);
+
+    private:
+        // the trees front_ belongs to and their build counts
+        const void* front_tree_A_ = NULL;
+        const void* front_tree_B_ = NULL;
+        uint32_t front_build_A_ = 0;
+        uint32_t front_build_B_ = 0;
+
+        // size of the front right after it was last built from the roots
+        size_t front_base_size_ = 0;
+
+        // the transforms at the last query and the motion summed since
+        // resetFront(), has_motion_ is false until the first query
+        bool has_motion_ = false;
+        float motion_M_A_[3][3];
+        float motion_M_B_[3][3];
+        float motion_T_[3];
+        float front_motion_ = 0;
+
+        // kept to reuse its memory
+        std::vector<frontPair> next_front_;
+};
+
+// State of one minimum distance query between two trees
+//
+// Node pairs are visited closest first by the lower bound of their
+// box distance, so the query stops as soon as no pair left can
+// beat the closest triangles found. Like collisionQuery, one per
+// thread lets several queries share the same trees.
+class distanceQuery
+{
+    public:
+        // stop at the first triangle pair closer than this, distance_
+        // is then below tolerance_ but not necessarily the minimum
+        float tolerance_ = 0;
+
+        // only triangle pairs closer than this are searched, node
+        // pairs at least this far apart are never opened
+        float max_distance_ = FLT_MAX;
+
+        // closest points in world space and the triangles they are on,
+        // distance_ is max_distance_ if either tree is empty or no
+        // triangle pair is closer
+        float distance_ = FLT_MAX;
+        glm::vec3 point_A_;
+        glm::vec3 point_B_;
+        contactPair closest_;
+
+        // diagnostics
+        int N_v_ = 0; // number of node pair distance bounds
+        int N_p_ = 0; // number of triangle pair distances
+        int max_queue_size_ = 0;
+
+        // node pair with the lower bound of its distance
+        struct nodePair
+        {
+            float bound_;
+            uint32_t a_node_;
+            uint32_t b_node_;
+
+            // std::push_heap keeps the largest first
+            bool operator<(const nodePair& other) const {return bound_ > other.bound_;}
+        };
+
+        // priority queue, kept to reuse its memory
+        std::vector<nodePair> queue_;
+
+    public:
+        void reset();
+};
+
+// State of one continuous collision query, see OBJ::timeOfImpact()
+//
+// Conservative advancement (Mirtich 1996), the objects are moved
+// forward in time by their distance over a bound on how fast any
+// two of their points can approach, which can never step past the
+// first contact. Node pairs farther apart than the objects can close
+// over the rest of the frame are never opened, so a pair that stays
+// apart mostly costs one distance query near the roots.
+class impactQuery
+{
+    public:
+        // contact is reported once the objects come this close, the
+        // smaller it is the more steps a grazing approach takes
+        float tolerance_ = 1e-3f;
+
+        // a query still running after this many steps reports a
+        // contact at the time reached, so nothing tunnels
+        int max_iterations_ = 64;
+
+        // time in [0, 1] the objects are within tolerance_, never
+        // past their first contact, FLT_MAX if they stay apart over
+        // the whole frame, the points and triangles are those
+        // closest at time_
+        float time_ = FLT_MAX;
+        glm::vec3 point_A_;
+        glm::vec3 point_B_;
+        contactPair closest_;
+
+        // diagnostics
+        int num_iterations_ = 0;
+        float motion_bound_ = 0; // approach speed bound, in distance per frame
+
+        // distance query of each step, kept to reuse its memory
+        distanceQuery distance_query_;
+
+    public:
+        void reset();
+};
+
+// Rays cast together by AABBTree::raycastBatch()
+//
+// Consecutive rays are traced as one packet, so rays that start close
+// together and point the same way should be next to each other, as
+// they are when sampling a hemisphere or a block of pixels. Packets
+// whose rays spread apart finish one ray at a time.
+class rayQuery
+{
+    public:
+        // world space rays, origins_ and dirs_ have the same size
+        std::vector<glm::vec3> origins_;
+        std::vector<glm::vec3> dirs_;
+        float t_max_ = FLT_MAX;
+
+        // stop each ray at the first triangle it hits, for occlusion
+        bool any_hit_ = false;
+
+        // set to trace the packets on this pool, not from one of its tasks
+        threadPool* pool_ = NULL;
+
+        // one per ray, distance_ is FLT_MAX for rays that miss
+        std::vector<rayHit> hits_;
+
+        // diagnostics
+        int num_hits_ = 0;
+        int num_packets_ = 0;
+        int num_diverged_ = 0; // rays that left their packet for a single ray traversal
+
+    public:
+        // marks every ray as a miss
+        void reset();
+};
+
+} // namespace glr
+
+#ifndef GLRENDER_STATIC
+#   include <glr/collision_query.cpp>
+#endif
+
+#endif
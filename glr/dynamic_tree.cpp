@@ -0,0 +1,437 @@
+#include <glr/dynamic_tree.h>
+
+#include <glr/obj.h>
+
+#include <algorithm>
+#include <stack>
+
+namespace glr
+{
+
+GLRENDER_INLINE void dynamicTree::insert(OBJ* obj)
+{
+    if (obj->scene_tree_ != NULL)
+        obj->scene_tree_->remove(obj);
+
+    int32_t leaf = allocateNode();
+    nodes_[leaf].obj_ = obj;
+    fatBounds(obj, nodes_[leaf].min_p_, nodes_[leaf].max_p_);
+
+    insertLeaf(leaf);
+
+    obj->scene_tree_ = this;
+    obj->scene_leaf_ = leaf;
+    num_objects_++;
+}
+
+GLRENDER_INLINE void dynamicTree::remove(OBJ* obj)
+{
+    if (obj->scene_tree_ != this)
+        return;
+
+    removeLeaf(obj->scene_leaf_);
+    freeNode(obj->scene_leaf_);
+
+    obj->scene_tree_ = NULL;
+    obj->scene_leaf_ = NULL_NODE;
+    num_objects_--;
+}
+
+GLRENDER_INLINE bool dynamicTree::move(OBJ* obj)
+{
+    if (obj->scene_tree_ != this)
+        return false;
+
+    int32_t leaf = obj->scene_leaf_;
+
+    glm::vec3 min_p, max_p;
+    obj->worldBounds(min_p, max_p);
+
+    // still inside the fat box, and the fat box is not much larger
+    // than a fresh one, as after a long object stopped spinning
+    const dynamicTreeNode& node = nodes_[leaf];
+    if (isInside(node, min_p, max_p))
+    {
+        glm::vec3 fat_min, fat_max;
+        fatBounds(obj, fat_min, fat_max);
+        if (surfaceArea(node.min_p_, node.max_p_) <= 2 * surfaceArea(fat_min, fat_max))
+            return false;
+    }
+
+    removeLeaf(leaf);
+    fatBounds(obj, nodes_[leaf].min_p_, nodes_[leaf].max_p_);
+    insertLeaf(leaf);
+
+    num_reinserts_++;
+    return true;
+}
+
+GLRENDER_INLINE void dynamicTree::clear()
+{
+    for (size_t n = 0; n < nodes_.size(); n++)
+    {
+        if (nodes_[n].height_ == 0 && nodes_[n].obj_ != NULL && nodes_[n].obj_->scene_tree_ == this)
+        {
+            nodes_[n].obj_->scene_tree_ = NULL;
+            nodes_[n].obj_->scene_leaf_ = NULL_NODE;
+        }
+    }
+
+    nodes_.clear();
+    root_ = NULL_NODE;
+    free_list_ = NULL_NODE;
+    num_objects_ = 0;
+    num_reinserts_ = 0;
+    num_rotations_ = 0;
+}
+
+GLRENDER_INLINE dynamicTree::~dynamicTree()
+{
+    clear();
+}
+
+GLRENDER_INLINE void dynamicTree::query(const glm::vec3& min_p, const glm::vec3& max_p, std::vector<OBJ*>& objs) const
+{
+    objs.clear();
+    if (root_ == NULL_NODE)
+        return;
+
+    std::stack<int32_t> s;
+    s.push(root_);
+
+    while (!s.empty())
+    {
+        const dynamicTreeNode& node = nodes_[s.top()];
+        s.pop();
+
+        if (!isOverlap(node, min_p, max_p))
+            continue;
+
+        if (node.isLeaf())
+        {
+            objs.push_back(node.obj_);
+        }
+        else
+        {
+            s.push(node.child_[1]);
+            s.push(node.child_[0]);
+        }
+    }
+}
+
+GLRENDER_INLINE void dynamicTree::overlappingPairs(std::vector<std::pair<OBJ*, OBJ*>>& pairs) const
+{
+    pairs.clear();
+    if (root_ == NULL_NODE)
+        return;
+
+    // every leaf queries the tree with its own box, a pair is kept
+    // from the leaf with the lower index only
+    std::stack<int32_t> s;
+    for (int32_t leaf = 0; leaf < (int32_t) nodes_.size(); leaf++)
+    {
+        const dynamicTreeNode& leaf_node = nodes_[leaf];
+        if (leaf_node.height_ != 0 || leaf_node.obj_ == NULL)
+            continue;
+
+        s.push(root_);
+        while (!s.empty())
+        {
+            int32_t n = s.top();
+            s.pop();
+
+            const dynamicTreeNode& node = nodes_[n];
+            if (!isOverlap(node, leaf_node.min_p_, leaf_node.max_p_))
+                continue;
+
+            if (node.isLeaf())
+            {
+                if (n > leaf)
+                    pairs.push_back(std::make_pair(leaf_node.obj_, node.obj_));
+            }
+            else
+            {
+                s.push(node.child_[1]);
+                s.push(node.child_[0]);
+            }
+        }
+    }
+}
+
+GLRENDER_INLINE int dynamicTree::height() const
+{
+    return (root_ == NULL_NODE) ? 0 : nodes_[root_].height_;
+}
+
+GLRENDER_INLINE int32_t dynamicTree::allocateNode()
+{
+    if (free_list_ == NULL_NODE)
+    {
+        nodes_.push_back(dynamicTreeNode());
+        return nodes_.size() - 1;
+    }
+
+    int32_t node = free_list_;
+    free_list_ = nodes_[node].parent_;
+    nodes_[node] = dynamicTreeNode();
+
+    return node;
+}
+
+GLRENDER_INLINE void dynamicTree::freeNode(int32_t node)
+{
+    nodes_[node] = dynamicTreeNode();
+    nodes_[node].parent_ = free_list_;
+    nodes_[node].height_ = -1;
+    free_list_ = node;
+}
+
+GLRENDER_INLINE void dynamicTree::insertLeaf(int32_t leaf)
+{
+    if (root_ == NULL_NODE)
+    {
+        root_ = leaf;
+        nodes_[leaf].parent_ = NULL_NODE;
+        return;
+    }
+
+    // walk down while going deeper is cheaper than making a new
+    // parent here, the cost of a node is the area it adds to the
+    // nodes above it plus its own area
+    glm::vec3 leaf_min = nodes_[leaf].min_p_;
+    glm::vec3 leaf_max = nodes_[leaf].max_p_;
+
+    int32_t sibling = root_;
+    while (!nodes_[sibling].isLeaf())
+    {
+        const dynamicTreeNode& node = nodes_[sibling];
+
+        float area = surfaceArea(node.min_p_, node.max_p_);
+        float combined_area = surfaceArea(glm::min(node.min_p_, leaf_min), glm::max(node.max_p_, leaf_max));
+
+        float cost = 2 * combined_area;
+        float inherited_cost = 2 * (combined_area - area);
+
+        float child_cost[2];
+        for (int c = 0; c < 2; c++)
+        {
+            const dynamicTreeNode& child = nodes_[node.child_[c]];
+            float child_area = surfaceArea(glm::min(child.min_p_, leaf_min), glm::max(child.max_p_, leaf_max));
+            if (!child.isLeaf())
+                child_area -= surfaceArea(child.min_p_, child.max_p_);
+
+            child_cost[c] = child_area + inherited_cost;
+        }
+
+        if (cost < child_cost[0] && cost < child_cost[1])
+            break;
+
+        sibling = (child_cost[0] <= child_cost[1]) ? node.child_[0] : node.child_[1];
+    }
+
+    int32_t old_parent = nodes_[sibling].parent_;
+    int32_t new_parent = allocateNode();
+
+    nodes_[new_parent].parent_ = old_parent;
+    nodes_[new_parent].child_[0] = sibling;
+    nodes_[new_parent].child_[1] = leaf;
+    nodes_[sibling].parent_ = new_parent;
+    nodes_[leaf].parent_ = new_parent;
+
+    if (old_parent == NULL_NODE)
+        root_ = new_parent;
+    else if (nodes_[old_parent].child_[0] == sibling)
+        nodes_[old_parent].child_[0] = new_parent;
+    else
+        nodes_[old_parent].child_[1] = new_parent;
+
+    for (int32_t n = new_parent; n != NULL_NODE; n = nodes_[n].parent_)
+    {
+        fitNode(n);
+        rotate(n);
+    }
+}
+
+GLRENDER_INLINE void dynamicTree::removeLeaf(int32_t leaf)
+{
+    if (leaf == root_)
+    {
+        root_ = NULL_NODE;
+        return;
+    }
+
+    int32_t parent = nodes_[leaf].parent_;
+    int32_t grand_parent = nodes_[parent].parent_;
+    int32_t sibling = (nodes_[parent].child_[0] == leaf) ? nodes_[parent].child_[1] : nodes_[parent].child_[0];
+
+    freeNode(parent);
+    nodes_[leaf].parent_ = NULL_NODE;
+    nodes_[sibling].parent_ = grand_parent;
+
+    if (grand_parent == NULL_NODE)
+    {
+        root_ = sibling;
+        return;
+    }
+
+    if (nodes_[grand_parent].child_[0] == parent)
+        nodes_[grand_parent].child_[0] = sibling;
+    else
+        nodes_[grand_parent].child_[1] = sibling;
+
+    for (int32_t n = grand_parent; n != NULL_NODE; n = nodes_[n].parent_)
+    {
+        fitNode(n);
+        rotate(n);
+    }
+}
+
+GLRENDER_INLINE void dynamicTree::rotate(int32_t a)
+{
+    if (nodes_[a].isLeaf() || nodes_[a].height_ < 2)
+        return;
+
+    int32_t child[2] = {nodes_[a].child_[0], nodes_[a].child_[1]};
+    float child_area[2];
+    for (int s = 0; s < 2; s++)
+        child_area[s] = surfaceArea(nodes_[child[s]].min_p_, nodes_[child[s]].max_p_);
+
+    // change in the area of the children of a for each swap, the
+    // box of a stays the same but its height can change
+    float best_cost = 0;
+    int best_swap = -1;
+    int best_sides[2] = {0, 0};
+
+    // child s of a with grandchild k under the other child o
+    for (int s = 0; s < 2; s++)
+    {
+        const dynamicTreeNode& other = nodes_[child[1 - s]];
+        if (other.isLeaf())
+            continue;
+
+        const dynamicTreeNode& moved = nodes_[child[s]];
+        for (int k = 0; k < 2; k++)
+        {
+            const dynamicTreeNode& kept = nodes_[other.child_[1 - k]];
+            float cost = surfaceArea(glm::min(moved.min_p_, kept.min_p_), glm::max(moved.max_p_, kept.max_p_)) - child_area[1 - s];
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_swap = 0;
+                best_sides[0] = s;
+                best_sides[1] = k;
+            }
+        }
+    }
+
+    // grandchild j under child 0 with grandchild k under child 1
+    if (!nodes_[child[0]].isLeaf() && !nodes_[child[1]].isLeaf())
+    {
+        const dynamicTreeNode& b = nodes_[child[0]];
+        const dynamicTreeNode& c = nodes_[child[1]];
+        for (int j = 0; j < 2; j++)
+        {
+            for (int k = 0; k < 2; k++)
+            {
+                const dynamicTreeNode& b_kept = nodes_[b.child_[1 - j]];
+                const dynamicTreeNode& b_moved = nodes_[b.child_[j]];
+                const dynamicTreeNode& c_kept = nodes_[c.child_[1 - k]];
+                const dynamicTreeNode& c_moved = nodes_[c.child_[k]];
+
+                float cost = surfaceArea(glm::min(b_kept.min_p_, c_moved.min_p_), glm::max(b_kept.max_p_, c_moved.max_p_))
+                             + surfaceArea(glm::min(c_kept.min_p_, b_moved.min_p_), glm::max(c_kept.max_p_, b_moved.max_p_))
+                             - child_area[0] - child_area[1];
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_swap = 1;
+                    best_sides[0] = j;
+                    best_sides[1] = k;
+                }
+            }
+        }
+    }
+
+    if (best_swap == 0)
+    {
+        int s = best_sides[0];
+        swapChildren(a, s, child[1 - s], best_sides[1]);
+        fitNode(child[1 - s]);
+    }
+    else if (best_swap == 1)
+    {
+        swapChildren(child[0], best_sides[0], child[1], best_sides[1]);
+        fitNode(child[0]);
+        fitNode(child[1]);
+    }
+    else
+    {
+        return;
+    }
+
+    fitNode(a);
+    num_rotations_++;
+}
+
+GLRENDER_INLINE void dynamicTree::swapChildren(int32_t a, int a_side, int32_t b, int b_side)
+{
+    int32_t a_child = nodes_[a].child_[a_side];
+    int32_t b_child = nodes_[b].child_[b_side];
+
+    nodes_[a].child_[a_side] = b_child;
+    nodes_[b_child].parent_ = a;
+    nodes_[b].child_[b_side] = a_child;
+    nodes_[a_child].parent_ = b;
+}
+
+GLRENDER_INLINE void dynamicTree::fitNode(int32_t n)
+{
+    dynamicTreeNode& node = nodes_[n];
+    const dynamicTreeNode& child_0 = nodes_[node.child_[0]];
+    const dynamicTreeNode& child_1 = nodes_[node.child_[1]];
+
+    node.min_p_ = glm::min(child_0.min_p_, child_1.min_p_);
+    node.max_p_ = glm::max(child_0.max_p_, child_1.max_p_);
+    node.height_ = 1 + std::max(child_0.height_, child_1.height_);
+}
+
+GLRENDER_INLINE void dynamicTree::fatBounds(OBJ* obj, glm::vec3& min_p, glm::vec3& max_p) const
+{
+    obj->worldBounds(min_p, max_p);
+
+    glm::vec3 size = max_p - min_p;
+    float margin = fat_margin_ * std::max(size.x, std::max(size.y, size.z));
+
+    min_p -= glm::vec3(margin);
+    max_p += glm::vec3(margin);
+}
+
+GLRENDER_INLINE float dynamicTree::surfaceArea(const glm::vec3& min_p, const glm::vec3& max_p)
+{
+    glm::vec3 d = max_p - min_p;
+    return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+GLRENDER_INLINE bool dynamicTree::isOverlap(const dynamicTreeNode& node, const glm::vec3& min_p, const glm::vec3& max_p)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        if (node.min_p_[i] > max_p[i] || min_p[i] > node.max_p_[i])
+            return false;
+    }
+
+    return true;
+}
+
+GLRENDER_INLINE bool dynamicTree::isInside(const dynamicTreeNode& node, const glm::vec3& min_p, const glm::vec3& max_p)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        if (min_p[i] < node.min_p_[i] || max_p[i] > node.max_p_[i])
+            return false;
+    }
+
+    return true;
+}
+
+} // namespace glr
@@ -1,5 +1,6 @@
 #include <glr/obb_tree.h>
 #include <glr/obj.h>
+#include <glr/thread_pool.h>
 
 #ifdef GLRENDER_STATIC
 #   include <glad/glad.h>
@@ -7,10 +8,13 @@
 
 #include <glm/gtx/matrix_decompose.hpp>
 
-#include <Eigen/Eigen>
-
 #include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <functional>
 #include <stack>
+#include <type_traits>
 #include <iostream>
 #include <chrono>
 
@@ -37,50 +41,178 @@ GLRENDER_INLINE void OBBTree::assignObj(OBJ* obj)
     this->obj_ptr_ = obj;
 }
 
+GLRENDER_INLINE void OBBTree::fitType(obbFitType fit_type)
+{
+    this->fit_type_ = fit_type;
+}
+
+GLRENDER_INLINE obbFitType OBBTree::fitType()
+{
+    return this->fit_type_;
+}
+
+GLRENDER_INLINE void OBBTree::numBuildThreads(int num_threads)
+{
+    this->num_build_threads_ = num_threads;
+}
+
+GLRENDER_INLINE int OBBTree::numBuildThreads()
+{
+    return this->num_build_threads_;
+}
+
+GLRENDER_INLINE void OBBTree::maxLeafSize(uint32_t max_leaf_size)
+{
+    this->max_leaf_size_ = std::max(max_leaf_size, (uint32_t) 1);
+}
+
+GLRENDER_INLINE uint32_t OBBTree::maxLeafSize()
+{
+    return this->max_leaf_size_;
+}
+
 GLRENDER_INLINE void OBBTree::calcTree()
 {
     clearTree();
 
-    std::vector<tinyobj::index_t*> f_idx_list;
+    buildTree();
+
+    initGLBuffers();
+}
+
+GLRENDER_INLINE bool OBBTree::refit()
+{
+    if (nodes_.empty())
+        return false;
 
-    for (int s = 0; s < obj_ptr_->shapes_.size(); s++)
+    // the triangle count changed so the ranges are no longer valid
+    if (obj_ptr_->tri_cache_.size() != prim_idx_.size())
     {
-        int index_offset = 0;
-        for (int f = 0; f < obj_ptr_->shapes_[s].mesh.num_face_vertices.size(); f++)
-        {
-            if (obj_ptr_->shapes_[s].mesh.num_face_vertices[f] != 3)
-            {
-                index_offset += obj_ptr_->shapes_[s].mesh.num_face_vertices[f];
-                continue;
-            }
+        calcTree();
+        return true;
+    }
 
-            for (int v = 0; v < 3; v++)
-            {
-                f_idx_list.push_back(&(obj_ptr_->shapes_[s].mesh.indices[index_offset + v]));
-            }
+    auto t1 = std::chrono::high_resolution_clock::now();
 
-            index_offset += 3;
-        }
+    calcAllBounds();
+
+    // the gaps stored along a collisionQuery front were measured
+    // on the old bounds
+    build_count_ += 1;
+
+    sah_cost_ = calcSAHCost();
+
+    bool is_rebuilt = false;
+    if (sah_cost_ > rebuild_threshold_ * build_sah_cost_)
+    {
+        calcTree();
+        is_rebuilt = true;
     }
 
-    head_ = calcTree(f_idx_list);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<float, std::milli> refit_time = t2 - t1;
+    refit_time_ = refit_time.count();
 
-    initGLBuffers();
+    return is_rebuilt;
+}
+
+GLRENDER_INLINE void OBBTree::rebuildThreshold(float threshold)
+{
+    this->rebuild_threshold_ = threshold;
+}
+
+GLRENDER_INLINE float OBBTree::rebuildThreshold()
+{
+    return this->rebuild_threshold_;
 }
 
 GLRENDER_INLINE void OBBTree::clearTree()
 {
-    clearTree(head_);
     glRelease();
-    head_ = NULL;
+    build_count_ += 1;
+    std::vector<OBBNode>().swap(nodes_);
+    std::vector<uint32_t>().swap(prim_idx_);
+    std::vector<bool>().swap(is_intersect_);
     num_obb_ = 0;
     total_mem_ = 0;
     num_primitives_ = 0;
+    sah_cost_ = 0;
+    build_sah_cost_ = 0;
+    build_time_ = 0;
+    refit_time_ = 0;
+    num_leaves_ = 0;
+    avg_leaf_size_ = 0;
     N_v_ = 0;
     C_v_ = 0;
+    N_p_ = 0;
+    C_p_ = 0;
     num_leaf_overlap_ = 0;
 }
 
+GLRENDER_INLINE bool OBBTree::saveTree(const std::string& path, uint64_t mesh_hash)
+{
+    if (path.empty() || nodes_.empty())
+        return false;
+
+    return treeCache::write(path, cacheHeader(mesh_hash), nodes_.data(), prim_idx_.data());
+}
+
+GLRENDER_INLINE bool OBBTree::loadTree(const std::string& path, uint64_t mesh_hash)
+{
+    static_assert(std::is_trivially_copyable<OBBNode>::value, "OBBNode is written to the tree cache as raw bytes");
+
+    if (path.empty() || obj_ptr_->tri_cache_.size() == 0)
+        return false;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    treeCache::mappedFile file;
+    if (!file.open(path) || !treeCache::validate(file, cacheHeader(mesh_hash)))
+        return false;
+
+    clearTree();
+
+    treeCacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    const char* data = file.data() + sizeof(header);
+
+    num_primitives_ = header.num_primitives_;
+
+    nodes_.resize(header.num_nodes_);
+    std::memcpy(nodes_.data(), data, nodes_.size() * sizeof(OBBNode));
+    data += nodes_.size() * sizeof(OBBNode);
+
+    prim_idx_.resize(header.num_primitives_);
+    std::memcpy(prim_idx_.data(), data, prim_idx_.size() * sizeof(uint32_t));
+
+    file.close();
+
+    calcDiagnostics();
+
+    auto t2 = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<float, std::milli> build_time = t2 - t1;
+    build_time_ = build_time.count();
+
+    initGLBuffers();
+
+    return true;
+}
+
+GLRENDER_INLINE treeCacheHeader OBBTree::cacheHeader(uint64_t mesh_hash)
+{
+    treeCacheHeader header;
+    header.version_ = treeCache::VERSION;
+    header.tree_type_ = treeCache::OBB_TREE;
+    header.build_type_ = fit_type_;
+    header.max_leaf_size_ = max_leaf_size_;
+    header.node_size_ = sizeof(OBBNode);
+    header.mesh_hash_ = mesh_hash;
+    header.num_nodes_ = nodes_.size();
+    header.num_primitives_ = obj_ptr_->tri_cache_.size();
+
+    return header;
+}
+
 GLRENDER_INLINE void OBBTree::draw()
 {
     OBBTree::obb_shader_.use();
@@ -107,14 +239,7 @@ GLRENDER_INLINE void OBBTree::initGLBuffers()
     vao_list_.clear();
     vbo_list_.clear();
 
-    initGLBuffers(head_);
-
-    is_loaded_into_gl_ = true;
-}
-
-GLRENDER_INLINE void OBBTree::initGLBuffers(OBBNode* node)
-{
-    if (node==NULL)
+    if (nodes_.empty())
         return;
 
 	std::vector<float> vertex_data;
@@ -131,21 +256,12 @@ GLRENDER_INLINE void OBBTree::initGLBuffers(OBBNode* node)
 
     glm::vec3 v1, v2, v3, v4;
 
-    std::stack<OBBNode*> node_stack;
-
-    node_stack.push(node);
-
-    // int num_AABB = 0;
-    while (!node_stack.empty())
+    for (uint32_t n = 0; n < nodes_.size(); n++)
     {
-        node = node_stack.top();
-        node_stack.pop();
-        // num_AABB += 1;
-        // printf("\rAABBs added to GPU: %i", num_AABB);
-        // fflush(stdout);
+        const OBBNode* node = &nodes_[n];
         glm::vec3 color;
         float scale = 1;
-        if (node->is_intersect)
+        if (is_intersect_[n])
         {
             color = glm::vec3(0, 1, 0);
             scale = 1.01;
@@ -153,11 +269,6 @@ GLRENDER_INLINE void OBBTree::initGLBuffers(OBBNode* node)
         else
             color = glm::vec3(0, 0, 0);
 
-        if (node->left_ != NULL)
-            node_stack.push(node->left_);
-        if (node->right_ != NULL)
-            node_stack.push(node->right_);
-
         glm::vec3 center = node->center_[0] * node->axes_[0] + node->center_[1] * node->axes_[1] + node->center_[2] * node->axes_[2];
         // top
         v1 = center + node->extent_.y*node->axes_[1] + node->extent_.x*node->axes_[0] - node->extent_.z*node->axes_[2];
@@ -276,7 +387,7 @@ GLRENDER_INLINE void OBBTree::initGLBuffers(OBBNode* node)
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
 
-    // printf("\n");
+    is_loaded_into_gl_ = true;
 }
 
 GLRENDER_INLINE void OBBTree::glRelease()
@@ -298,574 +409,1371 @@ GLRENDER_INLINE OBBTree::~OBBTree()
     clearTree();
 }
 
-GLRENDER_INLINE OBBNode* OBBTree::calcTree(std::vector<tinyobj::index_t*> f_idx_list)
+GLRENDER_INLINE void OBBTree::buildTree()
 {
-    if (f_idx_list.size() == 0)
-        return NULL;
+    if (obj_ptr_->tri_cache_.size() == 0)
+        return;
 
-    OBBNode* head = new OBBNode;
+    auto t1 = std::chrono::high_resolution_clock::now();
 
-    std::stack<OBBNode*> node_stack;
-    std::stack<std::vector<tinyobj::index_t*>> f_idx_list_stack;
+    num_primitives_ = obj_ptr_->tri_cache_.size();
 
-    node_stack.push(head);
-    f_idx_list_stack.push(f_idx_list);
+    prim_idx_.resize(num_primitives_);
+    for (uint32_t f = 0; f < prim_idx_.size(); f++)
+        prim_idx_[f] = f;
 
-    num_obb_ = 0;
-    total_mem_ = 0;
-    num_primitives_ = f_idx_list.size()/3;
+    OBBSubTree tree;
 
-    // std::cout << "\nNumber of faces: " << num_faces << std::endl;
-    bool doOnce = true;
-    while (!node_stack.empty())
+    if (num_build_threads_ != 1)
     {
-        OBBNode* node = node_stack.top();
-        node_stack.pop();
-        num_obb_ += 1;
-        total_mem_ += sizeof(*node);
-        // printf("\rNumber of AABB: %i", num_AABB);
-        // fflush(stdout);
-
-        node->tree_ = this;
-
-        f_idx_list = f_idx_list_stack.top();
-        f_idx_list_stack.pop();
-
-        calcOBBAxes(f_idx_list, node->axes_);
-
-        float minP[3];
-        float maxP[3];
-
-        glm::vec3 p;
-        for (int i = 0; i < 3; i++)
-        {
-            p[i] = obj_ptr_->attrib_.vertices[3 * f_idx_list[0]->vertex_index + i];
-        }
-        p = glm::vec3(glm::dot(node->axes_[0],p),glm::dot(node->axes_[1],p),glm::dot(node->axes_[2],p));
-        for (int i = 0; i < 3; i++)
-        {
-            minP[i] = p[i];
-            maxP[i] = p[i];
-        }
+        threadPool pool(num_build_threads_);
+        calcSubTree(0, num_primitives_, &pool, &tree);
+        pool.wait();
+    }
+    else
+        calcSubTree(0, num_primitives_, NULL, &tree);
 
-        int f_num = f_idx_list.size()/3;
-        for (int f = 0; f < f_num; f++)
-        {
-            for (int v = 0; v < 3; v++)
-            {
-                for (int i = 0; i < 3; i++)
-                {
-                    p[i] = obj_ptr_->attrib_.vertices[3 * f_idx_list[3*f + v]->vertex_index + i];
-                }
-                p = glm::vec3(glm::dot(node->axes_[0],p),glm::dot(node->axes_[1],p),glm::dot(node->axes_[2],p));
-                for (int i = 0; i < 3; i++)
-                {
-                    float v_i = p[i];
-                    if (v_i > maxP[i])
-                        maxP[i] = v_i;
-                    if (v_i < minP[i])
-                        minP[i] = v_i;
-                }
-            }
-        }
+    if (tree.sub_trees_.empty())
+        nodes_ = std::move(tree.nodes_);
+    else
+    {
+        nodes_.reserve(2*num_primitives_ - 1);
+        spliceSubTree(&tree);
+    }
 
-        glm::vec3 center{
-            (maxP[0] + minP[0])/2,
-            (maxP[1] + minP[1])/2,
-            (maxP[2] + minP[2])/2
-        };
+    calcDiagnostics();
 
-        node->center_ = center;
+    auto t2 = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<float, std::milli> build_time = t2 - t1;
+    build_time_ = build_time.count();
+}
 
-        glm::vec3 extent{
-            (maxP[0] - minP[0])/2,
-            (maxP[1] - minP[1])/2,
-            (maxP[2] - minP[2])/2
-        };
+GLRENDER_INLINE void OBBTree::calcDiagnostics()
+{
+    is_intersect_.assign(nodes_.size(), false);
 
-        node->extent_ = extent;
+    num_obb_ = nodes_.size();
+    num_leaves_ = 0;
+    for (const OBBNode& node : nodes_)
+    {
+        if (node.isLeaf())
+            num_leaves_ += 1;
+    }
+    avg_leaf_size_ = num_primitives_ / (float) num_leaves_;
+    total_mem_ = num_obb_ * sizeof(OBBNode) + prim_idx_.size() * sizeof(uint32_t);
+    sah_cost_ = calcSAHCost();
+    build_sah_cost_ = sah_cost_;
+}
 
-        if (f_num == 1)
-            continue;
+GLRENDER_INLINE void OBBTree::calcSubTree(uint32_t begin, uint32_t end, threadPool* pool, OBBSubTree* sub_tree)
+{
+    struct BuildEntry
+    {
+        uint32_t parent;
+        bool is_left;
+        uint32_t begin, end;
+        OBBSubTree* spawned; // set when another task builds this subtree
+    };
 
-        enum PlaneSep {
-            XY,
-            YZ,
-            ZX
-        };
-
-        PlaneSep plane_sep;
-        if (extent.x >= extent.y && extent.x >= extent.z)
-            plane_sep = YZ;
-        else if (extent.y >= extent.x && extent.y >= extent.z)
-            plane_sep = ZX;
-        else if (extent.z >= extent.x && extent.z >= extent.y)
-            plane_sep = XY;
-
-        float delta; // loacation of splitting plane
-        std::vector<float> axis_vals;
-        for (int f = 0; f < f_num; f++)
-        {
-            glm::vec3 centroid{
-                0,
-                0,
-                0
-            };
-
-            for (int v = 0; v < 3; v++)
-            {
-                glm::vec3 tmp{
-                    obj_ptr_->attrib_.vertices[3 * f_idx_list[3*f + v]->vertex_index + 0],
-                    obj_ptr_->attrib_.vertices[3 * f_idx_list[3*f + v]->vertex_index + 1],
-                    obj_ptr_->attrib_.vertices[3 * f_idx_list[3*f + v]->vertex_index + 2]
-                };
+    std::vector<OBBNode>& nodes = sub_tree->nodes_;
+    nodes.reserve(2*(end - begin));
 
-                tmp = glm::vec3(glm::dot(node->axes_[0],tmp),glm::dot(node->axes_[1],tmp),glm::dot(node->axes_[2],tmp));
+    std::stack<BuildEntry> entry_stack;
+    entry_stack.push({OBBNode::NULL_IDX, true, begin, end, NULL});
 
-                centroid += tmp;
-            }
+    while (!entry_stack.empty())
+    {
+        BuildEntry entry = entry_stack.top();
+        entry_stack.pop();
 
-            centroid /= 3;
+        // nodes are added in depth first order
+        uint32_t node_idx = nodes.size();
+        nodes.push_back(OBBNode());
 
-            switch (plane_sep)
-            {
-            case YZ:
-                axis_vals.push_back(centroid.x);
-                break;
-            case ZX:
-                axis_vals.push_back(centroid.y);
-                break;
-            case XY:
-                axis_vals.push_back(centroid.z);
-                break;
-            }
+        if (entry.parent != OBBNode::NULL_IDX)
+        {
+            if (entry.is_left)
+                nodes[entry.parent].left_ = node_idx;
+            else
+                nodes[entry.parent].right_ = node_idx;
         }
 
-        std::sort(axis_vals.data(), axis_vals.data() + axis_vals.size());
-        if (axis_vals.size()%2 == 1)
+        OBBNode* node = &nodes[node_idx];
+        node->begin_ = entry.begin;
+        node->end_ = entry.end;
+
+        if (entry.spawned != NULL)
         {
-            delta = axis_vals[axis_vals.size()/2];
+            sub_tree->slots_.push_back(node_idx);
+            sub_tree->sub_trees_.emplace_back(entry.spawned);
+            continue;
         }
+
+        if (fit_type_ == DITO_FIT)
+            calcDiTOAxes(entry.begin, entry.end, node->axes_);
         else
-        {
-            delta = axis_vals[axis_vals.size()/2 - 1] + axis_vals[axis_vals.size()/2];
-            delta /= 2;
-        }
-        bool split_evenly = false;
-        if (axis_vals[0] == axis_vals[axis_vals.size() - 1])
-            split_evenly = true;
+            calcOBBAxes(entry.begin, entry.end, node->axes_);
 
-        std::vector<tinyobj::index_t*> f_idx_list_l;
-        std::vector<tinyobj::index_t*> f_idx_list_r;
-        for (int f = 0; f < f_num; f++)
-        {
+        calcNodeBounds(node);
 
-            if (split_evenly)
-            {
-                for (int v = 0; v < 3; v++)
-                    if (f < f_num/2)
-                        f_idx_list_l.push_back(f_idx_list[3*f + v]);
-                    else
-                        f_idx_list_r.push_back(f_idx_list[3*f + v]);
-                continue;
-            }
-            
-            glm::vec3 centroid{
-                0,
-                0,
-                0
-            };
-
-            for (int v = 0; v < 3; v++)
-            {
-                glm::vec3 tmp{
-                    obj_ptr_->attrib_.vertices[3 * f_idx_list[3*f + v]->vertex_index + 0],
-                    obj_ptr_->attrib_.vertices[3 * f_idx_list[3*f + v]->vertex_index + 1],
-                    obj_ptr_->attrib_.vertices[3 * f_idx_list[3*f + v]->vertex_index + 2]
-                };
+        if (entry.end - entry.begin <= max_leaf_size_)
+            continue;
 
-                tmp = glm::vec3(glm::dot(node->axes_[0],tmp),glm::dot(node->axes_[1],tmp),glm::dot(node->axes_[2],tmp));
+        uint32_t mid = splitMedian(entry.begin, entry.end, node->axes_, node->extent_);
 
-                centroid += tmp;
-            }
+        // large subtrees are handed to the pool, the split only depends
+        // on the triangles in the range so the tree is the same as a serial build
+        //
+        // the right child is pushed first so the left child is popped next
+        // and ends up directly after its parent
+        uint32_t child_ranges[2][2] = {{mid, entry.end}, {entry.begin, mid}};
+        for (int c = 0; c < 2; c++)
+        {
+            uint32_t child_begin = child_ranges[c][0];
+            uint32_t child_end = child_ranges[c][1];
+            bool is_left = (c == 1);
 
-            centroid /= 3;
+            if (child_begin == child_end)
+                continue;
 
-            switch (plane_sep)
+            if (pool != NULL && child_end - child_begin >= PARALLEL_MIN_PRIMITIVES)
             {
-            case YZ:
-                if ( (centroid.x >= delta && axis_vals[0] != delta) || centroid.x > delta )
-                    for (int v = 0; v < 3; v++)
-                        f_idx_list_r.push_back(f_idx_list[3*f + v]);
-                else
-                    for (int v = 0; v < 3; v++)
-                        f_idx_list_l.push_back(f_idx_list[3*f + v]);
-                break;
-            case ZX:
-                if ( (centroid.y >= delta && axis_vals[0] != delta) || centroid.y > delta )
-                    for (int v = 0; v < 3; v++)
-                        f_idx_list_r.push_back(f_idx_list[3*f + v]);
-                else
-                    for (int v = 0; v < 3; v++)
-                        f_idx_list_l.push_back(f_idx_list[3*f + v]);
-                break;
-            case XY:
-                if ( (centroid.z >= delta && axis_vals[0] != delta) || centroid.z > delta )
-                    for (int v = 0; v < 3; v++)
-                        f_idx_list_r.push_back(f_idx_list[3*f + v]);
-                else
-                    for (int v = 0; v < 3; v++)
-                        f_idx_list_l.push_back(f_idx_list[3*f + v]);
-                break;
+                OBBSubTree* spawned = new OBBSubTree;
+                pool->submit([this, spawned, child_begin, child_end, pool] () {
+                    calcSubTree(child_begin, child_end, pool, spawned);
+                });
+                entry_stack.push({node_idx, is_left, child_begin, child_end, spawned});
             }
+            else
+                entry_stack.push({node_idx, is_left, child_begin, child_end, NULL});
         }
+    }
+}
 
+GLRENDER_INLINE void OBBTree::spliceSubTree(OBBSubTree* sub_tree)
+{
+    std::vector<uint32_t> global_idx(sub_tree->nodes_.size());
 
-        if (f_idx_list_l.size() != 0)
-        {
-            node->left_ = new OBBNode;
-            f_idx_list_stack.push(f_idx_list_l);
-            node_stack.push(node->left_);
-        }
-        if (f_idx_list_r.size() != 0)
+    size_t slot = 0;
+    for (uint32_t n = 0; n < sub_tree->nodes_.size(); n++)
+    {
+        global_idx[n] = nodes_.size();
+
+        if (slot < sub_tree->slots_.size() && sub_tree->slots_[slot] == n)
         {
-            node->right_ = new OBBNode;
-            f_idx_list_stack.push(f_idx_list_r);
-            node_stack.push(node->right_);
+            spliceSubTree(sub_tree->sub_trees_[slot].get());
+            slot += 1;
         }
+        else
+            nodes_.push_back(sub_tree->nodes_[n]);
     }
-    // std::cout << "\nTotal memory of AABB Tree: " << total_mem/1e6 << std::endl;
 
-    return head;
+    // placeholders have no children of their own so only
+    // nodes built by this task need their children remapped
+    for (uint32_t n = 0; n < sub_tree->nodes_.size(); n++)
+    {
+        const OBBNode& node = sub_tree->nodes_[n];
+        if (node.left_ != OBBNode::NULL_IDX)
+            nodes_[global_idx[n]].left_ = global_idx[node.left_];
+        if (node.right_ != OBBNode::NULL_IDX)
+            nodes_[global_idx[n]].right_ = global_idx[node.right_];
+    }
 }
 
-GLRENDER_INLINE glm::vec3 OBBTree::calcMean(const std::vector<tinyobj::index_t*>& f_idx_list)
+GLRENDER_INLINE void OBBTree::calcNodeBounds(OBBNode* node)
 {
-    int n = f_idx_list.size()/3;
+    const triangleCache& tris = obj_ptr_->tri_cache_;
 
-    glm::vec3 mu(0);
+    float minP[3];
+    float maxP[3];
 
-    for (int i = 0; i < n; i++)
+    glm::vec3 p = tris.vertex(prim_idx_[node->begin_], 0);
+    p = glm::vec3(glm::dot(node->axes_[0],p),glm::dot(node->axes_[1],p),glm::dot(node->axes_[2],p));
+    for (int i = 0; i < 3; i++)
+    {
+        minP[i] = p[i];
+        maxP[i] = p[i];
+    }
+
+    for (uint32_t f = node->begin_; f < node->end_; f++)
     {
-        glm::vec3 p;
-        for (int v = 0; v < 3; v++)
-        {
-            p[v] = this->obj_ptr_->attrib_.vertices[3 * f_idx_list[3*i + 0]->vertex_index + v];
-        }
-        glm::vec3 q;
-        for (int v = 0; v < 3; v++)
-        {
-            q[v] = this->obj_ptr_->attrib_.vertices[3 * f_idx_list[3*i + 1]->vertex_index + v];
-        }
-        glm::vec3 r;
         for (int v = 0; v < 3; v++)
         {
-            r[v] = this->obj_ptr_->attrib_.vertices[3 * f_idx_list[3*i + 2]->vertex_index + v];
+            p = tris.vertex(prim_idx_[f], v);
+            p = glm::vec3(glm::dot(node->axes_[0],p),glm::dot(node->axes_[1],p),glm::dot(node->axes_[2],p));
+            for (int i = 0; i < 3; i++)
+            {
+                float v_i = p[i];
+                if (v_i > maxP[i])
+                    maxP[i] = v_i;
+                if (v_i < minP[i])
+                    minP[i] = v_i;
+            }
         }
+    }
 
-        float m = glm::length(glm::cross(q-p,r-p))/2;
+    glm::vec3 center{
+        (maxP[0] + minP[0])/2,
+        (maxP[1] + minP[1])/2,
+        (maxP[2] + minP[2])/2
+    };
 
-        if (m != 0)
-            mu += 1/m * (p + q + r);
-    }
+    node->center_ = center;
 
-    mu = 1.f/(6.f * n) * mu;
+    glm::vec3 extent{
+        (maxP[0] - minP[0])/2,
+        (maxP[1] - minP[1])/2,
+        (maxP[2] - minP[2])/2
+    };
 
-    return mu;
+    node->extent_ = extent;
 }
 
-GLRENDER_INLINE void OBBTree::calcOBBAxes(const std::vector<tinyobj::index_t*>& f_idx_list, glm::vec3 axes[3])
+GLRENDER_INLINE void OBBTree::calcAllBounds()
 {
-    glm::vec3 mu_glm = calcMean(f_idx_list);
+    // nodes are independent of each other so they are
+    // spread over the pool in chunks when threads are enabled
+    const uint32_t NODES_PER_TASK = 1024;
 
-    Eigen::Vector3f mu(glm::value_ptr(mu_glm));
-    Eigen::Matrix3f C = Eigen::Matrix3f::Zero();
+    auto calcChunk = [this] (uint32_t begin, uint32_t end) {
+        for (uint32_t n = begin; n < end; n++)
+            calcNodeBounds(&nodes_[n]);
+    };
 
+    if (num_build_threads_ == 1 || nodes_.size() <= NODES_PER_TASK)
+    {
+        calcChunk(0, nodes_.size());
+        return;
+    }
 
-    int n = f_idx_list.size()/3;
+    threadPool pool(num_build_threads_);
+    for (uint32_t begin = 0; begin < nodes_.size(); begin += NODES_PER_TASK)
+    {
+        uint32_t end = std::min<uint32_t>(begin + NODES_PER_TASK, nodes_.size());
+        pool.submit([&calcChunk, begin, end] () {calcChunk(begin, end);});
+    }
+    pool.wait();
+}
 
-    for (int i = 0; i < n; i++)
+GLRENDER_INLINE float OBBTree::calcSAHCost()
+{
+    if (nodes_.empty())
+        return 0;
+
+    // normalized by the axis aligned bounds of the mesh rather than
+    // the root box, refit() loosens the root so it would hide the
+    // growth of the rest of the tree
+    const triangleCache& tris = obj_ptr_->tri_cache_;
+    glm::vec3 mesh_extent;
+    for (int i = 0; i < 3; i++)
     {
-        Eigen::Vector3f p;
-        for (int v = 0; v < 3; v++)
-        {
-            p[v] = this->obj_ptr_->attrib_.vertices[3 * f_idx_list[3*i + 0]->vertex_index + v];
-        }
-        Eigen::Vector3f q;
-        for (int v = 0; v < 3; v++)
-        {
-            q[v] = this->obj_ptr_->attrib_.vertices[3 * f_idx_list[3*i + 1]->vertex_index + v];
-        }
-        Eigen::Vector3f r;
-        for (int v = 0; v < 3; v++)
-        {
-            r[v] = this->obj_ptr_->attrib_.vertices[3 * f_idx_list[3*i + 2]->vertex_index + v];
-        }
+        float min_i = *std::min_element(tris.min_[i].begin(), tris.min_[i].end());
+        float max_i = *std::max_element(tris.max_[i].begin(), tris.max_[i].end());
+        mesh_extent[i] = (max_i - min_i)/2;
+    }
 
+    float root_area = surfaceArea(mesh_extent);
 
-        float m = (q - p).cross(r - p).norm()/2;
+    float cost = 0;
 
-        p = p.array() - mu.array();
-        q = q.array() - mu.array();
-        r = r.array() - mu.array();
+    for (const OBBNode& node : nodes_)
+    {
+        float area = surfaceArea(node.extent_);
 
-        for (int j = 0; j < 3; j++)
-        {
-            for (int k = 0; k < 3; k++)
-            {
-                C(j,k) += 1.f/(24.f * n) * m * ( (p[j] + q[j] + r[j])*(p[k] + q[k] + r[k]) + p[j]*p[k] +q[j]*q[k] + r[j]*r[k] );
-            }
-        }
+        if (node.isLeaf())
+            cost += SAH_INTERSECT_COST * area * (node.end_ - node.begin_);
+        else
+            cost += SAH_TRAVERSAL_COST * area;
     }
 
-    Eigen::Matrix3cf eigen_vecs;
-    Eigen::EigenSolver<Eigen::Matrix3f> solver(C);
-    eigen_vecs = solver.eigenvectors();
-    
+    if (root_area == 0)
+        return cost;
 
-    for (int k = 0; k < 3; k++)
+    return cost / root_area;
+}
+
+GLRENDER_INLINE float OBBTree::surfaceArea(glm::vec3 extent)
+{
+    return 8 * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+GLRENDER_INLINE glm::vec3 OBBTree::calcMean(uint32_t begin, uint32_t end)
+{
+    const triangleCache& tris = obj_ptr_->tri_cache_;
+
+    int n = end - begin;
+
+    glm::vec3 mu(0);
+
+    for (uint32_t f = begin; f < end; f++)
     {
-        for (int j = 0; j < 3; j++)
-        {
-            axes[k][j] = eigen_vecs(j,k).real();
-        }
+        glm::vec3 p = tris.vertex(prim_idx_[f], 0);
+        glm::vec3 q = tris.vertex(prim_idx_[f], 1);
+        glm::vec3 r = tris.vertex(prim_idx_[f], 2);
+
+        float m = glm::length(glm::cross(q-p,r-p))/2;
 
-        axes[k] = glm::normalize(axes[k]);
+        if (m != 0)
+            mu += 1/m * (p + q + r);
     }
+
+    mu = 1.f/(6.f * n) * mu;
+
+    return mu;
 }
 
-GLRENDER_INLINE void OBBTree::clearTree(OBBNode* node)
+GLRENDER_INLINE void OBBTree::calcOBBAxes(uint32_t begin, uint32_t end, glm::vec3 axes[3])
 {
-    if (node == NULL)
-        return;
-    
-    clearTree(node->left_);
-    clearTree(node->right_);
+    const triangleCache& tris = obj_ptr_->tri_cache_;
 
-    delete node;
-};
+    glm::vec3 mu = calcMean(begin, end);
 
-GLRENDER_INLINE bool OBBTree::intersectTest(OBBTree* other_tree)
-{
+    // upper triangle of the covariance, xx yy zz xy xz yz
+    float cov[6] = {0, 0, 0, 0, 0, 0};
 
-    this->clearIntersectTest();
-    other_tree->clearIntersectTest();
+    int n = end - begin;
 
-    std::stack<OBBNode*> node_stack;
-    std::stack<glm::quat*> rot_stack;
+    for (uint32_t f = begin; f < end; f++)
+    {
+        uint32_t t = prim_idx_[f];
+        glm::vec3 p = tris.vertex(t, 0);
+        glm::vec3 q = tris.vertex(t, 1);
+        glm::vec3 r = tris.vertex(t, 2);
 
-    node_stack.push(this->head_);
-    node_stack.push(other_tree->head_);
+        float m = glm::length(glm::cross(q - p, r - p))/2;
 
-    bool is_intersect = false;
+        p -= mu;
+        q -= mu;
+        r -= mu;
 
-    glm::vec3 scale_A;
-    glm::quat rot_A;
-    glm::vec3 trans_A;
-    glm::vec3 skew_A;
-    glm::vec4 persp_A;
-    glm::decompose(this->obj_ptr_->modelMatrix(), scale_A, rot_A, trans_A, skew_A, persp_A);
-    rot_stack.push(&rot_A);
-
-    glm::vec3 scale_B;
-    glm::quat rot_B;
-    glm::vec3 trans_B;
-    glm::vec3 skew_B;
-    glm::vec4 persp_B;
-    glm::decompose(other_tree->obj_ptr_->modelMatrix(), scale_B, rot_B, trans_B, skew_B, persp_B);
-    rot_stack.push(&rot_B);
+        glm::vec3 s = p + q + r;
 
-    N_v_ = 0;
-    C_v_ = 0;
-    num_leaf_overlap_ = 0;
+        cov[0] += m * (s.x*s.x + p.x*p.x + q.x*q.x + r.x*r.x);
+        cov[1] += m * (s.y*s.y + p.y*p.y + q.y*q.y + r.y*r.y);
+        cov[2] += m * (s.z*s.z + p.z*p.z + q.z*q.z + r.z*r.z);
+        cov[3] += m * (s.x*s.y + p.x*p.y + q.x*q.y + r.x*r.y);
+        cov[4] += m * (s.x*s.z + p.x*p.z + q.x*q.z + r.x*r.z);
+        cov[5] += m * (s.y*s.z + p.y*p.z + q.y*q.z + r.y*r.z);
+    }
 
-    while (!node_stack.empty())
-    {
-        OBBNode* A = node_stack.top();
-        node_stack.pop();
-        glm::vec3 axis_A[3];
-        for (int i = 0; i < 3; i++)
-            axis_A[i] = A->axes_[i];
-        glm::quat* A_rot_ptr = rot_stack.top();
-        rot_stack.pop();
-        for (int i = 0; i < 3; i++)
-            axis_A[i] = (*A_rot_ptr) * axis_A[i];
+    for (int i = 0; i < 6; i++)
+        cov[i] *= 1.f/(24.f * n);
 
-        OBBNode* B = node_stack.top();
-        node_stack.pop();
-        glm::vec3 axis_B[3];
-        for (int i = 0; i < 3; i++)
-            axis_B[i] = B->axes_[i];
-        glm::quat* B_rot_ptr = rot_stack.top();
-        rot_stack.pop();
-        for (int i = 0; i < 3; i++)
-            axis_B[i] = (*B_rot_ptr) * axis_B[i];
-        
-        if (A == NULL || B == NULL)
-            continue;
+    symmetricEigen(cov, axes);
+}
 
-        if (A->left_ == NULL && A->right_ == NULL && B->left_ == NULL && B->right_ == NULL)
-        {
-            A = A;
-        }
+GLRENDER_INLINE void OBBTree::symmetricEigen(const float cov[6], glm::vec3 axes[3])
+{
+    // enough for float precision, each sweep roughly squares the
+    // off diagonal error once the matrix is close to diagonal
+    const int NUM_SWEEPS = 4;
 
-        N_v_ += 1;
+    // the rotations are scale invariant, normalising keeps the
+    // squares below from under or overflowing
+    float scale = 0;
+    for (int i = 0; i < 6; i++)
+        scale = std::max(scale, std::abs(cov[i]));
+    scale = (scale > 0) ? 1.f/scale : 1.f;
 
-        auto t1 = std::chrono::high_resolution_clock::now();
-        bool is_box_overlap = intersectTest(A, axis_A, B, axis_B);
-        auto t2 = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<float, std::milli> time_overlap_test = t2 - t1;
+    float a[3][3] = {
+        {cov[0]*scale, cov[3]*scale, cov[4]*scale},
+        {cov[3]*scale, cov[1]*scale, cov[5]*scale},
+        {cov[4]*scale, cov[5]*scale, cov[2]*scale}
+    };
 
-        C_v_ += time_overlap_test.count();
+    // columns are the eigenvectors
+    float v[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
 
-        if (is_box_overlap)
+    const int pairs[3][2] = {{0, 1}, {0, 2}, {1, 2}};
+
+    for (int sweep = 0; sweep < NUM_SWEEPS; sweep++)
+    {
+        for (int r = 0; r < 3; r++)
         {
-            if (A->left_ == NULL && A->right_ == NULL && B->left_ == NULL && B->right_ == NULL)
+            int p = pairs[r][0];
+            int q = pairs[r][1];
+
+            // entries this far below float precision are flushed,
+            // squaring them would produce (slow) denormals
+            float a_pq = (std::abs(a[p][q]) > 1e-12f) ? a[p][q] : 0.f;
+
+            // tangent of the rotation angle that zeroes a[p][q], written
+            // so a_pq == 0 gives t == 0 without a branch
+            float d = a[q][q] - a[p][p];
+            float t = 2*a_pq * std::copysign(1.f, d) /
+                      (std::abs(d) + std::sqrt(d*d + 4*a_pq*a_pq) + FLT_MIN);
+            float c = 1/std::sqrt(t*t + 1);
+            float s = t*c;
+
+            // a = J^T a J
+            for (int k = 0; k < 3; k++)
             {
-                A->is_intersect = true;
-                B->is_intersect = true;
-                is_intersect = true;
-                num_leaf_overlap_ += 1;
+                float a_kp = a[k][p];
+                float a_kq = a[k][q];
+                a[k][p] = c*a_kp - s*a_kq;
+                a[k][q] = s*a_kp + c*a_kq;
             }
+            for (int k = 0; k < 3; k++)
+            {
+                float a_pk = a[p][k];
+                float a_qk = a[q][k];
+                a[p][k] = c*a_pk - s*a_qk;
+                a[q][k] = s*a_pk + c*a_qk;
+            }
+            a[p][q] = 0;
+            a[q][p] = 0;
 
-            if ( (A->left_ != NULL || A->right_ != NULL) && ( A->volume() > B->volume() || (B->left_ == NULL && B->right_ == NULL) ) )
+            // v = v J
+            for (int k = 0; k < 3; k++)
             {
-                if (A->left_ != NULL)
+                float v_kp = v[k][p];
+                float v_kq = v[k][q];
+                v[k][p] = c*v_kp - s*v_kq;
+                v[k][q] = s*v_kp + c*v_kq;
+            }
+        }
+    }
+
+    for (int k = 0; k < 3; k++)
+        axes[k] = glm::normalize(glm::vec3(v[0][k], v[1][k], v[2][k]));
+}
+
+GLRENDER_INLINE void OBBTree::calcDiTOAxes(uint32_t begin, uint32_t end, glm::vec3 axes[3])
+{
+    const triangleCache& tris = obj_ptr_->tri_cache_;
+
+    // the coordinate axes and the 4 cube diagonals, the projections
+    // below are written out since the directions are all 0 and +-1
+    const int NUM_DIRS = 7;
+
+    // the vertex with the smallest projection on direction d is
+    // stored in ext[2*d] and the one with the largest in ext[2*d + 1]
+    float min_proj[NUM_DIRS];
+    float max_proj[NUM_DIRS];
+    uint32_t min_tri[NUM_DIRS], max_tri[NUM_DIRS];
+    int min_vert[NUM_DIRS], max_vert[NUM_DIRS];
+
+    for (int d = 0; d < NUM_DIRS; d++)
+    {
+        min_proj[d] = FLT_MAX;
+        max_proj[d] = -FLT_MAX;
+    }
+
+    for (uint32_t f = begin; f < end; f++)
+    {
+        uint32_t t = prim_idx_[f];
+        for (int v = 0; v < 3; v++)
+        {
+            float x = tris.v_[v][0][t];
+            float y = tris.v_[v][1][t];
+            float z = tris.v_[v][2][t];
+
+            float proj[NUM_DIRS] = {x, y, z, x + y + z, x + y - z, x - y + z, x - y - z};
+            for (int d = 0; d < NUM_DIRS; d++)
+            {
+                if (proj[d] < min_proj[d])
                 {
-                    node_stack.push(B);
-                    rot_stack.push(B_rot_ptr);
-                    node_stack.push(A->left_);
-                    rot_stack.push(A_rot_ptr);
+                    min_proj[d] = proj[d];
+                    min_tri[d] = t;
+                    min_vert[d] = v;
                 }
-
-                if (A->right_ != NULL)
+                if (proj[d] > max_proj[d])
                 {
-                    node_stack.push(B);
-                    rot_stack.push(B_rot_ptr);
-                    node_stack.push(A->right_);
-                    rot_stack.push(A_rot_ptr);
+                    max_proj[d] = proj[d];
+                    max_tri[d] = t;
+                    max_vert[d] = v;
                 }
             }
+        }
+    }
+
+    glm::vec3 ext[2*NUM_DIRS];
+    for (int d = 0; d < NUM_DIRS; d++)
+    {
+        ext[2*d] = tris.vertex(min_tri[d], min_vert[d]);
+        ext[2*d + 1] = tris.vertex(max_tri[d], max_vert[d]);
+    }
+
+    // small nodes share most of their extremal points, the
+    // candidate boxes only need to be measured around unique ones
+    glm::vec3 points[2*NUM_DIRS];
+    int num_points = 0;
+    for (int i = 0; i < 2*NUM_DIRS; i++)
+    {
+        bool is_unique = true;
+        for (int j = 0; j < num_points && is_unique; j++)
+            is_unique = (points[j] != ext[i]);
+        if (is_unique)
+            points[num_points++] = ext[i];
+    }
+
+    // the axis aligned box is kept unless a candidate beats it
+    axes[0] = glm::vec3(1, 0, 0);
+    axes[1] = glm::vec3(0, 1, 0);
+    axes[2] = glm::vec3(0, 0, 1);
+    float best_area = boxArea(points, num_points, axes);
+
+    // first edge of the base triangle is the most distant extremal pair
+    int best_dir = 0;
+    float max_dist = -1;
+    for (int d = 0; d < NUM_DIRS; d++)
+    {
+        glm::vec3 diff = ext[2*d + 1] - ext[2*d];
+        float dist = glm::dot(diff, diff);
+        if (dist > max_dist)
+        {
+            max_dist = dist;
+            best_dir = d;
+        }
+    }
+
+    // every vertex is the same point
+    if (max_dist <= 0)
+        return;
+
+    glm::vec3 p0 = ext[2*best_dir];
+    glm::vec3 p1 = ext[2*best_dir + 1];
+    glm::vec3 e0 = glm::normalize(p1 - p0);
+
+    // third point is the extremal point furthest from that edge
+    glm::vec3 p2 = p0;
+    max_dist = 0;
+    for (int i = 0; i < num_points; i++)
+    {
+        glm::vec3 u = points[i] - p0;
+        u -= glm::dot(u, e0) * e0;
+        float dist = glm::dot(u, u);
+        if (dist > max_dist)
+        {
+            max_dist = dist;
+            p2 = points[i];
+        }
+    }
+
+    glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+
+    // the extremal points are collinear, any box around
+    // the edge is as tight as the others
+    if (glm::dot(n, n) <= 0)
+    {
+        glm::vec3 u = (std::abs(e0.x) < 0.6f) ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+        glm::vec3 e1 = glm::normalize(glm::cross(e0, u));
+        glm::vec3 candidate[3] = {e0, e1, glm::cross(e0, e1)};
+
+        if (boxArea(points, num_points, candidate) < best_area)
+        {
+            for (int k = 0; k < 3; k++)
+                axes[k] = candidate[k];
+        }
+        return;
+    }
+
+    fitTriangle(p0, p1, p2, points, num_points, best_area, axes);
+
+    // the extremal points furthest above and below the base
+    // triangle give the two tetrahedra of the ditetrahedron
+    n = glm::normalize(n);
+    float min_height = 0, max_height = 0;
+    glm::vec3 q_min = p0, q_max = p0;
+    for (int i = 0; i < num_points; i++)
+    {
+        float height = glm::dot(n, points[i] - p0);
+        if (height < min_height)
+        {
+            min_height = height;
+            q_min = points[i];
+        }
+        if (height > max_height)
+        {
+            max_height = height;
+            q_max = points[i];
+        }
+    }
+
+    if (min_height < 0)
+    {
+        fitTriangle(p0, p1, q_min, points, num_points, best_area, axes);
+        fitTriangle(p1, p2, q_min, points, num_points, best_area, axes);
+        fitTriangle(p2, p0, q_min, points, num_points, best_area, axes);
+    }
+    if (max_height > 0)
+    {
+        fitTriangle(p0, p1, q_max, points, num_points, best_area, axes);
+        fitTriangle(p1, p2, q_max, points, num_points, best_area, axes);
+        fitTriangle(p2, p0, q_max, points, num_points, best_area, axes);
+    }
+}
+
+GLRENDER_INLINE void OBBTree::fitTriangle(glm::vec3 a, glm::vec3 b, glm::vec3 c, const glm::vec3* points, int num_points, float& best_area, glm::vec3 best_axes[3])
+{
+    glm::vec3 n = glm::cross(b - a, c - a);
+    if (glm::dot(n, n) <= 0)
+        return;
+    n = glm::normalize(n);
+
+    // the normal is shared by the three candidates
+    float min_n = glm::dot(n, points[0]);
+    float max_n = min_n;
+    for (int i = 1; i < num_points; i++)
+    {
+        float proj = glm::dot(n, points[i]);
+        min_n = std::min(min_n, proj);
+        max_n = std::max(max_n, proj);
+    }
+    float len_n = max_n - min_n;
+
+    glm::vec3 edges[3] = {b - a, c - b, a - c};
+    for (int e = 0; e < 3; e++)
+    {
+        if (glm::dot(edges[e], edges[e]) <= 0)
+            continue;
+
+        glm::vec3 u = glm::normalize(edges[e]);
+        glm::vec3 w = glm::cross(u, n);
+
+        float min_u = glm::dot(u, points[0]), max_u = min_u;
+        float min_w = glm::dot(w, points[0]), max_w = min_w;
+        for (int i = 1; i < num_points; i++)
+        {
+            float proj_u = glm::dot(u, points[i]);
+            float proj_w = glm::dot(w, points[i]);
+            min_u = std::min(min_u, proj_u);
+            max_u = std::max(max_u, proj_u);
+            min_w = std::min(min_w, proj_w);
+            max_w = std::max(max_w, proj_w);
+        }
+        float len_u = max_u - min_u;
+        float len_w = max_w - min_w;
+
+        float area = len_u*len_n + len_n*len_w + len_w*len_u;
+        if (area < best_area)
+        {
+            best_area = area;
+            best_axes[0] = u;
+            best_axes[1] = n;
+            best_axes[2] = w;
+        }
+    }
+}
+
+GLRENDER_INLINE float OBBTree::boxArea(const glm::vec3* points, int num_points, const glm::vec3 axes[3])
+{
+    float len[3];
+    for (int k = 0; k < 3; k++)
+    {
+        float min_proj = glm::dot(axes[k], points[0]);
+        float max_proj = min_proj;
+        for (int i = 1; i < num_points; i++)
+        {
+            float proj = glm::dot(axes[k], points[i]);
+            min_proj = std::min(min_proj, proj);
+            max_proj = std::max(max_proj, proj);
+        }
+        len[k] = max_proj - min_proj;
+    }
+
+    return len[0]*len[1] + len[1]*len[2] + len[2]*len[0];
+}
+
+GLRENDER_INLINE uint32_t OBBTree::splitMedian(uint32_t begin, uint32_t end, glm::vec3 axes[3], glm::vec3 extent)
+{
+    int axis; // normal of the splitting plane
+    if (extent.x >= extent.y && extent.x >= extent.z)
+        axis = 0;
+    else if (extent.y >= extent.x && extent.y >= extent.z)
+        axis = 1;
+    else
+        axis = 2;
+
+    uint32_t* first = prim_idx_.data() + begin;
+    uint32_t* last = prim_idx_.data() + end;
+    uint32_t f_num = end - begin;
+
+    // centroid along the chosen box axis
+    const triangleCache& tris = obj_ptr_->tri_cache_;
+    glm::vec3 box_axis = axes[axis];
+    auto axis_val = [&tris, box_axis] (uint32_t f) {
+        return glm::dot(box_axis, tris.centroid(f));
+    };
+
+    // only the median is needed, not a full sort
+    uint32_t* median = first + f_num/2;
+    std::nth_element(first, median, last, [&axis_val] (uint32_t a, uint32_t b) {
+        return axis_val(a) < axis_val(b);
+    });
+
+    float delta = axis_val(*median); // loacation of splitting plane
+    float min_val = delta;
+    float max_val = delta;
+    float lower_val = -FLT_MAX; // largest value below the median
+    for (uint32_t* f = first; f != last; f++)
+    {
+        float val = axis_val(*f);
+        min_val = std::min(min_val, val);
+        max_val = std::max(max_val, val);
+        if (f < median)
+            lower_val = std::max(lower_val, val);
+    }
+
+    if (f_num%2 == 0)
+        delta = (lower_val + delta) / 2;
+
+    // all centroids are the same so just split the range in half
+    if (min_val == max_val)
+        return begin + f_num/2;
+
+    uint32_t* split = std::partition(first, last, [&] (uint32_t f) {
+        float val = axis_val(f);
+        return !( (val >= delta && min_val != delta) || val > delta );
+    });
+
+    return begin + (split - first);
+}
+
+GLRENDER_INLINE bool OBBTree::intersectTest(const OBBTree* other_tree, collisionQuery& query) const
+{
+    query.reset(this->nodes_.size(), other_tree->nodes_.size());
+
+    if (this->nodes_.empty() || other_tree->nodes_.empty())
+        return false;
+
+    bool is_intersect = false;
+
+    // object axes, the node axes are relative to them
+    glm::mat4 model_A = this->obj_ptr_->modelMatrix();
+    glm::mat4 model_B = other_tree->obj_ptr_->modelMatrix();
+    glm::vec3 axis_A[3];
+    glm::vec3 axis_B[3];
+    objectAxes(model_A, axis_A);
+    objectAxes(model_B, axis_B);
+
+    OBBPairFrame frame = calcPairFrame(axis_A, model_A, axis_B, model_B);
+
+    if (query.pool_ != NULL)
+        is_intersect = intersectTestParallel(other_tree, frame, query);
+    else if (query.keep_front_)
+        is_intersect = intersectTestFront(other_tree, frame, query);
+    else
+        is_intersect = intersectTestBinary(other_tree, frame, {0, 0}, query, NULL);
+
+    query.finish();
+
+    return is_intersect;
+}
+
+GLRENDER_INLINE bool OBBTree::intersectTestBinary(const OBBTree* other_tree, const OBBPairFrame& frame, NodePair start, collisionQuery& query, std::vector<NodePair>* split) const
+{
+    bool is_intersect = false;
+
+    // node pairs, the first index is from this tree
+    // and the second from other_tree
+    std::stack<uint32_t> node_stack;
+
+    node_stack.push(start.a_node);
+    node_stack.push(start.b_node);
+
+    auto push_pair = [&] (uint32_t a_idx, uint32_t b_idx, bool is_split) {
+        if (is_split)
+            split->push_back({a_idx, b_idx});
+        else
+        {
+            node_stack.push(a_idx);
+            node_stack.push(b_idx);
+        }
+    };
+
+    while (!node_stack.empty())
+    {
+        uint32_t b_idx = node_stack.top();
+        node_stack.pop();
+        uint32_t a_idx = node_stack.top();
+        node_stack.pop();
+
+        const OBBNode& A = this->nodes_[a_idx];
+        const OBBNode& B = other_tree->nodes_[b_idx];
+
+        // children of a pair too big for one task go to split
+        bool is_split = (split != NULL && (A.end_ - A.begin_) + (B.end_ - B.begin_) >= PARALLEL_MIN_PRIMITIVES);
+
+        query.N_v_ += 1;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+        bool is_box_overlap = intersectTest(A, B, frame);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<float, std::milli> time_overlap_test = t2 - t1;
+
+        query.C_v_ += time_overlap_test.count();
+
+        if (is_box_overlap)
+        {
+            if (A.isLeaf() && B.isLeaf())
+            {
+                // overlapping leaves only count if their triangles do
+                if (!intersectLeaves(A, other_tree, B, frame, query))
+                    continue;
+
+                query.markLeaves(a_idx, b_idx);
+                is_intersect = true;
+                continue;
+            }
+
+            // descend into the bigger volume
+            if ( !A.isLeaf() && ( A.volume() > B.volume() || B.isLeaf() ) )
+            {
+                if (A.left_ != OBBNode::NULL_IDX)
+                    push_pair(A.left_, b_idx, is_split);
+                if (A.right_ != OBBNode::NULL_IDX)
+                    push_pair(A.right_, b_idx, is_split);
+            }
             else
             {
-                if (B->left_ != NULL)
-                {
-                    node_stack.push(A);
-                    rot_stack.push(A_rot_ptr);
-                    node_stack.push(B->left_);
-                    rot_stack.push(B_rot_ptr);
-                }
+                if (B.left_ != OBBNode::NULL_IDX)
+                    push_pair(a_idx, B.left_, is_split);
+                if (B.right_ != OBBNode::NULL_IDX)
+                    push_pair(a_idx, B.right_, is_split);
+            }
+        }
+    }
 
-                if (B->right_ != NULL)
-                {
-                    node_stack.push(A);
-                    rot_stack.push(A_rot_ptr);
-                    node_stack.push(B->right_);
-                    rot_stack.push(B_rot_ptr);
-                }
+    // split holds the children in push order, the stack would have
+    // visited them the other way round
+    if (split != NULL)
+        std::reverse(split->begin(), split->end());
+
+    return is_intersect;
+}
+
+GLRENDER_INLINE bool OBBTree::intersectTestFront(const OBBTree* other_tree, const OBBPairFrame& frame, collisionQuery& query) const
+{
+    if (!query.isFrontValid(this, this->build_count_, other_tree, other_tree->build_count_))
+        query.resetFront(this, this->build_count_, other_tree, other_tree->build_count_);
+
+    // every point of either tree is within its radius of its origin
+    const OBBNode& root_A = this->nodes_[0];
+    const OBBNode& root_B = other_tree->nodes_[0];
+    float radius_A = glm::length(root_A.center_) + glm::length(root_A.extent_);
+    float radius_B = glm::length(root_B.center_) + glm::length(root_B.extent_);
+    float motion = query.frontMotion(frame.M_A_, radius_A, frame.M_B_, frame.T_, radius_B);
+
+    const std::vector<collisionQuery::frontPair>& front = query.front_;
+    bool is_from_root = (front.size() == 1 && front[0].a_node_ == 0 && front[0].b_node_ == 0);
+
+    // objects that moved apart are caught by the roots alone
+    // instead of every pair of a deep front
+    if (!is_from_root)
+    {
+        query.N_v_ += 1;
+        float gap;
+        int axis = separatingAxis(root_A, root_B, frame, -1, gap);
+        if (axis >= 0)
+        {
+            query.resetFront(this, this->build_count_, other_tree, other_tree->build_count_);
+            query.front_[0] = {0, 0, axis, gap, query.frontMotion(frame.M_A_, radius_A, frame.M_B_, frame.T_, radius_B)};
+            return false;
+        }
+    }
+
+    bool is_intersect = false;
+
+    std::vector<collisionQuery::frontPair>& next_front = query.nextFront();
+
+    // pushed from the back so pairs come off the stack in the order
+    // they were found, which is the order a full traversal visits them
+    std::stack<collisionQuery::frontPair> pair_stack;
+    for (auto pair = front.rbegin(); pair != front.rend(); ++pair)
+        pair_stack.push(*pair);
+
+    while (!pair_stack.empty())
+    {
+        collisionQuery::frontPair pair = pair_stack.top();
+        pair_stack.pop();
+
+        // the objects have not moved far enough to close the gap yet
+        if (pair.gap_ > 0 && motion - pair.motion_ < pair.gap_)
+        {
+            next_front.push_back(pair);
+            query.num_front_skipped_ += 1;
+            continue;
+        }
+
+        const OBBNode& A = this->nodes_[pair.a_node_];
+        const OBBNode& B = other_tree->nodes_[pair.b_node_];
+
+        query.N_v_ += 1;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+        float gap = 0;
+        int axis = separatingAxis(A, B, frame, pair.axis_, gap);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<float, std::milli> time_overlap_test = t2 - t1;
+
+        query.C_v_ += time_overlap_test.count();
+
+        // separated pairs and leaf pairs are where the traversal stops
+        if (axis >= 0)
+        {
+            next_front.push_back({pair.a_node_, pair.b_node_, axis, gap, motion});
+            continue;
+        }
+
+        if (A.isLeaf() && B.isLeaf())
+        {
+            // overlapping leaves whose triangles are apart get a gap too
+            float leaf_gap = 0;
+            if (intersectLeaves(A, other_tree, B, frame, query))
+            {
+                query.markLeaves(pair.a_node_, pair.b_node_);
+                is_intersect = true;
             }
+            else
+                leaf_gap = leafGap(leafOf(A), other_tree->leafOf(B), frame.M_A_, frame.M_B_, frame.T_);
+
+            next_front.push_back({pair.a_node_, pair.b_node_, -1, leaf_gap, motion});
+            continue;
+        }
+
+        // descend into the bigger volume, children in the same
+        // order as intersectTestBinary()
+        if ( !A.isLeaf() && ( A.volume() > B.volume() || B.isLeaf() ) )
+        {
+            if (A.left_ != OBBNode::NULL_IDX)
+                pair_stack.push({A.left_, pair.b_node_, -1, 0, 0});
+            if (A.right_ != OBBNode::NULL_IDX)
+                pair_stack.push({A.right_, pair.b_node_, -1, 0, 0});
+        }
+        else
+        {
+            if (B.left_ != OBBNode::NULL_IDX)
+                pair_stack.push({pair.a_node_, B.left_, -1, 0, 0});
+            if (B.right_ != OBBNode::NULL_IDX)
+                pair_stack.push({pair.a_node_, B.right_, -1, 0, 0});
         }
     }
 
-    C_v_ /= (float) N_v_;
+    query.swapFront(is_from_root);
 
-    other_tree->N_v_ = this->N_v_;
-    other_tree->C_v_ = this->C_v_;
-    other_tree->num_leaf_overlap_ = this->num_leaf_overlap_;
-    
     return is_intersect;
 }
 
-//doesn't support scaled matrix yet
-GLRENDER_INLINE bool OBBTree::intersectTest(OBBNode* A, glm::vec3 axis_A[3], OBBNode* B, glm::vec3 axis_B[3])
+GLRENDER_INLINE bool OBBTree::intersectTestParallel(const OBBTree* other_tree, const OBBPairFrame& frame, collisionQuery& query) const
 {
+    // one task per pair of the traversal front, each with its own
+    // query and contact buffer, pairs covering fewer triangles than
+    // PARALLEL_MIN_PRIMITIVES are traversed by a single task
+    struct PairTask
+    {
+        NodePair pair_;
+        collisionQuery query_;
+        std::vector<contactPair> contacts_;
+        bool is_intersect_ = false;
 
-    glm::vec3 L; // separating axis
+        // in the order the serial traversal visits them
+        std::vector<std::unique_ptr<PairTask>> children_;
+    };
 
-    for (int i = 0; i < 3; i++)
+    threadPool* pool = query.pool_;
+
+    std::function<void(PairTask*)> run_task = [&] (PairTask* task) {
+        task->query_.list_leaves_ = query.mark_nodes_;
+        if (query.contacts_ != NULL)
+        {
+            task->query_.contacts_ = &task->contacts_;
+            task->query_.max_contacts_ = query.max_contacts_;
+        }
+
+        std::vector<NodePair> split;
+        task->is_intersect_ = intersectTestBinary(other_tree, frame, task->pair_, task->query_, &split);
+
+        for (const NodePair& pair : split)
+        {
+            task->children_.push_back(std::unique_ptr<PairTask>(new PairTask()));
+            task->children_.back()->pair_ = pair;
+        }
+        for (auto& child : task->children_)
+        {
+            PairTask* child_task = child.get();
+            pool->submit([&run_task, child_task] () {run_task(child_task);});
+        }
+    };
+
+    PairTask root;
+    root.pair_ = {0, 0};
+    run_task(&root);
+    pool->wait();
+
+    // merged depth first so the results are the ones of the serial
+    // traversal, whichever thread ran each task
+    bool is_intersect = false;
+
+    std::stack<const PairTask*> task_stack;
+    task_stack.push(&root);
+
+    while (!task_stack.empty())
     {
-        L = axis_A[i];
-        L = glm::normalize(L);
+        const PairTask* task = task_stack.top();
+        task_stack.pop();
 
-        float r_A = std::abs( glm::dot(A->extent_.x * axis_A[0], L) );
-        r_A += std::abs( glm::dot(A->extent_.y * axis_A[1], L) );
-        r_A += std::abs( glm::dot(A->extent_.z * axis_A[2], L) );
+        const collisionQuery& task_query = task->query_;
+        query.N_v_ += task_query.N_v_;
+        query.C_v_ += task_query.C_v_;
+        query.N_p_ += task_query.N_p_;
+        query.C_p_ += task_query.C_p_;
+        query.num_leaf_overlap_ += task_query.num_leaf_overlap_;
 
-        float r_B = std::abs( glm::dot(B->extent_.x * axis_B[0], L) );
-        r_B += std::abs( glm::dot(B->extent_.y * axis_B[1], L) );
-        r_B += std::abs( glm::dot(B->extent_.z * axis_B[2], L) );
+        for (size_t l = 0; l < task_query.leaf_pairs_.size(); l += 2)
+        {
+            query.is_intersect_A_[task_query.leaf_pairs_[l]] = true;
+            query.is_intersect_B_[task_query.leaf_pairs_[l + 1]] = true;
+        }
 
-        glm::vec3 A_center = A->center_[0] * A->axes_[0] + A->center_[1] * A->axes_[1] + A->center_[2] * A->axes_[2];
-        glm::vec3 B_center = B->center_[0] * B->axes_[0] + B->center_[1] * B->axes_[1] + B->center_[2] * B->axes_[2];
+        for (const contactPair& contact : task->contacts_)
+        {
+            if (!query.isCollecting())
+                break;
+            query.contacts_->push_back(contact);
+        }
 
-        glm::vec3 T = glm::vec3(B->tree_->obj_ptr_->modelMatrix() * glm::vec4(B_center,1)) - glm::vec3(A->tree_->obj_ptr_->modelMatrix() * glm::vec4(A_center,1));
+        is_intersect = is_intersect || task->is_intersect_;
 
-        if ( std::abs(glm::dot(T, L)) > (r_A + r_B) )
-            return false;
+        for (size_t c = task->children_.size(); c-- > 0;)
+            task_stack.push(task->children_[c].get());
+    }
+
+    return is_intersect;
+}
 
-        L = axis_B[i];
-        L = glm::normalize(L);
+GLRENDER_INLINE bool OBBTree::intersectTest(OBBTree* other_tree)
+{
+    collisionQuery query;
+    return intersectTestAndMark(other_tree, query);
+}
 
-        r_A = std::abs( glm::dot(A->extent_.x * axis_A[0], L) );
-        r_A += std::abs( glm::dot(A->extent_.y * axis_A[1], L) );
-        r_A += std::abs( glm::dot(A->extent_.z * axis_A[2], L) );
+GLRENDER_INLINE bool OBBTree::contactTest(OBBTree* other_tree, std::vector<contactPair>& contacts, size_t max_contacts)
+{
+    collisionQuery query(&contacts, max_contacts);
+    return intersectTestAndMark(other_tree, query);
+}
 
-        r_B = std::abs( glm::dot(B->extent_.x * axis_B[0], L) );
-        r_B += std::abs( glm::dot(B->extent_.y * axis_B[1], L) );
-        r_B += std::abs( glm::dot(B->extent_.z * axis_B[2], L) );
+GLRENDER_INLINE bool OBBTree::intersectTestAndMark(OBBTree* other_tree, collisionQuery& query)
+{
+    query.mark_nodes_ = true;
+    bool is_intersect = intersectTest(other_tree, query);
 
-        if ( std::abs(glm::dot(T, L)) > (r_A + r_B) )
-            return false;
+    this->is_intersect_.swap(query.is_intersect_A_);
+    other_tree->is_intersect_.swap(query.is_intersect_B_);
+
+    for (OBBTree* tree : {this, other_tree})
+    {
+        tree->N_v_ = query.N_v_;
+        tree->C_v_ = query.C_v_;
+        tree->N_p_ = query.N_p_;
+        tree->C_p_ = query.C_p_;
+        tree->num_leaf_overlap_ = query.num_leaf_overlap_;
     }
 
-    for (int i = 0; i < 3; i++)
-    {    
-        for (int j = 0; j < 3; j++)
+    return is_intersect;
+}
+
+GLRENDER_INLINE float OBBTree::distanceTest(const OBBTree* other_tree, distanceQuery& query) const
+{
+    if (this->nodes_.empty() || other_tree->nodes_.empty())
+    {
+        query.reset();
+        return query.distance_;
+    }
+
+    return distanceTest(other_tree, this->obj_ptr_->modelMatrix(), other_tree->obj_ptr_->modelMatrix(), query);
+}
+
+GLRENDER_INLINE float OBBTree::distanceTest(const OBBTree* other_tree, const glm::mat4& model_A, const glm::mat4& model_B, distanceQuery& query) const
+{
+    query.reset();
+
+    if (this->nodes_.empty() || other_tree->nodes_.empty())
+        return query.distance_;
+
+    glm::vec3 axis_A[3];
+    glm::vec3 axis_B[3];
+    objectAxes(model_A, axis_A);
+    objectAxes(model_B, axis_B);
+
+    OBBPairFrame frame = calcPairFrame(axis_A, model_A, axis_B, model_B);
+
+    // closest points found so far, in A's frame
+    glm::vec3 point_A;
+    glm::vec3 point_B;
+
+    std::vector<distanceQuery::nodePair>& queue = query.queue_;
+
+    query.N_v_ += 1;
+    queue.push_back({distanceBound(this->nodes_[0], other_tree->nodes_[0], frame), 0, 0});
+
+    while (!queue.empty())
+    {
+        std::pop_heap(queue.begin(), queue.end());
+        distanceQuery::nodePair pair = queue.back();
+        queue.pop_back();
+
+        // every pair left is at least this far apart
+        if (pair.bound_ >= query.distance_)
+            break;
+
+        const OBBNode& A = this->nodes_[pair.a_node_];
+        const OBBNode& B = other_tree->nodes_[pair.b_node_];
+
+        if (A.isLeaf() && B.isLeaf())
         {
-            L = glm::cross(axis_A[i], axis_B[j]);
-            if (glm::length(L) == 0)
+            distanceLeaves(leafOf(A), other_tree->leafOf(B), frame.M_A_, frame.M_B_, frame.T_, query, point_A, point_B);
+            if (query.distance_ <= query.tolerance_)
+                break;
+            continue;
+        }
+
+        // descend into the bigger volume
+        bool open_A = !A.isLeaf() && ( A.volume() > B.volume() || B.isLeaf() );
+        const OBBNode& opened = open_A ? A : B;
+
+        for (uint32_t child : {opened.left_, opened.right_})
+        {
+            if (child == OBBNode::NULL_IDX)
                 continue;
-            L = glm::normalize(L);
 
-            float r_A = std::abs( glm::dot(A->extent_.x * axis_A[0], L) );
-            r_A += std::abs( glm::dot(A->extent_.y * axis_A[1], L) );
-            r_A += std::abs( glm::dot(A->extent_.z * axis_A[2], L) );
+            uint32_t a_idx = open_A ? child : pair.a_node_;
+            uint32_t b_idx = open_A ? pair.b_node_ : child;
+
+            query.N_v_ += 1;
+            float bound = distanceBound(this->nodes_[a_idx], other_tree->nodes_[b_idx], frame);
+            if (bound >= query.distance_)
+                continue;
+
+            queue.push_back({bound, a_idx, b_idx});
+            std::push_heap(queue.begin(), queue.end());
+        }
+
+        query.max_queue_size_ = std::max(query.max_queue_size_, (int) queue.size());
+    }
+
+    if (query.distance_ < query.max_distance_)
+    {
+        glm::vec3 origin = glm::vec3(model_A[3]);
+        query.point_A_ = origin + axis_A[0] * point_A.x + axis_A[1] * point_A.y + axis_A[2] * point_A.z;
+        query.point_B_ = origin + axis_A[0] * point_B.x + axis_A[1] * point_B.y + axis_A[2] * point_B.z;
+    }
 
-            float r_B = std::abs( glm::dot(B->extent_.x * axis_B[0], L) );
-            r_B += std::abs( glm::dot(B->extent_.y * axis_B[1], L) );
-            r_B += std::abs( glm::dot(B->extent_.z * axis_B[2], L) );
+    return query.distance_;
+}
 
-            glm::vec3 A_center = A->center_[0] * A->axes_[0] + A->center_[1] * A->axes_[1] + A->center_[2] * A->axes_[2];
-            glm::vec3 B_center = B->center_[0] * B->axes_[0] + B->center_[1] * B->axes_[1] + B->center_[2] * B->axes_[2];
+GLRENDER_INLINE leafTriangles OBBTree::leafOf(const OBBNode& node) const
+{
+    return {&obj_ptr_->tri_cache_, prim_idx_.data(), node.begin_, node.end_};
+}
+
+GLRENDER_INLINE void OBBTree::objectAxes(const glm::mat4& model, glm::vec3 axes[3])
+{
+    glm::vec3 scale;
+    glm::quat rot;
+    glm::vec3 trans;
+    glm::vec3 skew;
+    glm::vec4 persp;
+    glm::decompose(model, scale, rot, trans, skew, persp);
+
+    axes[0] = rot * glm::vec3(1, 0, 0);
+    axes[1] = rot * glm::vec3(0, 1, 0);
+    axes[2] = rot * glm::vec3(0, 0, 1);
+}
 
-            glm::vec3 T = glm::vec3(B->tree_->obj_ptr_->modelMatrix() * glm::vec4(B_center,1)) - glm::vec3(A->tree_->obj_ptr_->modelMatrix() * glm::vec4(A_center,1));
+// the model matrices may scale but not shear
+GLRENDER_INLINE OBBPairFrame OBBTree::calcPairFrame(glm::vec3 axis_A[3], const glm::mat4& model_A, glm::vec3 axis_B[3], const glm::mat4& model_B)
+{
+    OBBPairFrame frame;
 
-            if ( std::abs(glm::dot(T, L)) > (r_A + r_B) )
-                return false;
+    glm::vec3 T = glm::vec3(model_B[3]) - glm::vec3(model_A[3]);
+    for (int i = 0; i < 3; i++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            frame.M_A_[i][k] = glm::dot(axis_A[i], glm::vec3(model_A[k]));
+            frame.M_B_[i][k] = glm::dot(axis_A[i], glm::vec3(model_B[k]));
+            frame.R_[i][k] = glm::dot(axis_A[i], axis_B[k]);
         }
+        frame.T_[i] = glm::dot(axis_A[i], T);
+        frame.scale_A_[i] = glm::length(glm::vec3(model_A[i]));
+        frame.scale_B_[i] = glm::length(glm::vec3(model_B[i]));
     }
 
-    return true;    
+    return frame;
 }
 
-GLRENDER_INLINE void OBBTree::clearIntersectTest()
+GLRENDER_INLINE bool OBBTree::intersectTest(const OBBNode& A, const OBBNode& B, const OBBPairFrame& frame)
 {
-    std::stack<OBBNode*> node_stack;
-    node_stack.push(head_);
+    float t[3];
+    float R[3][3];
+    float abs_R[3][3];
+    nodeFrame(A, B, frame, t, R, abs_R);
 
-    while (!node_stack.empty())
+    float e_A[3];
+    float e_B[3];
+    scaledExtents(A, frame.scale_A_, e_A);
+    scaledExtents(B, frame.scale_B_, e_B);
+
+    return separatingAxisTest(e_A, e_B, t, R, abs_R);
+}
+
+GLRENDER_INLINE int OBBTree::separatingAxis(const OBBNode& A, const OBBNode& B, const OBBPairFrame& frame, int first_axis, float& gap)
+{
+    float t[3];
+    float R[3][3];
+    float abs_R[3][3];
+    nodeFrame(A, B, frame, t, R, abs_R);
+
+    float e_A[3];
+    float e_B[3];
+    scaledExtents(A, frame.scale_A_, e_A);
+    scaledExtents(B, frame.scale_B_, e_B);
+
+    return glr::separatingAxis(e_A, e_B, t, R, abs_R, first_axis, gap);
+}
+
+GLRENDER_INLINE float OBBTree::distanceBound(const OBBNode& A, const OBBNode& B, const OBBPairFrame& frame)
+{
+    float t[3];
+    float R[3][3];
+    float abs_R[3][3];
+    nodeFrame(A, B, frame, t, R, abs_R);
+
+    float e_A[3];
+    float e_B[3];
+    scaledExtents(A, frame.scale_A_, e_A);
+    scaledExtents(B, frame.scale_B_, e_B);
+
+    return boxDistanceBound(e_A, e_B, t, R, abs_R);
+}
+
+GLRENDER_INLINE void OBBTree::scaledExtents(const OBBNode& node, const float scale[3], float e[3])
+{
+    if (scale[0] == scale[1] && scale[1] == scale[2])
     {
-        OBBNode* node = node_stack.top();
-        node_stack.pop();
+        for (int i = 0; i < 3; i++)
+            e[i] = node.extent_[i] * scale[0];
+        return;
+    }
 
-        if (node == NULL)
-            continue;
+    // the scaled box spans sum_j |a_i . S a_j| e_j along node axis a_i
+    for (int i = 0; i < 3; i++)
+    {
+        glm::vec3 scaled_axis = node.axes_[i] * glm::vec3(scale[0], scale[1], scale[2]);
+        e[i] = 0;
+        for (int j = 0; j < 3; j++)
+            e[i] += std::abs(glm::dot(scaled_axis, node.axes_[j])) * node.extent_[j];
+    }
+}
+
+GLRENDER_INLINE void OBBTree::nodeFrame(const OBBNode& A, const OBBNode& B, const OBBPairFrame& frame, float t[3], float R[3][3], float abs_R[3][3])
+{
+    // B's node axes in A's frame
+    glm::vec3 axes_B[3];
+    for (int j = 0; j < 3; j++)
+    {
+        for (int i = 0; i < 3; i++)
+            axes_B[j][i] = frame.R_[i][0] * B.axes_[j][0] + frame.R_[i][1] * B.axes_[j][1] + frame.R_[i][2] * B.axes_[j][2];
+    }
+
+    // rotation from B's node axes to A's node axes
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            R[i][j] = glm::dot(A.axes_[i], axes_B[j]);
+            abs_R[i][j] = std::abs(R[i][j]) + SAT_EPSILON;
+        }
+    }
+
+    // the centers are stored along the node axes
+    glm::vec3 A_center = A.center_[0] * A.axes_[0] + A.center_[1] * A.axes_[1] + A.center_[2] * A.axes_[2];
+    glm::vec3 B_center = B.center_[0] * B.axes_[0] + B.center_[1] * B.axes_[1] + B.center_[2] * B.axes_[2];
+
+    glm::vec3 T;
+    for (int i = 0; i < 3; i++)
+    {
+        T[i] = frame.T_[i];
+        for (int k = 0; k < 3; k++)
+            T[i] += frame.M_B_[i][k] * B_center[k] - frame.M_A_[i][k] * A_center[k];
+    }
+
+    for (int i = 0; i < 3; i++)
+        t[i] = glm::dot(A.axes_[i], T);
+}
+
+GLRENDER_INLINE bool OBBTree::intersectLeaves(const OBBNode& A, const OBBTree* other_tree, const OBBNode& B, const OBBPairFrame& frame, collisionQuery& query) const
+{
+    const triangleCache& tris_A = this->obj_ptr_->tri_cache_;
+    const triangleCache& tris_B = other_tree->obj_ptr_->tri_cache_;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    // B's triangles are moved into A's frame a batch at a time,
+    // b[c][i][k] is axis i of corner c of the k-th triangle
+    float b[3][3][TRIANGLE_BATCH_SIZE] = {};
+    bool is_overlap = false;
+
+    // every hit is listed until the contact buffer is full,
+    // after that only the first hit matters
+    for (uint32_t f_B = B.begin_; f_B < B.end_; f_B += TRIANGLE_BATCH_SIZE)
+    {
+        int num_b = (int) std::min<uint32_t>(TRIANGLE_BATCH_SIZE, B.end_ - f_B);
+        for (int k = 0; k < num_b; k++)
+        {
+            uint32_t t_B = other_tree->prim_idx_[f_B + k];
+            for (int c = 0; c < 3; c++)
+            {
+                glm::vec3 v = tris_B.vertex(t_B, c);
+                for (int i = 0; i < 3; i++)
+                    b[c][i][k] = frame.T_[i] + frame.M_B_[i][0] * v.x + frame.M_B_[i][1] * v.y + frame.M_B_[i][2] * v.z;
+            }
+        }
+
+        for (uint32_t f_A = A.begin_; f_A < A.end_; f_A++)
+        {
+            uint32_t t_A = this->prim_idx_[f_A];
+            glm::vec3 a[3];
+            for (int c = 0; c < 3; c++)
+            {
+                glm::vec3 v = tris_A.vertex(t_A, c);
+                for (int i = 0; i < 3; i++)
+                    a[c][i] = frame.M_A_[i][0] * v.x + frame.M_A_[i][1] * v.y + frame.M_A_[i][2] * v.z;
+            }
+
+            query.N_p_ += num_b;
+            bool find_all = query.isCollecting();
+            int hit_mask = triangleIntersectBatch(a, b, num_b, find_all);
+            if (hit_mask == 0)
+                continue;
 
-        node->is_intersect = false;
+            is_overlap = true;
+            if (!find_all)
+                break;
 
-        node_stack.push(node->left_);
-        node_stack.push(node->right_);
+            for (int k = 0; k < num_b && query.isCollecting(); k++)
+            {
+                if (hit_mask & (1 << k))
+                {
+                    uint32_t t_B = other_tree->prim_idx_[f_B + k];
+                    query.contacts_->push_back({tris_A.shape_idx_[t_A], tris_A.face_idx_[t_A],
+                                          tris_B.shape_idx_[t_B], tris_B.face_idx_[t_B]});
+                }
+            }
+        }
+
+        if (is_overlap && !query.isCollecting())
+            break;
     }
+
+    auto t2 = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<float, std::milli> time_prim_test = t2 - t1;
+
+    query.C_p_ += time_prim_test.count();
+
+    return is_overlap;
 }
 
 } // namespace glr
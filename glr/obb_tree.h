@@ -9,8 +9,15 @@
 #include <glr/tinyobjloader/tiny_obj_loader.h>
 
 #include <glr/shader.h>
+#include <glr/tree_cache.h>
+#include <glr/collision_query.h>
+#include <glr/pair_test.h>
+#include <glr/triangle_intersect.h>
 
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
 
 
 namespace glr
@@ -18,20 +25,90 @@ namespace glr
 
 // forward declarations
 class OBJ;
-struct OBBNode;
+class threadPool;
+
+typedef enum{
+    COVARIANCE_FIT, // eigenvectors of the triangle covariance
+    DITO_FIT // best box of the triangles spanned by the extremal points of 7 fixed directions
+} obbFitType;
+
+struct OBBNode
+{
+    static const uint32_t NULL_IDX = 0xFFFFFFFF;
+
+    glm::vec3 extent_{0.0f, 0.0f, 0.0f};
+
+    glm::vec3 center_{0.0f, 0.0f, 0.0f};
+
+    glm::vec3 axes_[3];
+
+    // indices into OBBTree::nodes_, the left child
+    // is always stored right after its parent
+    uint32_t left_ = NULL_IDX, right_ = NULL_IDX;
+
+    // range of OBBTree::prim_idx_ holding the triangles under this node
+    uint32_t begin_ = 0, end_ = 0;
+
+    bool isLeaf() const {return (left_ == NULL_IDX && right_ == NULL_IDX);}
+
+    float volume() const {return (extent_.x * extent_.y * extent_.z * 2);}
+};
+
+// B's tree seen from A's frame, set up once per intersectTest()
+// so the node pair tests only read precomputed values
+struct OBBPairFrame
+{
+    // maps local centers of A and B into A's rotated frame
+    float M_A_[3][3];
+    float M_B_[3][3];
+    float T_[3];
+
+    // B's object axes in A's frame, the node axes are rotated by it
+    float R_[3][3];
+
+    // scale of each model matrix along its own axes, see
+    // OBBTree::scaledExtents()
+    float scale_A_[3];
+    float scale_B_[3];
+};
+
+// part of a tree built by one task of a parallel build,
+// spliced into OBBTree::nodes_ once every task is done
+struct OBBSubTree
+{
+    std::vector<OBBNode> nodes_;
+
+    // placeholder nodes for subtrees built by other tasks
+    std::vector<uint32_t> slots_;
+    std::vector<std::unique_ptr<OBBSubTree>> sub_trees_;
+};
 
 class OBBTree
 {
     public:
-        OBBNode* head_ = NULL;
+        // depth first order, nodes_[0] is the root
+        std::vector<OBBNode> nodes_;
+
+        // triangle indices into OBJ::tri_cache_, partitioned
+        // in place while building so every node owns a range
+        std::vector<uint32_t> prim_idx_;
 
         // diagnostics
         int num_obb_ = 0;
         int num_primitives_ = 0;
         float total_mem_ = 0;
-
+        float sah_cost_ = 0; // surface area heuristic cost of the tree (lower is better)
+        float build_time_ = 0; // time taken by the last calcTree() in ms
+        float refit_time_ = 0; // time taken by the last refit() in ms, including any rebuild
+        int num_leaves_ = 0;
+        float avg_leaf_size_ = 0; // average number of triangles in a leaf
+
+        // results of the last intersectTest() or contactTest() run
+        // without a collisionQuery, queries keep their own copy
         int N_v_ = 0; // number of volume overlap tests
         float C_v_ = 0; // average time cost of volume overlap test
+        int N_p_ = 0; // number of triangle pair tests
+        float C_p_ = 0; // average time cost of a triangle pair test
         int num_leaf_overlap_ = 0; // number of leaf volumes that overlap
 
     public:
@@ -40,13 +117,75 @@ class OBBTree
         OBBTree(OBJ* obj);
 
         void assignObj(OBJ* obj);
+
+        // how the box axes of each node are chosen when calcTree() is called
+        void fitType(obbFitType fit_type);
+
+        obbFitType fitType();
+
+        // number of threads used by calcTree(), 0 uses
+        // every hardware thread and 1 builds serially
+        void numBuildThreads(int num_threads);
+
+        int numBuildThreads();
+
+        // leaves hold up to max_leaf_size triangles, overlapping
+        // leaves then test the bounds of each triangle pair
+        void maxLeafSize(uint32_t max_leaf_size);
+
+        uint32_t maxLeafSize();
         
         void calcTree();
 
+        // recomputes the box extents for the current triangles (see
+        // OBJ::refit()) and keeps the topology and box axes, the tree
+        // is rebuilt instead once its SAH cost grows past rebuildThreshold()
+        // times the cost right after the last build, returns true if rebuilt
+        //
+        // the GL buffers are not updated, see initGLBuffers()
+        bool refit();
+
+        void rebuildThreshold(float threshold);
+
+        float rebuildThreshold();
+
         void clearTree();
 
+        // writes the built tree to a treeCache file
+        bool saveTree(const std::string& path, uint64_t mesh_hash);
+
+        // replaces the tree with the one cached at path if it was built
+        // from the same triangles and settings, returns false otherwise
+        bool loadTree(const std::string& path, uint64_t mesh_hash);
+
+        // only reads both trees, safe to run from several threads at
+        // once as long as each has its own query and no tree is being
+        // built or refit, lists contacts if query.contacts_ is set
+        bool intersectTest(const OBBTree *other_tree, collisionQuery& query) const;
+
+        // single threaded shorthands, the intersecting leaves and the
+        // diagnostics are kept in both trees for drawing
         bool intersectTest(OBBTree *other_tree);
 
+        // also lists up to max_contacts intersecting triangle pairs,
+        // contacts is cleared first but keeps its capacity, so
+        // reserving max_contacts once avoids allocating per query
+        bool contactTest(OBBTree *other_tree, std::vector<contactPair>& contacts, size_t max_contacts);
+
+        // minimum distance between the two meshes, closest points and
+        // diagnostics go to query, thread safe like intersectTest()
+        float distanceTest(const OBBTree* other_tree, distanceQuery& query) const;
+
+        // distanceTest() with the objects at model_A and model_B
+        // instead of their modelMatrix(), see OBJ::timeOfImpact()
+        float distanceTest(const OBBTree* other_tree, const glm::mat4& model_A, const glm::mat4& model_B, distanceQuery& query) const;
+
+        // eigenvectors of the symmetric matrix {c_xx, c_yy, c_zz, c_xy,
+        // c_xz, c_yz} by a fixed number of cyclic Jacobi sweeps, there
+        // are no data dependent branches so it can run over many
+        // matrices in lockstep
+        static void symmetricEigen(const float cov[6], glm::vec3 axes[3]);
+
         void draw();
 
         void glRelease();
@@ -62,51 +201,136 @@ class OBBTree
     private:
         OBJ* obj_ptr_ = NULL;
 
+        obbFitType fit_type_ = COVARIANCE_FIT;
+        int num_build_threads_ = 1;
+        uint32_t max_leaf_size_ = 1;
+
+        float rebuild_threshold_ = 1.5f;
+        float build_sah_cost_ = 0; // sah_cost_ right after the last build
+
+        // bumped by clearTree() and refit(), a collisionQuery front
+        // is only valid for the bounds it was found on
+        uint32_t build_count_ = 0;
+
+        // subtrees with fewer triangles are built by the task that split them,
+        // node pairs covering fewer are traversed by a single query task
+        static const int PARALLEL_MIN_PRIMITIVES = 2048;
+
+        // cost weights for sah_cost_
+        static constexpr float SAH_TRAVERSAL_COST = 1.0f;
+        static constexpr float SAH_INTERSECT_COST = 1.0f;
+
+        // added to |R| in the separating axis tests
+        static constexpr float SAT_EPSILON = 1e-6f;
+
         // static AABB shader
         static std::string obb_vs_code_;
         static std::string obb_fs_code_;
         static shader obb_shader_;
 
+        // one bit per node, set for intersecting leaves by the
+        // intersectTest() and contactTest() without a query
+        std::vector<bool> is_intersect_;
+
         std::vector<unsigned int> vao_list_;
         std::vector<unsigned int> vbo_list_;
         bool is_loaded_into_gl_ = false;
 
     private:
         
-        OBBNode* calcTree(std::vector<tinyobj::index_t*> f_idx_list);
+        void buildTree();
 
-        glm::vec3 calcMean(const std::vector<tinyobj::index_t*>& f_idx_list);
+        // fills the diagnostics once nodes_ and prim_idx_ are set
+        void calcDiagnostics();
 
-        void calcOBBAxes(const std::vector<tinyobj::index_t*>& f_idx_list, glm::vec3 axes[3]);
+        treeCacheHeader cacheHeader(uint64_t mesh_hash);
 
-        void clearTree(OBBNode* node);
+        void calcSubTree(uint32_t begin, uint32_t end, threadPool* pool, OBBSubTree* sub_tree);
 
-        bool intersectTest(OBBNode* A, glm::vec3 axis_A[3], OBBNode* B, glm::vec3 axis_B[3]);
+        void spliceSubTree(OBBSubTree* sub_tree);
 
-        void clearIntersectTest();
+        // extents of a node from the triangles in its range, along its axes
+        void calcNodeBounds(OBBNode* node);
 
-        void initGLBuffers();
+        // extents of every node along its current axes, the union of the
+        // children's boxes is far too loose once they are rotated so
+        // every node projects its own triangles
+        void calcAllBounds();
 
-        void initGLBuffers(OBBNode* node);
-};
+        float calcSAHCost();
 
-struct OBBNode
-{
-    OBBTree* tree_ = NULL;
+        static float surfaceArea(glm::vec3 extent);
 
-    OBBNode *left_ = NULL, *right_ = NULL;
+        glm::vec3 calcMean(uint32_t begin, uint32_t end);
 
-    glm::vec3 extent_{0.0f, 0.0f, 0.0f};
+        void calcOBBAxes(uint32_t begin, uint32_t end, glm::vec3 axes[3]);
 
-    glm::vec3 center_{0.0f, 0.0f, 0.0f};
+        // DiTO-14 (Larsson and Kallberg 2011), the candidate boxes are
+        // compared by their surface area around the 14 extremal points
+        void calcDiTOAxes(uint32_t begin, uint32_t end, glm::vec3 axes[3]);
 
-    glm::vec3 axes_[3];
+        // tries the three edges of triangle a, b, c as box axes and
+        // keeps the box with the smallest area around points
+        static void fitTriangle(glm::vec3 a, glm::vec3 b, glm::vec3 c, const glm::vec3* points, int num_points, float& best_area, glm::vec3 best_axes[3]);
 
-    bool is_intersect = false;
+        // half the surface area of the box with the given axes around points
+        static float boxArea(const glm::vec3* points, int num_points, const glm::vec3 axes[3]);
 
-    float volume() {return (extent_.x * extent_.y * extent_.z * 2);}
-};
+        // partitions prim_idx_[begin, end) in place and
+        // returns where the right child's range starts
+        uint32_t splitMedian(uint32_t begin, uint32_t end, glm::vec3 axes[3], glm::vec3 extent);
+
+        static OBBPairFrame calcPairFrame(glm::vec3 axis_A[3], const glm::mat4& model_A, glm::vec3 axis_B[3], const glm::mat4& model_B);
+
+        static bool intersectTest(const OBBNode& A, const OBBNode& B, const OBBPairFrame& frame);
+
+        // B's node box relative to A's node box, t along A's node axes
+        // and R rotating B's node axes into A's
+        static void nodeFrame(const OBBNode& A, const OBBNode& B, const OBBPairFrame& frame, float t[3], float R[3][3], float abs_R[3][3]);
+
+        // half sizes along the node axes of the box around the node box
+        // under its model scale, the scaled box itself if the scale is
+        // uniform, a non-uniform one turns it into a parallelepiped
+        static void scaledExtents(const OBBNode& node, const float scale[3], float e[3]);
+
+        static int separatingAxis(const OBBNode& A, const OBBNode& B, const OBBPairFrame& frame, int first_axis, float& gap);
+
+        static float distanceBound(const OBBNode& A, const OBBNode& B, const OBBPairFrame& frame);
+
+        // the triangles under node, for the leaf tests of pair_test.h
+        leafTriangles leafOf(const OBBNode& node) const;
+
+        // rotation of an object as the world directions of its axes
+        static void objectAxes(const glm::mat4& model, glm::vec3 axes[3]);
 
+        // a pair of nodes met by the traversal
+        struct NodePair
+        {
+            uint32_t a_node; // this tree
+            uint32_t b_node; // other_tree
+        };
+
+        // depth first traversal from start, with split set the children
+        // of pairs covering PARALLEL_MIN_PRIMITIVES or more triangles are
+        // added to it in visiting order instead of being traversed
+        bool intersectTestBinary(const OBBTree* other_tree, const OBBPairFrame& frame, NodePair start, collisionQuery& query, std::vector<NodePair>* split) const;
+
+        // intersectTestBinary() from the front kept by query from the
+        // last query instead of the roots, see collisionQuery::keep_front_
+        bool intersectTestFront(const OBBTree* other_tree, const OBBPairFrame& frame, collisionQuery& query) const;
+
+        // splits the traversal into tasks on query.pool_, each with its own
+        // results, merged in the order the serial traversal would find them
+        bool intersectTestParallel(const OBBTree* other_tree, const OBBPairFrame& frame, collisionQuery& query) const;
+
+        // exact triangle test of two overlapping leaves
+        bool intersectLeaves(const OBBNode& A, const OBBTree* other_tree, const OBBNode& B, const OBBPairFrame& frame, collisionQuery& query) const;
+
+        // runs the query and keeps its results in both trees
+        bool intersectTestAndMark(OBBTree* other_tree, collisionQuery& query);
+
+        void initGLBuffers();
+};
 
 } // namespace glr
 
@@ -1,5 +1,10 @@
 #include <glr/obj.h>
 
+#include <glr/dynamic_tree.h>
+
+#include <algorithm>
+#include <cmath>
+
 #ifdef GLRENDER_STATIC
 #include <glad/glad.h>
 #endif
@@ -107,12 +112,14 @@ namespace glr
 
 		calcCenters();
 
+		tri_cache_.build(attrib_, shapes_);
+
 		aabb_tree_.assignObj(this);
 		if (aabb_tree_enabled_)
-			aabb_tree_.calcTree();
+			calcAABBTree();
 		obb_tree_.assignObj(this);
 		if (obb_tree_enabled_)
-			obb_tree_.calcTree();
+			calcOBBTree();
 
 		this->use_vert_colors_.clear();
 		for (int s = 0; s < shapes_.size(); s++)
@@ -220,20 +227,74 @@ namespace glr
 	GLRENDER_INLINE void OBJ::modelMatrix(glm::mat4 mat)
 	{
 		model_matrix_ = mat;
+
+		if (scene_tree_ != NULL)
+			scene_tree_->move(this);
+	}
+
+	GLRENDER_INLINE void OBJ::worldBounds(glm::vec3& min_p, glm::vec3& max_p) const
+	{
+		glm::vec3 center;
+		glm::vec3 extent;
+
+		if (!aabb_tree_.nodes_.empty())
+		{
+			center = aabb_tree_.nodes_[0].center_;
+			extent = aabb_tree_.nodes_[0].extent_;
+		}
+		else if (!obb_tree_.nodes_.empty())
+		{
+			// the center is stored along the node axes
+			const OBBNode& root = obb_tree_.nodes_[0];
+			center = glm::vec3(0.0f);
+			extent = glm::vec3(0.0f);
+			for (int j = 0; j < 3; j++)
+			{
+				center += root.center_[j] * root.axes_[j];
+				for (int i = 0; i < 3; i++)
+					extent[i] += std::abs(root.axes_[j][i]) * root.extent_[j];
+			}
+		}
+		else
+		{
+			center = center_;
+			extent = glm::vec3(radius_);
+		}
+
+		// Arvo 1990, the box around a transformed box
+		glm::vec3 world_center = glm::vec3(model_matrix_ * glm::vec4(center, 1.0f));
+		glm::vec3 world_extent(0.0f);
+		for (int k = 0; k < 3; k++)
+		{
+			for (int i = 0; i < 3; i++)
+				world_extent[i] += std::abs(model_matrix_[k][i]) * extent[k];
+		}
+
+		min_p = world_center - world_extent;
+		max_p = world_center + world_extent;
 	}
 
 	GLRENDER_INLINE void OBJ::enableAABB(bool use)
+	{
+		enableAABB(use, aabb_tree_.buildType());
+	}
+
+	GLRENDER_INLINE void OBJ::enableAABB(bool use, treeBuildType build_type)
 	{
 		if (use)
 		{
 			enableOBB(false);
 			displayOBB(false);
-			aabb_tree_.calcTree();
+			aabb_tree_.buildType(build_type);
+			calcAABBTree();
 		}
 		else
 			aabb_tree_.clearTree();
 		
 		aabb_tree_enabled_ = use;
+
+		if (scene_tree_ != NULL)
+			scene_tree_->move(this);
 	}
 
 	GLRENDER_INLINE void OBJ::displayAABB(bool use)
@@ -248,17 +309,26 @@ namespace glr
 	}
 
 	GLRENDER_INLINE void OBJ::enableOBB(bool use)
+	{
+		enableOBB(use, obb_tree_.fitType());
+	}
+
+	GLRENDER_INLINE void OBJ::enableOBB(bool use, obbFitType fit_type)
 	{
 		if (use)
 		{
 			enableAABB(false);
 			displayAABB(false);
-			obb_tree_.calcTree();
+			obb_tree_.fitType(fit_type);
+			calcOBBTree();
 		}
 		else
 			obb_tree_.clearTree();
 		
 		obb_tree_enabled_ = use;
+
+		if (scene_tree_ != NULL)
+			scene_tree_->move(this);
 	}
 
 	GLRENDER_INLINE void OBJ::displayOBB(bool use)
@@ -272,6 +342,25 @@ namespace glr
 			display_obb_tree_ = false;
 	}
 
+	GLRENDER_INLINE void OBJ::refit()
+	{
+		tri_cache_.build(attrib_, shapes_);
+
+		if (aabb_tree_enabled_)
+		{
+			aabb_tree_.refit();
+			this->displayAABB(this->display_aabb_tree_);
+		}
+		else if (obb_tree_enabled_)
+		{
+			obb_tree_.refit();
+			this->displayOBB(this->display_obb_tree_);
+		}
+
+		if (scene_tree_ != NULL)
+			scene_tree_->move(this);
+	}
+
 	GLRENDER_INLINE bool OBJ::isIntersect(OBJ* other_obj)
 	{
 		bool is_intersect = false;
@@ -293,6 +382,182 @@ namespace glr
 		return is_intersect;
 	}
 
+	GLRENDER_INLINE bool OBJ::isIntersect(OBJ* other_obj, std::vector<contactPair>& contacts, size_t max_contacts)
+	{
+		bool is_intersect = false;
+		contacts.clear();
+		if (aabb_tree_enabled_)
+		{
+			is_intersect = this->aabb_tree_.contactTest( &(other_obj->aabb_tree_), contacts, max_contacts );
+
+			this->displayAABB(this->display_aabb_tree_);
+			other_obj->displayAABB(other_obj->display_aabb_tree_);
+		}
+		else if (obb_tree_enabled_)
+		{
+			is_intersect = this->obb_tree_.contactTest( &(other_obj->obb_tree_), contacts, max_contacts );
+
+			this->displayOBB(this->display_obb_tree_);
+			other_obj->displayOBB(other_obj->display_obb_tree_);
+		}
+
+		return is_intersect;
+	}
+
+	GLRENDER_INLINE bool OBJ::isIntersect(const OBJ* other_obj, collisionQuery& query) const
+	{
+		if (aabb_tree_enabled_)
+			return this->aabb_tree_.intersectTest( &(other_obj->aabb_tree_), query );
+		else if (obb_tree_enabled_)
+			return this->obb_tree_.intersectTest( &(other_obj->obb_tree_), query );
+
+		return false;
+	}
+
+	GLRENDER_INLINE float OBJ::distance(const OBJ* other_obj, distanceQuery& query) const
+	{
+		if (aabb_tree_enabled_)
+			return this->aabb_tree_.distanceTest( &(other_obj->aabb_tree_), query );
+		else if (obb_tree_enabled_)
+			return this->obb_tree_.distanceTest( &(other_obj->obb_tree_), query );
+
+		query.reset();
+		return query.distance_;
+	}
+
+	GLRENDER_INLINE float OBJ::timeOfImpact(const OBJ* other_obj, const glm::mat4& start_A, const glm::mat4& end_A, const glm::mat4& start_B, const glm::mat4& end_B, impactQuery& query) const
+	{
+		query.reset();
+
+		if (!aabb_tree_enabled_ && !obb_tree_enabled_)
+			return query.time_;
+
+		glm::vec3 trans_A[2], scale_A[2], trans_B[2], scale_B[2];
+		glm::quat rot_A[2], rot_B[2];
+		splitModel(start_A, trans_A[0], rot_A[0], scale_A[0]);
+		splitModel(end_A, trans_A[1], rot_A[1], scale_A[1]);
+		splitModel(start_B, trans_B[0], rot_B[0], scale_B[0]);
+		splitModel(end_B, trans_B[1], rot_B[1], scale_B[1]);
+
+		// slerp the short way round
+		if (glm::dot(rot_A[0], rot_A[1]) < 0)
+			rot_A[1] = -rot_A[1];
+		if (glm::dot(rot_B[0], rot_B[1]) < 0)
+			rot_B[1] = -rot_B[1];
+
+		// any two points approach at most as fast as the origins do
+		// plus how fast each point turns and scales about its origin
+		glm::vec3 approach = (trans_B[1] - trans_B[0]) - (trans_A[1] - trans_A[0]);
+		query.motion_bound_ = glm::length(approach) + turnBound(rot_A, scale_A) + other_obj->turnBound(rot_B, scale_B);
+
+		distanceQuery& dist_query = query.distance_query_;
+		dist_query.tolerance_ = query.tolerance_;
+
+		// the points are those of the last distance query, so report
+		// its time rather than the one a last step would have reached
+		float t = 0;
+		float checked_t = 0;
+		for (query.num_iterations_ = 1; query.num_iterations_ <= query.max_iterations_; query.num_iterations_++)
+		{
+			checked_t = t;
+			glm::mat4 model_A = blendModel(trans_A, rot_A, scale_A, t);
+			glm::mat4 model_B = blendModel(trans_B, rot_B, scale_B, t);
+
+			// anything farther apart cannot touch before the frame ends
+			dist_query.max_distance_ = query.tolerance_ + query.motion_bound_ * (1 - t);
+
+			float dist;
+			if (aabb_tree_enabled_)
+				dist = this->aabb_tree_.distanceTest( &(other_obj->aabb_tree_), model_A, model_B, dist_query );
+			else
+				dist = this->obb_tree_.distanceTest( &(other_obj->obb_tree_), model_A, model_B, dist_query );
+
+			if (dist >= dist_query.max_distance_)
+				return query.time_;
+
+			if (dist <= query.tolerance_)
+				break;
+
+			// no two points can meet before this, motion_bound_ is not
+			// zero or dist would have been at least max_distance_
+			t = std::min(1.0f, t + dist / query.motion_bound_);
+		}
+
+		query.num_iterations_ = std::min(query.num_iterations_, query.max_iterations_);
+		query.time_ = checked_t;
+		query.point_A_ = dist_query.point_A_;
+		query.point_B_ = dist_query.point_B_;
+		query.closest_ = dist_query.closest_;
+
+		return query.time_;
+	}
+
+	GLRENDER_INLINE void OBJ::splitModel(const glm::mat4& model, glm::vec3& trans, glm::quat& rot, glm::vec3& scale)
+	{
+		glm::vec3 axes[3];
+		for (int i = 0; i < 3; i++)
+		{
+			axes[i] = glm::vec3(model[i]);
+			scale[i] = glm::length(axes[i]);
+			axes[i] /= scale[i];
+		}
+
+		rot = glm::quat_cast(glm::mat3(axes[0], axes[1], axes[2]));
+		trans = glm::vec3(model[3]);
+	}
+
+	GLRENDER_INLINE glm::mat4 OBJ::blendModel(const glm::vec3 trans[2], const glm::quat rot[2], const glm::vec3 scale[2], float t)
+	{
+		glm::mat4 model = glm::mat4_cast(glm::slerp(rot[0], rot[1], t));
+		for (int i = 0; i < 3; i++)
+			model[i] *= scale[0][i] + (scale[1][i] - scale[0][i]) * t;
+		model[3] = glm::vec4(trans[0] + (trans[1] - trans[0]) * t, 1.0f);
+
+		return model;
+	}
+
+	GLRENDER_INLINE float OBJ::turnBound(const glm::quat rot[2], const glm::vec3 scale[2]) const
+	{
+		// every vertex lies within radius_ of center_
+		float reach = glm::length(center_) + radius_;
+
+		float angle = 2 * std::acos(std::min(1.0f, std::abs(glm::dot(rot[0], rot[1]))));
+		glm::vec3 max_scale = glm::max(glm::abs(scale[0]), glm::abs(scale[1]));
+		glm::vec3 scale_change = glm::abs(scale[1] - scale[0]);
+
+		// a vertex at x turns through at most angle * |S x| and
+		// scales by at most |dS x|
+		float max_s = std::max(max_scale.x, std::max(max_scale.y, max_scale.z));
+		float max_ds = std::max(scale_change.x, std::max(scale_change.y, scale_change.z));
+
+		return reach * (angle * max_s + max_ds);
+	}
+
+	GLRENDER_INLINE bool OBJ::raycast(const glm::vec3& origin, const glm::vec3& dir, float t_max, rayHit& hit) const
+	{
+		if (aabb_tree_enabled_)
+			return this->aabb_tree_.raycast(origin, dir, t_max, hit);
+
+		return false;
+	}
+
+	GLRENDER_INLINE bool OBJ::raycastAny(const glm::vec3& origin, const glm::vec3& dir, float t_max) const
+	{
+		if (aabb_tree_enabled_)
+			return this->aabb_tree_.raycastAny(origin, dir, t_max);
+
+		return false;
+	}
+
+	GLRENDER_INLINE int OBJ::raycastBatch(rayQuery& query) const
+	{
+		if (aabb_tree_enabled_)
+			return this->aabb_tree_.raycastBatch(query);
+
+		query.reset();
+		return 0;
+	}
+
 	GLRENDER_INLINE void OBJ::draw()
 	{
 		int shape_num = shapes_.size();
@@ -323,7 +588,7 @@ namespace glr
 
 			// set up uniforms
 			tinyobj::material_t mat = materials_[shapes_[s].mesh.material_ids[0]];
-			setUniforms(s, mat, shader_list_[s]);
+			setUniforms(mat, shader_list_[s]);
 
 			// draw
 			glBindVertexArray(vao_list_[s]);
@@ -359,10 +624,13 @@ namespace glr
 
 	GLRENDER_INLINE OBJ::~OBJ()
 	{
+		if (scene_tree_ != NULL)
+			scene_tree_->remove(this);
+
 		glRelease();
 	}
 
-	GLRENDER_INLINE void OBJ::setUniforms(unsigned int shape_idx, tinyobj::material_t &mat, shader *shader_ptr)
+	GLRENDER_INLINE void OBJ::setUniforms(tinyobj::material_t &mat, shader *shader_ptr)
 	{
 		// model matrix
 		int u_location = glGetUniformLocation(shader_ptr->ID_, "m");
@@ -649,15 +917,13 @@ namespace glr
 					vx = attrib_.vertices[3 * idx.vertex_index + 0];
 					vy = attrib_.vertices[3 * idx.vertex_index + 1];
 					vz = attrib_.vertices[3 * idx.vertex_index + 2];
+
+					float tmp = glm::length(glm::vec3(vx, vy, vz) - shape_center);
+					if (tmp > radius)
+						radius = tmp;
 				}
 
 				index_offset += 3;
-
-				glm::vec3 v = glm::vec3(vx, vy, vz);
-
-				float tmp = glm::length(v - shape_center);
-				if (tmp > radius)
-					radius = tmp;
 			}
 
 			shape_radii_.push_back(radius);
@@ -694,17 +960,51 @@ namespace glr
 					vx = attrib_.vertices[3 * idx.vertex_index + 0];
 					vy = attrib_.vertices[3 * idx.vertex_index + 1];
 					vz = attrib_.vertices[3 * idx.vertex_index + 2];
+
+					float tmp = glm::length(glm::vec3(vx, vy, vz) - center_);
+					if (tmp > radius_)
+						radius_ = tmp;
 				}
 
 				index_offset += 3;
+			}
+		}
+	}
 
-				glm::vec3 v = glm::vec3(vx, vy, vz);
+	GLRENDER_INLINE void OBJ::calcAABBTree()
+	{
+		if (treeCache::directory().empty())
+		{
+			aabb_tree_.calcTree();
+			return;
+		}
 
-				float tmp = glm::length(v - center_);
-				if (tmp > radius_)
-					radius_ = tmp;
-			}
+		uint64_t mesh_hash = treeCache::meshHash(tri_cache_);
+		std::string path = treeCache::filePath(mesh_hash, treeCache::AABB_TREE, aabb_tree_.buildType(), aabb_tree_.maxLeafSize());
+
+		if (aabb_tree_.loadTree(path, mesh_hash))
+			return;
+
+		aabb_tree_.calcTree();
+		aabb_tree_.saveTree(path, mesh_hash);
+	}
+
+	GLRENDER_INLINE void OBJ::calcOBBTree()
+	{
+		if (treeCache::directory().empty())
+		{
+			obb_tree_.calcTree();
+			return;
 		}
+
+		uint64_t mesh_hash = treeCache::meshHash(tri_cache_);
+		std::string path = treeCache::filePath(mesh_hash, treeCache::OBB_TREE, obb_tree_.fitType(), obb_tree_.maxLeafSize());
+
+		if (obb_tree_.loadTree(path, mesh_hash))
+			return;
+
+		obb_tree_.calcTree();
+		obb_tree_.saveTree(path, mesh_hash);
 	}
 
 } // namespace glr
\ No newline at end of file
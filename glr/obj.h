@@ -7,6 +7,8 @@
 #include <glr/shader.h>
 #include <glr/aabb_tree.h>
 #include <glr/obb_tree.h>
+#include <glr/triangle_cache.h>
+#include <glr/tree_cache.h>
 
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
@@ -20,6 +22,8 @@
 
 namespace glr {
 
+class dynamicTree;
+
 class OBJ
 {
     public:
@@ -37,10 +41,13 @@ class OBJ
         glm::vec3 center_; // center of entire obj
         float radius_; // radius of unscaled obj
 
+        triangleCache tri_cache_; // triangles used by the trees
+
         AABBTree aabb_tree_;
         OBBTree obb_tree_;
 
         friend class renderBase;
+        friend class dynamicTree;
         friend class sceneViewer;
         friend class sceneViewer2D;
 
@@ -82,17 +89,66 @@ class OBJ
 
         void modelMatrix(glm::mat4 mat);
 
-        // geometry
+        // world space box around the root of the enabled tree, or
+        // around center_ and radius_ without one, under modelMatrix()
+        void worldBounds(glm::vec3& min_p, glm::vec3& max_p) const;
+
+        // geometry, the trees are loaded from treeCache::directory()
+        // when a tree for the same triangles and settings was cached,
+        // the tree keeps its current build type unless one is passed
         void enableAABB(bool use);
 
+        void enableAABB(bool use, treeBuildType build_type);
+
         void displayAABB(bool use);
 
+        // keeps the current fit type unless one is passed
         void enableOBB(bool use);
 
+        void enableOBB(bool use, obbFitType fit_type);
+
         void displayOBB(bool use);
 
         bool isIntersect(OBJ* other_obj);
 
+        // isIntersect() that also fills contacts with up to max_contacts
+        // intersecting triangle pairs, this object is A and other_obj B,
+        // reserve max_contacts once and reuse contacts every frame
+        bool isIntersect(OBJ* other_obj, std::vector<contactPair>& contacts, size_t max_contacts);
+
+        // thread safe version, nothing is written outside query so
+        // worker threads can test the same objects at once
+        bool isIntersect(const OBJ* other_obj, collisionQuery& query) const;
+
+        // minimum distance to other_obj through the enabled tree,
+        // query.max_distance_ if no tree is enabled, thread safe as above
+        float distance(const OBJ* other_obj, distanceQuery& query) const;
+
+        // continuous collision test over one frame, this object moves
+        // from start_A to end_A and other_obj from start_B to end_B,
+        // returns a time in [0, 1] no later than their first contact
+        // at which they are within query.tolerance_, or FLT_MAX, see
+        // impactQuery
+        //
+        // in between, translation and scale are interpolated linearly
+        // and rotation with slerp, the matrices may scale but not shear,
+        // modelMatrix() is neither used nor changed so this is thread
+        // safe as above
+        float timeOfImpact(const OBJ* other_obj, const glm::mat4& start_A, const glm::mat4& end_A, const glm::mat4& start_B, const glm::mat4& end_B, impactQuery& query) const;
+
+        // AABBTree::raycast() and raycastAny() on this object, both
+        // miss unless enableAABB() was called
+        bool raycast(const glm::vec3& origin, const glm::vec3& dir, float t_max, rayHit& hit) const;
+
+        bool raycastAny(const glm::vec3& origin, const glm::vec3& dir, float t_max) const;
+
+        // AABBTree::raycastBatch(), every ray misses without the tree
+        int raycastBatch(rayQuery& query) const;
+
+        // call after editing attrib_.vertices, updates the triangle
+        // cache and refits the enabled tree without a full rebuild
+        void refit();
+
         // draw object
         void draw();
 
@@ -131,11 +187,32 @@ class OBJ
         bool obb_tree_enabled_ = false;
         bool display_obb_tree_ = false;
 
+        // set by dynamicTree::insert(), moved along with the object
+        dynamicTree* scene_tree_ = NULL;
+        int32_t scene_leaf_ = -1;
+
     private:
 
-        void setUniforms(unsigned int shapde_idx, tinyobj::material_t &mat, shader* shader_ptr);
+        void setUniforms(tinyobj::material_t &mat, shader* shader_ptr);
 
         void calcCenters();
+
+        // build the tree or load it from the tree cache
+        void calcAABBTree();
+
+        void calcOBBTree();
+
+        // model matrix without shear split into its parts
+        static void splitModel(const glm::mat4& model, glm::vec3& trans, glm::quat& rot, glm::vec3& scale);
+
+        // model matrix at time t between the split start and end ones,
+        // rot[1] has to be on the same side of the quaternion sphere
+        static glm::mat4 blendModel(const glm::vec3 trans[2], const glm::quat rot[2], const glm::vec3 scale[2], float t);
+
+        // how far the vertices of this object can move over a frame
+        // when it goes from the split start to end matrices, ignoring
+        // the translation
+        float turnBound(const glm::quat rot[2], const glm::vec3 scale[2]) const;
 };
 
 } // namespace glr
@@ -0,0 +1,223 @@
+#include <glr/pair_test.h>
+#include <glr/triangle_intersect.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace glr
+{
+
+GLRENDER_INLINE bool separatingAxisTest(const float e_A[3], const float e_B[3], const float t[3], const float R[3][3], const float abs_R[3][3])
+{
+    // Gottschalk et al. 1996, A's axes are the identity and B's
+    // are the columns of R, returns true if no axis separates them
+
+    // A's axes
+    for (int i = 0; i < 3; i++)
+    {
+        float r = e_A[i] + abs_R[i][0] * e_B[0] + abs_R[i][1] * e_B[1] + abs_R[i][2] * e_B[2];
+        if (std::abs(t[i]) > r)
+            return false;
+    }
+
+    // B's axes
+    for (int j = 0; j < 3; j++)
+    {
+        float r = e_B[j] + abs_R[0][j] * e_A[0] + abs_R[1][j] * e_A[1] + abs_R[2][j] * e_A[2];
+        float dist = R[0][j] * t[0] + R[1][j] * t[1] + R[2][j] * t[2];
+        if (std::abs(dist) > r)
+            return false;
+    }
+
+    // cross products of A's axis i and B's axis j, their length
+    // cancels out so they are not normalised
+    for (int i = 0; i < 3; i++)
+    {
+        int i1 = (i + 1) % 3;
+        int i2 = (i + 2) % 3;
+        for (int j = 0; j < 3; j++)
+        {
+            int j1 = (j + 1) % 3;
+            int j2 = (j + 2) % 3;
+
+            float r = e_A[i1] * abs_R[i2][j] + e_A[i2] * abs_R[i1][j]
+                      + e_B[j1] * abs_R[i][j2] + e_B[j2] * abs_R[i][j1];
+            float dist = t[i2] * R[i1][j] - t[i1] * R[i2][j];
+            if (std::abs(dist) > r)
+                return false;
+        }
+    }
+
+    return true;
+}
+GLRENDER_INLINE int separatingAxis(const float e_A[3], const float e_B[3], const float t[3], const float R[3][3], const float abs_R[3][3], int first_axis, float& gap)
+{
+    // the axis that separated the pair last time most likely still does
+    int axis = -1;
+    if (first_axis >= 0 && axisGap(first_axis, e_A, e_B, t, R, abs_R) > 0)
+        axis = first_axis;
+
+    for (int k = 0; k < 15 && axis < 0; k++)
+    {
+        if (k != first_axis && axisGap(k, e_A, e_B, t, R, abs_R) > 0)
+            axis = k;
+    }
+
+    if (axis < 0)
+        return -1;
+
+    // the cross product axes are not normalised, |a_i x b_j| is
+    // sqrt(1 - R_ij^2) and nearly parallel axes give no usable gap
+    gap = axisGap(axis, e_A, e_B, t, R, abs_R);
+    if (axis >= 6)
+    {
+        float R_ij = R[(axis - 6) / 3][(axis - 6) % 3];
+        float length = std::sqrt(std::max(0.0f, 1.0f - R_ij * R_ij));
+        gap = (length > 1e-3f) ? gap / length : 0;
+    }
+
+    return axis;
+}
+GLRENDER_INLINE float axisGap(int axis, const float e_A[3], const float e_B[3], const float t[3], const float R[3][3], const float abs_R[3][3])
+{
+    // numbered in the order separatingAxisTest() tries them, the
+    // result is positive exactly when that test finds the axis
+    if (axis < 3)
+    {
+        int i = axis;
+        float r = e_A[i] + abs_R[i][0] * e_B[0] + abs_R[i][1] * e_B[1] + abs_R[i][2] * e_B[2];
+        return std::abs(t[i]) - r;
+    }
+
+    if (axis < 6)
+    {
+        int j = axis - 3;
+        float r = e_B[j] + abs_R[0][j] * e_A[0] + abs_R[1][j] * e_A[1] + abs_R[2][j] * e_A[2];
+        float dist = R[0][j] * t[0] + R[1][j] * t[1] + R[2][j] * t[2];
+        return std::abs(dist) - r;
+    }
+
+    int i = (axis - 6) / 3;
+    int j = (axis - 6) % 3;
+    int i1 = (i + 1) % 3;
+    int i2 = (i + 2) % 3;
+    int j1 = (j + 1) % 3;
+    int j2 = (j + 2) % 3;
+
+    float r = e_A[i1] * abs_R[i2][j] + e_A[i2] * abs_R[i1][j]
+              + e_B[j1] * abs_R[i][j2] + e_B[j2] * abs_R[i][j1];
+    float dist = t[i2] * R[i1][j] - t[i1] * R[i2][j];
+    return std::abs(dist) - r;
+}
+GLRENDER_INLINE float boxDistanceBound(const float e_A[3], const float e_B[3], const float t[3], const float R[3][3], const float abs_R[3][3])
+{
+    // the gap along any unit axis is never more than the distance,
+    // the face normals of both boxes are the cheap ones to check and
+    // the line between the centers is tight once the boxes are apart
+    float bound = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        float r = e_A[i] + e_B[0] * abs_R[i][0] + e_B[1] * abs_R[i][1] + e_B[2] * abs_R[i][2];
+        bound = std::max(bound, std::abs(t[i]) - r);
+    }
+    for (int j = 0; j < 3; j++)
+    {
+        float r = e_A[0] * abs_R[0][j] + e_A[1] * abs_R[1][j] + e_A[2] * abs_R[2][j] + e_B[j];
+        float dist = t[0] * R[0][j] + t[1] * R[1][j] + t[2] * R[2][j];
+        bound = std::max(bound, std::abs(dist) - r);
+    }
+
+    float length = std::sqrt(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+    if (length > bound)
+    {
+        float d[3] = {t[0] / length, t[1] / length, t[2] / length};
+        float r = e_A[0] * std::abs(d[0]) + e_A[1] * std::abs(d[1]) + e_A[2] * std::abs(d[2]);
+        for (int j = 0; j < 3; j++)
+            r += e_B[j] * std::abs(d[0] * R[0][j] + d[1] * R[1][j] + d[2] * R[2][j]);
+        bound = std::max(bound, length - r);
+    }
+
+    return bound;
+}
+
+GLRENDER_INLINE float leafGap(const leafTriangles& A, const leafTriangles& B, const float M_A[3][3], const float M_B[3][3], const float T[3])
+{
+    const triangleCache& tris_A = *A.tris_;
+    const triangleCache& tris_B = *B.tris_;
+
+    float gap = FLT_MAX;
+    for (uint32_t f_A = A.begin_; f_A < A.end_ && gap > 0; f_A++)
+    {
+        uint32_t t_A = A.prim_idx_[f_A];
+        glm::vec3 a[3];
+        for (int c = 0; c < 3; c++)
+        {
+            glm::vec3 v = tris_A.vertex(t_A, c);
+            for (int i = 0; i < 3; i++)
+                a[c][i] = M_A[i][0] * v.x + M_A[i][1] * v.y + M_A[i][2] * v.z;
+        }
+
+        for (uint32_t f_B = B.begin_; f_B < B.end_ && gap > 0; f_B++)
+        {
+            uint32_t t_B = B.prim_idx_[f_B];
+            glm::vec3 b[3];
+            for (int c = 0; c < 3; c++)
+            {
+                glm::vec3 v = tris_B.vertex(t_B, c);
+                for (int i = 0; i < 3; i++)
+                    b[c][i] = T[i] + M_B[i][0] * v.x + M_B[i][1] * v.y + M_B[i][2] * v.z;
+            }
+
+            gap = std::min(gap, triangleSeparation(a, b));
+        }
+    }
+
+    return gap;
+}
+
+GLRENDER_INLINE void distanceLeaves(const leafTriangles& A, const leafTriangles& B, const float M_A[3][3], const float M_B[3][3], const float T[3], distanceQuery& query, glm::vec3& point_A, glm::vec3& point_B)
+{
+    const triangleCache& tris_A = *A.tris_;
+    const triangleCache& tris_B = *B.tris_;
+
+    for (uint32_t f_A = A.begin_; f_A < A.end_; f_A++)
+    {
+        uint32_t t_A = A.prim_idx_[f_A];
+        glm::vec3 a[3];
+        for (int c = 0; c < 3; c++)
+        {
+            glm::vec3 v = tris_A.vertex(t_A, c);
+            for (int i = 0; i < 3; i++)
+                a[c][i] = M_A[i][0] * v.x + M_A[i][1] * v.y + M_A[i][2] * v.z;
+        }
+
+        for (uint32_t f_B = B.begin_; f_B < B.end_; f_B++)
+        {
+            uint32_t t_B = B.prim_idx_[f_B];
+            glm::vec3 b[3];
+            for (int c = 0; c < 3; c++)
+            {
+                glm::vec3 v = tris_B.vertex(t_B, c);
+                for (int i = 0; i < 3; i++)
+                    b[c][i] = T[i] + M_B[i][0] * v.x + M_B[i][1] * v.y + M_B[i][2] * v.z;
+            }
+
+            query.N_p_ += 1;
+            glm::vec3 p;
+            glm::vec3 q;
+            float dist = triangleDistance(a, b, p, q);
+            if (dist >= query.distance_)
+                continue;
+
+            query.distance_ = dist;
+            query.closest_ = {tris_A.shape_idx_[t_A], tris_A.face_idx_[t_A], tris_B.shape_idx_[t_B], tris_B.face_idx_[t_B]};
+            point_A = p;
+            point_B = q;
+            if (dist <= query.tolerance_)
+                return;
+        }
+    }
+}
+
+} // namespace glr
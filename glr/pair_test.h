@@ -0,0 +1,63 @@
+#ifndef PAIRTEST_H
+#define PAIRTEST_H
+#include "glr_inline.h"
+
+#include <glr/collision_query.h>
+#include <glr/triangle_cache.h>
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+namespace glr
+{
+
+// Tests between a node of AABBTree or OBBTree and a node of the
+// tree it is queried against
+//
+// The box tests work in A's box frame: A's axes are the identity,
+// B's axes are the columns of R and t is B's center minus A's
+// center. e_A and e_B are the half sizes and abs_R is |R| plus
+// the tree's SAT_EPSILON, so near parallel axes do not separate.
+
+// the 15 axis test of two boxes, cheapest axes first so most
+// pairs exit early, returns true if no axis separates them
+bool separatingAxisTest(const float e_A[3], const float e_B[3], const float t[3], const float R[3][3], const float abs_R[3][3]);
+
+// index of an axis separating two boxes, trying first_axis first,
+// -1 exactly when separatingAxisTest() is true, gap is set to the
+// distance between the boxes along the axis
+int separatingAxis(const float e_A[3], const float e_B[3], const float t[3], const float R[3][3], const float abs_R[3][3], int first_axis, float& gap);
+
+// one of the 15 axes of separatingAxisTest(), in its order, the
+// boxes are apart along it by the result over the axis length
+float axisGap(int axis, const float e_A[3], const float e_B[3], const float t[3], const float R[3][3], const float abs_R[3][3]);
+
+// lower bound of the distance between two boxes
+float boxDistanceBound(const float e_A[3], const float e_B[3], const float t[3], const float R[3][3], const float abs_R[3][3]);
+
+// the triangles of a leaf, tris_ indexed by prim_idx_[begin_, end_)
+struct leafTriangles
+{
+    const triangleCache* tris_;
+    const uint32_t* prim_idx_;
+    uint32_t begin_;
+    uint32_t end_;
+};
+
+// smallest triangleSeparation() between the triangles of two
+// leaves, how far B can move relative to A before they may touch,
+// M_A maps A's corners and M_B and T map B's into A's object frame
+float leafGap(const leafTriangles& A, const leafTriangles& B, const float M_A[3][3], const float M_B[3][3], const float T[3]);
+
+// closer triangle pairs of two leaves update query, mapped as in
+// leafGap(), the points are kept in A's frame until the query ends
+void distanceLeaves(const leafTriangles& A, const leafTriangles& B, const float M_A[3][3], const float M_B[3][3], const float T[3], distanceQuery& query, glm::vec3& point_A, glm::vec3& point_B);
+
+} // namespace glr
+
+#ifndef GLRENDER_STATIC
+#   include <glr/pair_test.cpp>
+#endif
+
+#endif
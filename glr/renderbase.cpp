@@ -23,12 +23,15 @@ GLRENDER_INLINE void renderBase::addOBJ(std::string obj_path, std::string base_d
 	{
 		new_obj = getOBJ(obj_name);
 		*new_obj = OBJ(obj_path, base_dir, obj_name, calc_normals, flip_normals);
+		scene_tree_.move(new_obj);
 	}
 	else
 	{
 		new_obj = new OBJ(obj_path, base_dir, obj_name, calc_normals, flip_normals);
 
 		obj_list_.push_back(new_obj);
+		broadphase_.add(new_obj);
+		scene_tree_.insert(new_obj);
 	}
 	
 	for (int s = 0; s < new_obj->shapes_.size(); s++)
@@ -70,6 +73,8 @@ GLRENDER_INLINE void renderBase::deleteOBJ(std::string obj_name)
 	for (obj = 0; obj < obj_list_.size(); obj++)
 		if (obj_list_[obj]->name_ == obj_name) break;
 
+	broadphase_.remove(obj_list_[obj]);
+	scene_tree_.remove(obj_list_[obj]);
 	delete obj_list_[obj];
 	obj_list_.erase(obj_list_.begin() + obj);
 }
@@ -210,6 +215,59 @@ GLRENDER_INLINE bool renderBase::textureExist(std::string texture_name)
 }
 
 
+/*
+*
+*
+PUBLIC COLLISION STUFF
+*
+*
+*/
+
+GLRENDER_INLINE std::vector<std::pair<OBJ*, OBJ*>> renderBase::collidingPairs()
+{
+	std::vector<std::pair<OBJ*, OBJ*>> pairs;
+	if (broadphase_type_ == SPATIAL_HASH)
+	{
+		hash_grid_.update(obj_list_);
+		hash_grid_.overlappingPairs(pairs);
+	}
+	else
+	{
+		broadphase_.update();
+		broadphase_.overlappingPairs(pairs);
+	}
+
+	std::vector<std::pair<OBJ*, OBJ*>> colliding;
+	for (size_t p = 0; p < pairs.size(); p++)
+	{
+		if (pairs[p].first->isIntersect(pairs[p].second, narrowphase_query_))
+			colliding.push_back(pairs[p]);
+	}
+
+	return colliding;
+}
+
+GLRENDER_INLINE void renderBase::broadphase(broadphaseType type)
+{
+	broadphase_type_ = type;
+}
+
+GLRENDER_INLINE broadphaseType renderBase::broadphase()
+{
+	return broadphase_type_;
+}
+
+GLRENDER_INLINE spatialHashGrid* renderBase::hashGrid()
+{
+	return &hash_grid_;
+}
+
+GLRENDER_INLINE dynamicTree* renderBase::sceneTree()
+{
+	return &scene_tree_;
+}
+
+
 GLRENDER_INLINE void renderBase::cleanup()
 {
 	for (int s = 0; s < shaders_.size(); s++)
@@ -221,6 +279,8 @@ GLRENDER_INLINE void renderBase::cleanup()
 	for (int o = 0; o < obj_list_.size(); o++)
 		delete obj_list_[o];
 	obj_list_.clear();
+	broadphase_.clear();
+	scene_tree_.clear();
 
 	is_init_ = false;
 }
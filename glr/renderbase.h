@@ -5,8 +5,12 @@
 #include <glr/shader.h>
 #include <glr/texture.h>
 #include <glr/obj.h>
+#include <glr/broadphase.h>
+#include <glr/dynamic_tree.h>
+#include <glr/collision_query.h>
 
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace glr {
@@ -53,6 +57,26 @@ class renderBase
 
         void deleteTexture(std::string texture_name);
 
+        // collision
+
+        // every pair of objects whose meshes intersect this frame,
+        // only pairs whose world bounds overlap reach the trees,
+        // objects without an enabled tree never collide
+        std::vector<std::pair<OBJ*, OBJ*>> collidingPairs();
+
+        // broadphase used by collidingPairs()
+        void broadphase(broadphaseType type);
+
+        broadphaseType broadphase();
+
+        // cell size and pool of the SPATIAL_HASH broadphase
+        spatialHashGrid* hashGrid();
+
+        // every object is kept in this tree from addOBJ() to
+        // deleteOBJ() and moved by OBJ::modelMatrix(mat), use it
+        // for region and overlap queries on the scene
+        dynamicTree* sceneTree();
+
         // draw
 
         virtual void drawScene() = 0;
@@ -68,6 +92,12 @@ class renderBase
 
         std::vector<OBJ*> obj_list_;
 
+        broadphaseType broadphase_type_ = SWEEP_AND_PRUNE;
+        sweepAndPrune broadphase_;
+        spatialHashGrid hash_grid_;
+        dynamicTree scene_tree_;
+        collisionQuery narrowphase_query_; // reused by collidingPairs()
+
         std::vector<shader*> shaders_;
         const int MAX_SHADER_COUNT = 100;            
         std::vector<texture*> textures_;
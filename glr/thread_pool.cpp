@@ -0,0 +1,156 @@
+#include <glr/thread_pool.h>
+
+namespace glr
+{
+
+GLRENDER_INLINE threadPool::threadPool(int num_threads)
+{
+    if (num_threads <= 0)
+        num_threads = hardwareThreads();
+
+    for (int t = 0; t < num_threads; t++)
+        queues_.push_back(std::unique_ptr<taskQueue>(new taskQueue()));
+
+    for (int t = 1; t < num_threads; t++)
+        workers_.push_back(std::thread(&threadPool::workerLoop, this, t));
+}
+
+GLRENDER_INLINE int threadPool::numThreads()
+{
+    return workers_.size() + 1;
+}
+
+GLRENDER_INLINE void threadPool::submit(std::function<void()> task)
+{
+    taskQueue& queue = *queues_[queueIndex()];
+    {
+        // counted before another thread can pop it, or its pop and run
+        // could bring num_pending_ to 0 with tasks left and end wait(),
+        // the queue is locked first as in popTask()
+        std::lock_guard<std::mutex> queue_lock(queue.mutex_);
+        std::lock_guard<std::mutex> lock(mutex_);
+        num_queued_ += 1;
+        num_pending_ += 1;
+        queue.tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+}
+
+GLRENDER_INLINE void threadPool::wait()
+{
+    int queue_idx = queueIndex();
+    std::function<void()> task;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (num_pending_ > 0)
+    {
+        if (num_queued_ <= 0)
+        {
+            cv_.wait(lock, [this] { return num_queued_ > 0 || num_pending_ == 0; });
+            continue;
+        }
+
+        lock.unlock();
+        if (popTask(queue_idx, task))
+            runTask(task);
+        lock.lock();
+    }
+}
+
+GLRENDER_INLINE threadPool::~threadPool()
+{
+    wait();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+
+    for (int t = 0; t < workers_.size(); t++)
+        workers_[t].join();
+}
+
+GLRENDER_INLINE int threadPool::hardwareThreads()
+{
+    int n = std::thread::hardware_concurrency();
+    return (n > 0) ? n : 1;
+}
+
+GLRENDER_INLINE void threadPool::workerLoop(int queue_idx)
+{
+    currentWorker().pool_ = this;
+    currentWorker().queue_idx_ = queue_idx;
+
+    std::function<void()> task;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+        cv_.wait(lock, [this] { return stop_ || num_queued_ > 0; });
+
+        if (stop_)
+            return;
+
+        lock.unlock();
+        if (popTask(queue_idx, task))
+            runTask(task);
+        lock.lock();
+    }
+}
+
+GLRENDER_INLINE threadPool::workerInfo& threadPool::currentWorker()
+{
+    static thread_local workerInfo worker;
+    return worker;
+}
+
+GLRENDER_INLINE int threadPool::queueIndex()
+{
+    const workerInfo& worker = currentWorker();
+    return (worker.pool_ == this) ? worker.queue_idx_ : 0;
+}
+
+GLRENDER_INLINE bool threadPool::popTask(int queue_idx, std::function<void()>& task)
+{
+    int num_queues = queues_.size();
+    for (int q = 0; q < num_queues; q++)
+    {
+        taskQueue& queue = *queues_[(queue_idx + q) % num_queues];
+        std::lock_guard<std::mutex> queue_lock(queue.mutex_);
+        if (queue.tasks_.empty())
+            continue;
+
+        // LIFO on the own queue keeps the most recently split (smallest)
+        // subtrees hot in cache, the oldest and biggest tasks are stolen
+        if (q == 0)
+        {
+            task = std::move(queue.tasks_.back());
+            queue.tasks_.pop_back();
+        }
+        else
+        {
+            task = std::move(queue.tasks_.front());
+            queue.tasks_.pop_front();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        num_queued_ -= 1;
+        return true;
+    }
+
+    return false;
+}
+
+GLRENDER_INLINE void threadPool::runTask(std::function<void()>& task)
+{
+    task();
+    task = nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_pending_ -= 1;
+    if (num_pending_ == 0)
+        cv_.notify_all();
+}
+
+} // namespace glr
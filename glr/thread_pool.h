@@ -0,0 +1,96 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+#include "glr_inline.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace glr
+{
+
+// Task pool used to spread tree builds and large
+// queries over several cores
+//
+// The thread calling wait() also runs tasks, so a pool
+// with num_threads threads starts num_threads-1 workers.
+// Every thread has its own deque of tasks behind a mutex,
+// not a lock free work stealing deque. Tasks can submit
+// more tasks while running, they go to the submitting
+// thread's deque and are run newest first, idle threads
+// take the oldest task of another deque. wait() must not
+// be called from inside a task.
+class threadPool
+{
+    public:
+        threadPool(int num_threads);
+
+        int numThreads();
+
+        void submit(std::function<void()> task);
+
+        // returns once every submitted task (including tasks
+        // submitted by other tasks) has finished
+        void wait();
+
+        ~threadPool();
+
+        // number of threads to use when 0 is requested
+        static int hardwareThreads();
+
+    private:
+        struct taskQueue
+        {
+            std::mutex mutex_;
+            std::deque<std::function<void()>> tasks_;
+        };
+
+        std::vector<std::thread> workers_;
+
+        // queues_[t] belongs to workers_[t-1], queues_[0] to every
+        // thread outside the pool
+        std::vector<std::unique_ptr<taskQueue>> queues_;
+
+        // only changed under mutex_, so sleeping threads never miss a
+        // task, and together with the queue a task is pushed to or
+        // popped from, so they never count fewer tasks than queued
+        int num_queued_ = 0;
+        int num_pending_ = 0; // queued + running tasks
+        bool stop_ = false;
+
+        std::mutex mutex_;
+        std::condition_variable cv_;
+
+    private:
+
+        // pool and queue of the worker running on the calling thread
+        struct workerInfo
+        {
+            threadPool* pool_ = NULL;
+            int queue_idx_ = 0;
+        };
+
+        static workerInfo& currentWorker();
+
+        void workerLoop(int queue_idx);
+
+        // index of the calling thread's queue
+        int queueIndex();
+
+        // own queue from the back, then the front of the others
+        bool popTask(int queue_idx, std::function<void()>& task);
+
+        void runTask(std::function<void()>& task);
+};
+
+} // namespace glr
+
+#ifndef GLRENDER_STATIC
+#   include <glr/thread_pool.cpp>
+#endif
+
+#endif
@@ -0,0 +1,222 @@
+#include <glr/tree_cache.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifndef _WIN32
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#else
+#   include <process.h>
+#endif
+
+namespace glr
+{
+
+GLRENDER_INLINE bool treeCache::mappedFile::open(const std::string& path)
+{
+    close();
+
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    data_ = (const char*) data;
+    size_ = file_stat.st_size;
+    is_mapped_ = true;
+#else
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+
+    std::streamsize size = file.tellg();
+    if (size <= 0)
+        return false;
+
+    buffer_.resize(size);
+    file.seekg(0);
+    if (!file.read(buffer_.data(), size))
+    {
+        std::vector<char>().swap(buffer_);
+        return false;
+    }
+
+    data_ = buffer_.data();
+    size_ = size;
+#endif
+
+    return true;
+}
+
+GLRENDER_INLINE void treeCache::mappedFile::close()
+{
+#ifndef _WIN32
+    if (is_mapped_)
+        munmap((void*) data_, size_);
+#endif
+    std::vector<char>().swap(buffer_);
+    data_ = NULL;
+    size_ = 0;
+    is_mapped_ = false;
+}
+
+GLRENDER_INLINE treeCache::mappedFile::~mappedFile()
+{
+    close();
+}
+
+GLRENDER_INLINE std::string& treeCache::cacheDir()
+{
+    static std::string dir;
+    return dir;
+}
+
+GLRENDER_INLINE void treeCache::directory(std::string dir)
+{
+    if (!dir.empty() && dir[dir.length() - 1] != '/')
+        dir += "/";
+    cacheDir() = dir;
+}
+
+GLRENDER_INLINE std::string treeCache::directory()
+{
+    return cacheDir();
+}
+
+GLRENDER_INLINE uint64_t treeCache::fnv1a(const void* data, size_t num_bytes, uint64_t hash)
+{
+    const uint64_t FNV_PRIME = 0x100000001b3ULL;
+    const char* bytes = (const char*) data;
+
+    // 8 bytes at a time, the byte wise loop is several times slower
+    size_t b = 0;
+    for (; b + 8 <= num_bytes; b += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes + b, 8);
+        hash ^= word;
+        hash *= FNV_PRIME;
+    }
+    for (; b < num_bytes; b++)
+    {
+        hash ^= (unsigned char) bytes[b];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+GLRENDER_INLINE uint64_t treeCache::meshHash(const triangleCache& tri_cache)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    uint64_t num_tris = tri_cache.size();
+    hash = fnv1a(&num_tris, sizeof(num_tris), hash);
+
+    for (int c = 0; c < 3; c++)
+    {
+        for (int i = 0; i < 3; i++)
+            hash = fnv1a(tri_cache.v_[c][i].data(), num_tris * sizeof(float), hash);
+    }
+
+    return hash;
+}
+
+GLRENDER_INLINE std::string treeCache::filePath(uint64_t mesh_hash, uint32_t tree_type, uint32_t build_type, uint32_t max_leaf_size)
+{
+    if (cacheDir().empty())
+        return "";
+
+    char name[64];
+    std::snprintf(name, sizeof(name), "%016llx_%s%u_%u.glrtree", (unsigned long long) mesh_hash,
+                  (tree_type == OBB_TREE) ? "obb" : "aabb", build_type, max_leaf_size);
+
+    return cacheDir() + name;
+}
+
+GLRENDER_INLINE bool treeCache::write(const std::string& path, const treeCacheHeader& header, const void* nodes, const uint32_t* prim_idx)
+{
+    // named after the process and the call so writers of the same
+    // tree in other processes or threads never share a temporary file
+    static std::atomic<uint32_t> num_writes(0);
+#ifndef _WIN32
+    long pid = (long) getpid();
+#else
+    long pid = (long) _getpid();
+#endif
+    char suffix[48];
+    std::snprintf(suffix, sizeof(suffix), ".%ld_%u.tmp", pid, (unsigned) num_writes++);
+    std::string tmp_path = path + suffix;
+
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return false;
+
+        file.write((const char*) &header, sizeof(header));
+        file.write((const char*) nodes, (std::streamsize) header.num_nodes_ * header.node_size_);
+        file.write((const char*) prim_idx, (std::streamsize) header.num_primitives_ * sizeof(uint32_t));
+        if (!file)
+        {
+            file.close();
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+    }
+
+    // rename replaces an existing file in one step on unix,
+    // it does not replace it at all on windows
+#ifdef _WIN32
+    std::remove(path.c_str());
+#endif
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+GLRENDER_INLINE bool treeCache::validate(const mappedFile& file, const treeCacheHeader& expected)
+{
+    if (file.size() < sizeof(treeCacheHeader))
+        return false;
+
+    treeCacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    if (std::memcmp(header.magic_, expected.magic_, sizeof(header.magic_)) != 0 ||
+        header.version_ != expected.version_ ||
+        header.tree_type_ != expected.tree_type_ ||
+        header.build_type_ != expected.build_type_ ||
+        header.max_leaf_size_ != expected.max_leaf_size_ ||
+        header.node_size_ != expected.node_size_ ||
+        header.mesh_hash_ != expected.mesh_hash_ ||
+        header.num_primitives_ != expected.num_primitives_)
+        return false;
+
+    size_t num_bytes = sizeof(header) + (size_t) header.num_nodes_ * header.node_size_
+                       + (size_t) header.num_primitives_ * sizeof(uint32_t);
+
+    return (header.num_nodes_ > 0 && file.size() == num_bytes);
+}
+
+} // namespace glr
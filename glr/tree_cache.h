@@ -0,0 +1,105 @@
+#ifndef TREECACHE_H
+#define TREECACHE_H
+#include "glr_inline.h"
+
+#include <glr/triangle_cache.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace glr
+{
+
+// header at the start of every cached tree file, followed by
+// num_nodes_ nodes and num_primitives_ triangle indices
+struct treeCacheHeader
+{
+    char magic_[4] = {'G', 'L', 'R', 'T'};
+    uint32_t version_ = 0;
+    uint32_t tree_type_ = 0; // treeCache::AABB_TREE or treeCache::OBB_TREE
+    uint32_t build_type_ = 0;
+    uint32_t max_leaf_size_ = 0;
+    uint32_t node_size_ = 0; // sizeof the node struct that was written
+    uint64_t mesh_hash_ = 0;
+    uint32_t num_nodes_ = 0;
+    uint32_t num_primitives_ = 0;
+};
+
+// On disk cache of built trees
+//
+// Trees are stored as a raw copy of their node and index arrays,
+// keyed by a hash of the triangles so a changed mesh never picks
+// up a stale tree. Files are read through mmap on unix and with
+// an ifstream on windows. The cache is off until directory() is
+// set, the directory has to exist already.
+class treeCache
+{
+    public:
+        // bump whenever the node layout or the builders change
+        static const uint32_t VERSION = 2;
+
+        static const uint32_t AABB_TREE = 0;
+        static const uint32_t OBB_TREE = 1;
+
+        // read-only view of a cache file, unmapped on destruction
+        class mappedFile
+        {
+            public:
+                mappedFile() {}
+
+                mappedFile(const mappedFile&) = delete;
+                mappedFile& operator=(const mappedFile&) = delete;
+
+                bool open(const std::string& path);
+
+                void close();
+
+                const char* data() const {return data_;}
+
+                size_t size() const {return size_;}
+
+                ~mappedFile();
+
+            private:
+                const char* data_ = NULL;
+                size_t size_ = 0;
+
+                // windows fallback, the file is read into buffer_
+                std::vector<char> buffer_;
+                bool is_mapped_ = false;
+        };
+
+    public:
+        static void directory(std::string dir);
+
+        static std::string directory();
+
+        // FNV-1a hash of the triangle corners
+        static uint64_t meshHash(const triangleCache& tri_cache);
+
+        // cache file for a tree of a mesh, empty if the cache is off
+        static std::string filePath(uint64_t mesh_hash, uint32_t tree_type, uint32_t build_type, uint32_t max_leaf_size);
+
+        // writes to a temporary file first so other processes
+        // never map a half written tree
+        static bool write(const std::string& path, const treeCacheHeader& header, const void* nodes, const uint32_t* prim_idx);
+
+        // checks the header of a mapped file against the expected
+        // one and that the file holds every node and index
+        static bool validate(const mappedFile& file, const treeCacheHeader& expected);
+
+    private:
+        static std::string& cacheDir();
+
+        static uint64_t fnv1a(const void* data, size_t num_bytes, uint64_t hash);
+};
+
+} // namespace glr
+
+#ifndef GLRENDER_STATIC
+#   include <glr/tree_cache.cpp>
+#endif
+
+#endif
@@ -0,0 +1,102 @@
+#include <glr/triangle_cache.h>
+
+#include <algorithm>
+
+namespace glr
+{
+
+GLRENDER_INLINE void triangleCache::build(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes)
+{
+    clear();
+
+    size_t num_tris = 0;
+    for (int s = 0; s < shapes.size(); s++)
+    {
+        for (int f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++)
+        {
+            if (shapes[s].mesh.num_face_vertices[f] == 3)
+                num_tris += 1;
+        }
+    }
+
+    shape_idx_.reserve(num_tris);
+    face_idx_.reserve(num_tris);
+    for (int c = 0; c < 3; c++)
+    {
+        for (int i = 0; i < 3; i++)
+            v_[c][i].resize(num_tris);
+    }
+
+    // gather the corners, this is the only pass
+    // that goes through the tinyobj indices
+    size_t tri = 0;
+    for (int s = 0; s < shapes.size(); s++)
+    {
+        int index_offset = 0;
+        for (int f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++)
+        {
+            if (shapes[s].mesh.num_face_vertices[f] != 3)
+            {
+                index_offset += shapes[s].mesh.num_face_vertices[f];
+                continue;
+            }
+
+            for (int c = 0; c < 3; c++)
+            {
+                int vertex_index = shapes[s].mesh.indices[index_offset + c].vertex_index;
+                for (int i = 0; i < 3; i++)
+                    v_[c][i][tri] = attrib.vertices[3 * vertex_index + i];
+            }
+
+            shape_idx_.push_back(s);
+            face_idx_.push_back(f);
+
+            tri += 1;
+            index_offset += 3;
+        }
+    }
+
+    // the rest works on contiguous arrays so the
+    // compiler can vectorize each loop
+    for (int i = 0; i < 3; i++)
+    {
+        centroid_[i].resize(num_tris);
+        min_[i].resize(num_tris);
+        max_[i].resize(num_tris);
+
+        const float* v0 = v_[0][i].data();
+        const float* v1 = v_[1][i].data();
+        const float* v2 = v_[2][i].data();
+        float* c = centroid_[i].data();
+        float* min_p = min_[i].data();
+        float* max_p = max_[i].data();
+
+        for (size_t t = 0; t < num_tris; t++)
+        {
+            c[t] = (v0[t] + v1[t] + v2[t]) / 3.f;
+            min_p[t] = std::min(v0[t], std::min(v1[t], v2[t]));
+            max_p[t] = std::max(v0[t], std::max(v1[t], v2[t]));
+        }
+    }
+}
+
+GLRENDER_INLINE void triangleCache::clear()
+{
+    for (int c = 0; c < 3; c++)
+    {
+        for (int i = 0; i < 3; i++)
+            std::vector<float>().swap(v_[c][i]);
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        std::vector<float>().swap(centroid_[i]);
+        std::vector<float>().swap(min_[i]);
+        std::vector<float>().swap(max_[i]);
+    }
+
+    std::vector<uint32_t>().swap(shape_idx_);
+    std::vector<uint32_t>().swap(face_idx_);
+}
+
+} // namespace glr
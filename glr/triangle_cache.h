@@ -0,0 +1,60 @@
+#ifndef TRIANGLECACHE_H
+#define TRIANGLECACHE_H
+#include "glr_inline.h"
+
+#include <glm/glm.hpp>
+
+#define TINYOBJ_CUSTOM_NAMESPACE glr
+#include <glr/tinyobjloader/tiny_obj_loader.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace glr
+{
+
+// Triangles of an OBJ stored as structure of arrays
+//
+// Built once when the OBJ is loaded so the tree builders
+// read contiguous floats instead of going through the
+// tinyobj indices for every corner. Faces that are not
+// triangles are skipped.
+class triangleCache
+{
+    public:
+        // v_[c][i] is axis i of corner c
+        std::vector<float> v_[3][3];
+
+        std::vector<float> centroid_[3];
+
+        // per triangle bounds
+        std::vector<float> min_[3];
+        std::vector<float> max_[3];
+
+        // shape and face in OBJ::shapes_ each triangle came from
+        std::vector<uint32_t> shape_idx_;
+        std::vector<uint32_t> face_idx_;
+
+    public:
+        void build(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes);
+
+        void clear();
+
+        size_t size() const {return shape_idx_.size();}
+
+        glm::vec3 vertex(uint32_t t, int c) const {return glm::vec3(v_[c][0][t], v_[c][1][t], v_[c][2][t]);}
+
+        glm::vec3 centroid(uint32_t t) const {return glm::vec3(centroid_[0][t], centroid_[1][t], centroid_[2][t]);}
+
+        glm::vec3 minP(uint32_t t) const {return glm::vec3(min_[0][t], min_[1][t], min_[2][t]);}
+
+        glm::vec3 maxP(uint32_t t) const {return glm::vec3(max_[0][t], max_[1][t], max_[2][t]);}
+};
+
+} // namespace glr
+
+#ifndef GLRENDER_STATIC
+#   include <glr/triangle_cache.cpp>
+#endif
+
+#endif
@@ -0,0 +1,513 @@
+#include <glr/triangle_intersect.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <utility>
+
+namespace glr
+{
+
+// distances to a plane below this times the size of
+// the triangles are treated as lying on the plane
+static const float TRIANGLE_EPSILON = 1e-6f;
+
+// squared length of the longest edge leaving corner 0
+static GLRENDER_INLINE float edgeSizeSq(const glm::vec3 t[3])
+{
+    glm::vec3 e1 = t[1] - t[0];
+    glm::vec3 e2 = t[2] - t[0];
+    return std::max(glm::dot(e1, e1), glm::dot(e2, e2));
+}
+
+// dist are dot(n, p) + d for the corners of a triangle
+static GLRENDER_INLINE void snapToPlane(float dist[3], glm::vec3 n, float size_sq)
+{
+    float eps_sq = TRIANGLE_EPSILON * TRIANGLE_EPSILON * glm::dot(n, n) * size_sq;
+    for (int c = 0; c < 3; c++)
+    {
+        if (dist[c] * dist[c] <= eps_sq)
+            dist[c] = 0;
+    }
+}
+
+// interval where the line shared by both planes crosses a triangle, p are
+// the corners projected on that line and dist their distances to the other
+// triangle's plane, returns false if every corner lies on that plane
+static GLRENDER_INLINE bool lineInterval(const float p[3], const float dist[3], float interval[2])
+{
+    int alone; // corner on its own side of the plane
+    if (dist[0] * dist[1] > 0)
+        alone = 2;
+    else if (dist[0] * dist[2] > 0)
+        alone = 1;
+    else if (dist[1] * dist[2] > 0 || dist[0] != 0)
+        alone = 0;
+    else if (dist[1] != 0)
+        alone = 1;
+    else if (dist[2] != 0)
+        alone = 2;
+    else
+        return false;
+
+    int c1 = (alone + 1) % 3;
+    int c2 = (alone + 2) % 3;
+
+    interval[0] = p[alone] + (p[c1] - p[alone]) * dist[alone] / (dist[alone] - dist[c1]);
+    interval[1] = p[alone] + (p[c2] - p[alone]) * dist[alone] / (dist[alone] - dist[c2]);
+    if (interval[0] > interval[1])
+        std::swap(interval[0], interval[1]);
+
+    return true;
+}
+
+static GLRENDER_INLINE float cross2(glm::vec2 u, glm::vec2 v)
+{
+    return u.x * v.y - u.y * v.x;
+}
+
+// closed segments p0 p1 and q0 q1
+static GLRENDER_INLINE bool segmentIntersect(glm::vec2 p0, glm::vec2 p1, glm::vec2 q0, glm::vec2 q1)
+{
+    float d0 = cross2(q1 - q0, p0 - q0);
+    float d1 = cross2(q1 - q0, p1 - q0);
+    float d2 = cross2(p1 - p0, q0 - p0);
+    float d3 = cross2(p1 - p0, q1 - p0);
+
+    if (((d0 > 0 && d1 < 0) || (d0 < 0 && d1 > 0)) && ((d2 > 0 && d3 < 0) || (d2 < 0 && d3 > 0)))
+        return true;
+
+    // an end point on the other segment
+    auto on_segment = [] (glm::vec2 a, glm::vec2 b, glm::vec2 p) {
+        return (std::min(a.x, b.x) <= p.x && p.x <= std::max(a.x, b.x) &&
+                std::min(a.y, b.y) <= p.y && p.y <= std::max(a.y, b.y));
+    };
+
+    return ((d0 == 0 && on_segment(q0, q1, p0)) || (d1 == 0 && on_segment(q0, q1, p1)) ||
+            (d2 == 0 && on_segment(p0, p1, q0)) || (d3 == 0 && on_segment(p0, p1, q1)));
+}
+
+static GLRENDER_INLINE bool pointInTriangle(glm::vec2 p, const glm::vec2 t[3])
+{
+    float d0 = cross2(t[1] - t[0], p - t[0]);
+    float d1 = cross2(t[2] - t[1], p - t[1]);
+    float d2 = cross2(t[0] - t[2], p - t[2]);
+
+    return ((d0 >= 0 && d1 >= 0 && d2 >= 0) || (d0 <= 0 && d1 <= 0 && d2 <= 0));
+}
+
+// axes of the coordinate plane most parallel to the plane with normal n
+static GLRENDER_INLINE void projectionAxes(glm::vec3 n, int& i0, int& i1)
+{
+    glm::vec3 abs_n = glm::abs(n);
+    i0 = 1;
+    i1 = 2;
+    if (abs_n.y >= abs_n.x && abs_n.y >= abs_n.z)
+    {
+        i0 = 0;
+        i1 = 2;
+    }
+    else if (abs_n.z >= abs_n.x && abs_n.z >= abs_n.y)
+    {
+        i0 = 0;
+        i1 = 1;
+    }
+}
+
+// both triangles lie in the plane with normal n
+static GLRENDER_INLINE bool coplanarIntersect(glm::vec3 n, const glm::vec3 a[3], const glm::vec3 b[3])
+{
+    int i0;
+    int i1;
+    projectionAxes(n, i0, i1);
+
+    glm::vec2 p_a[3];
+    glm::vec2 p_b[3];
+    for (int c = 0; c < 3; c++)
+    {
+        p_a[c] = glm::vec2(a[c][i0], a[c][i1]);
+        p_b[c] = glm::vec2(b[c][i0], b[c][i1]);
+    }
+
+    for (int e_a = 0; e_a < 3; e_a++)
+    {
+        for (int e_b = 0; e_b < 3; e_b++)
+        {
+            if (segmentIntersect(p_a[e_a], p_a[(e_a + 1) % 3], p_b[e_b], p_b[(e_b + 1) % 3]))
+                return true;
+        }
+    }
+
+    // no edges cross, so either one contains the other or they are apart
+    return pointInTriangle(p_a[0], p_b) || pointInTriangle(p_b[0], p_a);
+}
+
+// a has zero area so it is a segment, dist_a are its corners' distances
+// to the plane of b, which they are known not to be all on one side of
+static GLRENDER_INLINE bool flatTriangleIntersect(const glm::vec3 a[3], const float dist_a[3], glm::vec3 n_b, const glm::vec3 b[3])
+{
+    if (dist_a[0] == 0 && dist_a[1] == 0 && dist_a[2] == 0)
+        return coplanarIntersect(n_b, a, b);
+
+    // the one point where the segment crosses the plane
+    int lo = 0;
+    int hi = 0;
+    for (int c = 1; c < 3; c++)
+    {
+        if (dist_a[c] < dist_a[lo])
+            lo = c;
+        if (dist_a[c] > dist_a[hi])
+            hi = c;
+    }
+    glm::vec3 p = a[lo] + (a[hi] - a[lo]) * (dist_a[lo] / (dist_a[lo] - dist_a[hi]));
+
+    int i0;
+    int i1;
+    projectionAxes(n_b, i0, i1);
+
+    glm::vec2 p_b[3];
+    for (int c = 0; c < 3; c++)
+        p_b[c] = glm::vec2(b[c][i0], b[c][i1]);
+
+    return pointInTriangle(glm::vec2(p[i0], p[i1]), p_b);
+}
+
+GLRENDER_INLINE bool triangleIntersect(const glm::vec3 a[3], const glm::vec3 b[3])
+{
+    float size_sq = std::max(edgeSizeSq(a), edgeSizeSq(b));
+
+    glm::vec3 n_a = glm::cross(a[1] - a[0], a[2] - a[0]);
+    glm::vec3 n_b = glm::cross(b[1] - b[0], b[2] - b[0]);
+    bool is_flat_a = (n_a == glm::vec3(0));
+    bool is_flat_b = (n_b == glm::vec3(0));
+    if (is_flat_a && is_flat_b)
+        return false;
+
+    // a against the plane of b
+    float d_b = -glm::dot(n_b, b[0]);
+
+    float dist_a[3];
+    for (int c = 0; c < 3; c++)
+        dist_a[c] = glm::dot(n_b, a[c]) + d_b;
+    snapToPlane(dist_a, n_b, size_sq);
+
+    if (dist_a[0] * dist_a[1] > 0 && dist_a[0] * dist_a[2] > 0)
+        return false;
+
+    if (is_flat_a)
+        return flatTriangleIntersect(a, dist_a, n_b, b);
+
+    // b against the plane of a
+    float d_a = -glm::dot(n_a, a[0]);
+
+    float dist_b[3];
+    for (int c = 0; c < 3; c++)
+        dist_b[c] = glm::dot(n_a, b[c]) + d_a;
+    snapToPlane(dist_b, n_a, size_sq);
+
+    if (dist_b[0] * dist_b[1] > 0 && dist_b[0] * dist_b[2] > 0)
+        return false;
+
+    if (is_flat_b)
+        return flatTriangleIntersect(b, dist_b, n_a, a);
+
+    // both triangles cross the line where the planes meet, project
+    // onto the coordinate axis that line is most aligned with
+    glm::vec3 dir = glm::abs(glm::cross(n_a, n_b));
+    int axis = 0;
+    if (dir.y > dir[axis])
+        axis = 1;
+    if (dir.z > dir[axis])
+        axis = 2;
+
+    float p_a[3] = {a[0][axis], a[1][axis], a[2][axis]};
+    float p_b[3] = {b[0][axis], b[1][axis], b[2][axis]};
+
+    float interval_a[2];
+    float interval_b[2];
+    if (!lineInterval(p_a, dist_a, interval_a) || !lineInterval(p_b, dist_b, interval_b))
+        return coplanarIntersect(n_a, a, b);
+
+    return (interval_a[0] <= interval_b[1] && interval_b[0] <= interval_a[1]);
+}
+
+GLRENDER_INLINE int triangleIntersectBatch(const glm::vec3 a[3], const float b[3][3][TRIANGLE_BATCH_SIZE], int num_b, bool find_all)
+{
+    glm::vec3 n_a = glm::cross(a[1] - a[0], a[2] - a[0]);
+    float d_a = -glm::dot(n_a, a[0]);
+    float size_sq_a = edgeSizeSq(a);
+    float eps_sq_a = TRIANGLE_EPSILON * TRIANGLE_EPSILON * glm::dot(n_a, n_a);
+
+    // corners of every triangle of b against the plane of a, the
+    // loops run over the triangles so the compiler can vectorize them
+    float dist[3][TRIANGLE_BATCH_SIZE];
+    for (int c = 0; c < 3; c++)
+    {
+        for (int k = 0; k < TRIANGLE_BATCH_SIZE; k++)
+            dist[c][k] = n_a.x * b[c][0][k] + n_a.y * b[c][1][k] + n_a.z * b[c][2][k] + d_a;
+    }
+
+    // the same tolerance triangleIntersect() snaps to the plane with
+    float eps_sq[TRIANGLE_BATCH_SIZE];
+    for (int k = 0; k < TRIANGLE_BATCH_SIZE; k++)
+    {
+        float size_sq = size_sq_a;
+        for (int c = 1; c < 3; c++)
+        {
+            float e_x = b[c][0][k] - b[0][0][k];
+            float e_y = b[c][1][k] - b[0][1][k];
+            float e_z = b[c][2][k] - b[0][2][k];
+            size_sq = std::max(size_sq, e_x * e_x + e_y * e_y + e_z * e_z);
+        }
+        eps_sq[k] = eps_sq_a * size_sq;
+    }
+
+    int hit_mask = 0;
+    for (int k = 0; k < num_b; k++)
+    {
+        bool is_above = true;
+        bool is_below = true;
+        for (int c = 0; c < 3; c++)
+        {
+            bool is_off_plane = (dist[c][k] * dist[c][k] > eps_sq[k]);
+            is_above = is_above && is_off_plane && dist[c][k] > 0;
+            is_below = is_below && is_off_plane && dist[c][k] < 0;
+        }
+
+        if (is_above || is_below)
+            continue;
+
+        glm::vec3 tri_b[3];
+        for (int c = 0; c < 3; c++)
+            tri_b[c] = glm::vec3(b[c][0][k], b[c][1][k], b[c][2][k]);
+
+        if (triangleIntersect(a, tri_b))
+        {
+            hit_mask |= (1 << k);
+            if (!find_all)
+                break;
+        }
+    }
+
+    return hit_mask;
+}
+
+// point of triangle t closest to p, Ericson 2005 5.1.5
+static GLRENDER_INLINE glm::vec3 closestPointTriangle(glm::vec3 p, const glm::vec3 t[3])
+{
+    glm::vec3 ab = t[1] - t[0];
+    glm::vec3 ac = t[2] - t[0];
+    glm::vec3 ap = p - t[0];
+    float d1 = glm::dot(ab, ap);
+    float d2 = glm::dot(ac, ap);
+    if (d1 <= 0 && d2 <= 0)
+        return t[0];
+
+    glm::vec3 bp = p - t[1];
+    float d3 = glm::dot(ab, bp);
+    float d4 = glm::dot(ac, bp);
+    if (d3 >= 0 && d4 <= d3)
+        return t[1];
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0)
+        return t[0] + ab * (d1 / (d1 - d3));
+
+    glm::vec3 cp = p - t[2];
+    float d5 = glm::dot(ab, cp);
+    float d6 = glm::dot(ac, cp);
+    if (d6 >= 0 && d5 <= d6)
+        return t[2];
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0)
+        return t[0] + ac * (d2 / (d2 - d6));
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+        return t[1] + (t[2] - t[1]) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+    // inside the face, also taken by zero area triangles
+    float denom = va + vb + vc;
+    if (denom == 0)
+        return t[0];
+    return t[0] + ab * (vb / denom) + ac * (vc / denom);
+}
+
+// closest points c1 on p1 q1 and c2 on p2 q2, Ericson 2005 5.1.9
+static GLRENDER_INLINE void closestPointsSegments(glm::vec3 p1, glm::vec3 q1, glm::vec3 p2, glm::vec3 q2, glm::vec3& c1, glm::vec3& c2)
+{
+    glm::vec3 d1 = q1 - p1;
+    glm::vec3 d2 = q2 - p2;
+    glm::vec3 r = p1 - p2;
+    float a = glm::dot(d1, d1);
+    float e = glm::dot(d2, d2);
+    float f = glm::dot(d2, r);
+
+    float s = 0;
+    float t = 0;
+    if (a == 0 && e == 0)
+    {
+        c1 = p1;
+        c2 = p2;
+        return;
+    }
+
+    if (a == 0)
+        t = std::min(std::max(f / e, 0.f), 1.f);
+    else
+    {
+        float c = glm::dot(d1, r);
+        if (e == 0)
+            s = std::min(std::max(-c / a, 0.f), 1.f);
+        else
+        {
+            float b = glm::dot(d1, d2);
+            float denom = a * e - b * b;
+
+            // parallel segments take any s, 0 is as good as the rest
+            if (denom > 0)
+                s = std::min(std::max((b * f - c * e) / denom, 0.f), 1.f);
+
+            t = (b * s + f) / e;
+            if (t < 0)
+            {
+                t = 0;
+                s = std::min(std::max(-c / a, 0.f), 1.f);
+            }
+            else if (t > 1)
+            {
+                t = 1;
+                s = std::min(std::max((b - c) / a, 0.f), 1.f);
+            }
+        }
+    }
+
+    c1 = p1 + d1 * s;
+    c2 = p2 + d2 * t;
+}
+
+// keeps p and q if they are closer than the best pair so far
+static GLRENDER_INLINE void keepCloser(glm::vec3 p, glm::vec3 q, float& best_sq, glm::vec3& best_p, glm::vec3& best_q)
+{
+    glm::vec3 d = q - p;
+    float dist_sq = glm::dot(d, d);
+    if (dist_sq < best_sq)
+    {
+        best_sq = dist_sq;
+        best_p = p;
+        best_q = q;
+    }
+}
+
+// where the edges of a cross the plane of b, the one case the
+// vertex and edge pairs of triangleDistance() cannot see
+static GLRENDER_INLINE void edgesThroughTriangle(const glm::vec3 a[3], const glm::vec3 b[3], bool is_a_first, float& best_sq, glm::vec3& best_p, glm::vec3& best_q)
+{
+    glm::vec3 n_b = glm::cross(b[1] - b[0], b[2] - b[0]);
+    float dist[3];
+    for (int c = 0; c < 3; c++)
+        dist[c] = glm::dot(n_b, a[c] - b[0]);
+
+    for (int e = 0; e < 3; e++)
+    {
+        int c0 = e;
+        int c1 = (e + 1) % 3;
+        if (!((dist[c0] < 0 && dist[c1] > 0) || (dist[c0] > 0 && dist[c1] < 0)))
+            continue;
+
+        glm::vec3 x = a[c0] + (a[c1] - a[c0]) * (dist[c0] / (dist[c0] - dist[c1]));
+        glm::vec3 y = closestPointTriangle(x, b);
+        if (is_a_first)
+            keepCloser(x, y, best_sq, best_p, best_q);
+        else
+            keepCloser(y, x, best_sq, best_p, best_q);
+    }
+}
+
+GLRENDER_INLINE float triangleDistance(const glm::vec3 a[3], const glm::vec3 b[3], glm::vec3& p, glm::vec3& q)
+{
+    float best_sq = FLT_MAX;
+    glm::vec3 c_a;
+    glm::vec3 c_b;
+
+    // the closest points of two apart triangles are two
+    // edge points or a corner and a point of the other face
+    for (int e_a = 0; e_a < 3; e_a++)
+    {
+        for (int e_b = 0; e_b < 3; e_b++)
+        {
+            closestPointsSegments(a[e_a], a[(e_a + 1) % 3], b[e_b], b[(e_b + 1) % 3], c_a, c_b);
+            keepCloser(c_a, c_b, best_sq, p, q);
+        }
+    }
+
+    for (int c = 0; c < 3; c++)
+    {
+        keepCloser(a[c], closestPointTriangle(a[c], b), best_sq, p, q);
+        keepCloser(closestPointTriangle(b[c], a), b[c], best_sq, p, q);
+    }
+
+    // crossing triangles meet where an edge goes through a face
+    if (best_sq > 0)
+    {
+        edgesThroughTriangle(a, b, true, best_sq, p, q);
+        edgesThroughTriangle(b, a, false, best_sq, p, q);
+    }
+
+    return std::sqrt(best_sq);
+}
+
+GLRENDER_INLINE bool rayTriangleIntersect(const glm::vec3& origin, const glm::vec3& dir, const glm::vec3 tri[3], float t_max, float& t, float& u, float& v)
+{
+    glm::vec3 e1 = tri[1] - tri[0];
+    glm::vec3 e2 = tri[2] - tri[0];
+
+    // the determinant is dot(dir, normal) up to sign, the
+    // same relative epsilon as the plane tests above
+    glm::vec3 p = glm::cross(dir, e2);
+    float det = glm::dot(e1, p);
+    float eps = TRIANGLE_EPSILON * glm::length(dir) * glm::length(glm::cross(e1, e2));
+    if (std::abs(det) <= eps)
+        return false;
+
+    float inv_det = 1.0f / det;
+    glm::vec3 s = origin - tri[0];
+    u = glm::dot(s, p) * inv_det;
+    if (u < 0 || u > 1)
+        return false;
+
+    glm::vec3 q = glm::cross(s, e1);
+    v = glm::dot(dir, q) * inv_det;
+    if (v < 0 || u + v > 1)
+        return false;
+
+    t = glm::dot(e2, q) * inv_det;
+    return (t >= 0 && t <= t_max);
+}
+
+// distance of the corners of t to the plane of p, if they are all
+// on the same side, zero otherwise
+static GLRENDER_INLINE float planeGap(const glm::vec3 p[3], const glm::vec3 t[3])
+{
+    glm::vec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+    float length = glm::length(n);
+    if (length <= 0)
+        return 0;
+
+    float dist[3];
+    for (int c = 0; c < 3; c++)
+        dist[c] = glm::dot(n, t[c] - p[0]) / length;
+
+    float gap = std::min(std::abs(dist[0]), std::min(std::abs(dist[1]), std::abs(dist[2])));
+    bool is_one_side = (dist[0] > 0 && dist[1] > 0 && dist[2] > 0) || (dist[0] < 0 && dist[1] < 0 && dist[2] < 0);
+
+    return is_one_side ? gap : 0;
+}
+
+GLRENDER_INLINE float triangleSeparation(const glm::vec3 a[3], const glm::vec3 b[3])
+{
+    return std::max(planeGap(a, b), planeGap(b, a));
+}
+
+} // namespace glr
@@ -0,0 +1,69 @@
+#ifndef TRIANGLEINTERSECT_H
+#define TRIANGLEINTERSECT_H
+#include "glr_inline.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+namespace glr
+{
+
+// two intersecting triangles, the shape and face indices
+// point into OBJ::shapes_ of each object
+struct contactPair
+{
+    uint32_t shape_A_;
+    uint32_t face_A_;
+    uint32_t shape_B_;
+    uint32_t face_B_;
+};
+
+// closest triangle hit by a ray, the shape and face indices point
+// into OBJ::shapes_ and the hit point is (1 - u - v) * corner 0 +
+// u * corner 1 + v * corner 2 of that face
+struct rayHit
+{
+    float distance_; // ray parameter t, a distance for a normalized ray
+    uint32_t shape_idx_;
+    uint32_t face_idx_;
+    float u_;
+    float v_;
+};
+
+// number of triangles triangleIntersectBatch() takes at once
+const int TRIANGLE_BATCH_SIZE = 8;
+
+// Moller 1997 triangle triangle test, touching triangles intersect
+bool triangleIntersect(const glm::vec3 a[3], const glm::vec3 b[3]);
+
+// distance between two triangles, p and q are set to the
+// closest points on a and b, zero if the triangles touch
+float triangleDistance(const glm::vec3 a[3], const glm::vec3 b[3], glm::vec3& p, glm::vec3& q);
+
+// Moller Trumbore 1997 ray triangle test, true if origin + t * dir
+// hits the triangle with 0 <= t <= t_max, u and v as in rayHit,
+// rays in the plane of the triangle miss it
+bool rayTriangleIntersect(const glm::vec3& origin, const glm::vec3& dir, const glm::vec3 tri[3], float t_max, float& t, float& u, float& v);
+
+// how far b lies on one side of the plane of a or a of the plane
+// of b, the larger one, zero if both planes cut the other triangle,
+// a cheap lower bound of triangleDistance()
+float triangleSeparation(const glm::vec3 a[3], const glm::vec3 b[3]);
+
+// tests triangle a against the first num_b triangles of b, where
+// b[c][i][k] is axis i of corner c of triangle k
+//
+// every triangle of b is checked against the plane of a in one pass
+// and only the ones crossing it go through triangleIntersect(),
+// returns the mask of the triangles of b that intersect a, or just
+// the first one found if find_all is false
+int triangleIntersectBatch(const glm::vec3 a[3], const float b[3][3][TRIANGLE_BATCH_SIZE], int num_b, bool find_all = false);
+
+} // namespace glr
+
+#ifndef GLRENDER_STATIC
+#   include <glr/triangle_intersect.cpp>
+#endif
+
+#endif
@@ -0,0 +1,1978 @@
+// Brute force checks of the collision queries
+//
+// Every query is compared against the same question answered by
+// looping over all triangle pairs. The meshes are made here so no
+// model files are needed, and the trees only call GL to draw
+// themselves so those calls go to no-ops and no context is needed.
+#include <glr/broadphase.h>
+#include <glr/dynamic_tree.h>
+#include <glr/obj.h>
+#include <glr/thread_pool.h>
+#include <glr/tree_cache.h>
+#include <glr/triangle_intersect.h>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include <Eigen/Eigen>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+typedef std::vector<std::pair<uint32_t, uint32_t>> facePairs;
+typedef std::vector<std::pair<uint32_t, uint32_t>> objPairs;
+
+int num_checks = 0;
+int num_failures = 0;
+
+void check(bool ok, const char* format, ...)
+{
+    num_checks += 1;
+    if (ok)
+        return;
+
+    num_failures += 1;
+    std::printf("FAILED: ");
+    va_list args;
+    va_start(args, format);
+    std::vprintf(format, args);
+    va_end(args);
+    std::printf("\n");
+}
+
+void APIENTRY genNames(GLsizei n, GLuint* names)
+{
+    for (GLsizei i = 0; i < n; i++)
+        names[i] = 0;
+}
+
+void APIENTRY deleteNames(GLsizei, const GLuint*) {}
+
+void APIENTRY useName(GLuint) {}
+
+void APIENTRY bindBuffer(GLenum, GLuint) {}
+
+void APIENTRY bufferData(GLenum, GLsizeiptr, const void*, GLenum) {}
+
+void APIENTRY vertexAttribPointer(GLuint, GLint, GLenum, GLboolean, GLsizei, const void*) {}
+
+// the GL calls made when a tree is built or released
+void disableGL()
+{
+    glad_glGenVertexArrays = genNames;
+    glad_glGenBuffers = genNames;
+    glad_glDeleteVertexArrays = deleteNames;
+    glad_glDeleteBuffers = deleteNames;
+    glad_glBindVertexArray = useName;
+    glad_glEnableVertexAttribArray = useName;
+    glad_glBindBuffer = bindBuffer;
+    glad_glBufferData = bufferData;
+    glad_glVertexAttribPointer = vertexAttribPointer;
+}
+
+// one shape of triangles, corner c of triangle t is verts[tris[3 * t + c]]
+void makeMesh(glr::OBJ& obj, const std::vector<glm::vec3>& verts, const std::vector<int>& tris)
+{
+    obj.attrib_.vertices.clear();
+    for (const glm::vec3& v : verts)
+    {
+        for (int i = 0; i < 3; i++)
+            obj.attrib_.vertices.push_back(v[i]);
+    }
+
+    glr::tinyobj::shape_t shape;
+    for (int v : tris)
+    {
+        glr::tinyobj::index_t idx;
+        idx.vertex_index = v;
+        idx.normal_index = -1;
+        idx.texcoord_index = -1;
+        shape.mesh.indices.push_back(idx);
+    }
+    shape.mesh.num_face_vertices.assign(tris.size() / 3, 3);
+    obj.shapes_.assign(1, shape);
+
+    obj.tri_cache_.build(obj.attrib_, obj.shapes_);
+
+    glm::vec3 min_p = verts[0];
+    glm::vec3 max_p = verts[0];
+    for (const glm::vec3& v : verts)
+    {
+        min_p = glm::min(min_p, v);
+        max_p = glm::max(max_p, v);
+    }
+    obj.center_ = 0.5f * (min_p + max_p);
+    obj.radius_ = 0;
+    for (const glm::vec3& v : verts)
+        obj.radius_ = std::max(obj.radius_, glm::length(v - obj.center_));
+
+    obj.aabb_tree_.assignObj(&obj);
+    obj.obb_tree_.assignObj(&obj);
+}
+
+// unit cube, its corners moved by shape
+void makeCube(glr::OBJ& obj, const glm::mat4& shape = glm::mat4(1.0f))
+{
+    std::vector<glm::vec3> verts;
+    for (int v = 0; v < 8; v++)
+    {
+        glm::vec4 corner((v & 1) ? 0.5f : -0.5f, (v & 2) ? 0.5f : -0.5f, (v & 4) ? 0.5f : -0.5f, 1.0f);
+        verts.push_back(glm::vec3(shape * corner));
+    }
+
+    std::vector<int> tris = {0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6,
+                             0, 1, 4, 1, 5, 4, 2, 6, 3, 3, 6, 7,
+                             0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5};
+    makeMesh(obj, verts, tris);
+}
+
+// a sphere with bumps so it is not convex, 2 * slices * (stacks - 1) triangles
+void makeBumpySphere(glr::OBJ& obj, int stacks, int slices)
+{
+    const float PI = 3.14159265f;
+
+    std::vector<glm::vec3> verts;
+    verts.push_back(glm::vec3(0, 0, 1));
+    for (int s = 1; s < stacks; s++)
+    {
+        float theta = PI * s / stacks;
+        for (int k = 0; k < slices; k++)
+        {
+            float phi = 2 * PI * k / slices;
+            float r = 1 + 0.2f * std::sin(3 * theta) * std::cos(4 * phi);
+            verts.push_back(r * glm::vec3(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta)));
+        }
+    }
+    verts.push_back(glm::vec3(0, 0, -1));
+
+    int bottom = verts.size() - 1;
+    auto ring = [slices] (int s, int k) {return 1 + (s - 1) * slices + (k % slices);};
+
+    std::vector<int> tris;
+    for (int k = 0; k < slices; k++)
+    {
+        tris.insert(tris.end(), {0, ring(1, k), ring(1, k + 1)});
+        for (int s = 1; s < stacks - 1; s++)
+        {
+            tris.insert(tris.end(), {ring(s, k), ring(s + 1, k), ring(s + 1, k + 1)});
+            tris.insert(tris.end(), {ring(s, k), ring(s + 1, k + 1), ring(s, k + 1)});
+        }
+        tris.insert(tris.end(), {ring(stacks - 1, k), bottom, ring(stacks - 1, k + 1)});
+    }
+    makeMesh(obj, verts, tris);
+}
+
+// corners of every triangle under model, 3 per triangle
+std::vector<glm::vec3> worldTriangles(const glr::OBJ& obj, const glm::mat4& model)
+{
+    const glr::triangleCache& cache = obj.tri_cache_;
+    std::vector<glm::vec3> tris(3 * cache.size());
+    for (uint32_t t = 0; t < cache.size(); t++)
+    {
+        for (int c = 0; c < 3; c++)
+            tris[3 * t + c] = glm::vec3(model * glm::vec4(cache.vertex(t, c), 1.0f));
+    }
+
+    return tris;
+}
+
+// largest gap along an axis between the bounds of two triangles,
+// 0 if they overlap, never more than the triangle distance
+float boxGap(const glm::vec3* a, const glm::vec3* b)
+{
+    float gap = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        float min_a = std::min(a[0][i], std::min(a[1][i], a[2][i]));
+        float max_a = std::max(a[0][i], std::max(a[1][i], a[2][i]));
+        float min_b = std::min(b[0][i], std::min(b[1][i], b[2][i]));
+        float max_b = std::max(b[0][i], std::max(b[1][i], b[2][i]));
+        gap = std::max(gap, std::max(min_a - max_b, min_b - max_a));
+    }
+
+    return gap;
+}
+
+// every intersecting (face of A, face of B) pair, in order
+facePairs intersectingPairs(const std::vector<glm::vec3>& a, const std::vector<glm::vec3>& b)
+{
+    facePairs pairs;
+    for (uint32_t f_A = 0; f_A < a.size() / 3; f_A++)
+    {
+        for (uint32_t f_B = 0; f_B < b.size() / 3; f_B++)
+        {
+            if (boxGap(&a[3 * f_A], &b[3 * f_B]) <= 0 && glr::triangleIntersect(&a[3 * f_A], &b[3 * f_B]))
+                pairs.push_back(std::make_pair(f_A, f_B));
+        }
+    }
+
+    return pairs;
+}
+
+// true if both arrays hold the same bytes
+template <class T>
+bool isSameArray(const std::vector<T>& a, const std::vector<T>& b)
+{
+    return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+float uniform(std::mt19937& rng, float lo, float hi)
+{
+    return std::uniform_real_distribution<float>(lo, hi)(rng);
+}
+
+glm::vec3 randomDirection(std::mt19937& rng)
+{
+    glm::vec3 d;
+    do
+    {
+        d = glm::vec3(uniform(rng, -1, 1), uniform(rng, -1, 1), uniform(rng, -1, 1));
+    } while (glm::length(d) < 0.1f || glm::length(d) > 1);
+
+    return glm::normalize(d);
+}
+
+// rotated about a random axis, scaled by scale and moved to position
+glm::mat4 randomPose(std::mt19937& rng, const glm::vec3& position, const glm::vec3& scale)
+{
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+    model = glm::rotate(model, uniform(rng, 0, 6.2832f), randomDirection(rng));
+    return glm::scale(model, scale);
+}
+
+// closest triangle pair, pairs whose bounds are already further apart
+// than the closest so far are skipped
+float minDistance(const std::vector<glm::vec3>& a, const std::vector<glm::vec3>& b)
+{
+    float min_distance = FLT_MAX;
+    glm::vec3 p, q;
+    for (size_t f_A = 0; f_A < a.size(); f_A += 3)
+    {
+        for (size_t f_B = 0; f_B < b.size(); f_B += 3)
+        {
+            if (boxGap(&a[f_A], &b[f_B]) < min_distance)
+                min_distance = std::min(min_distance, glr::triangleDistance(&a[f_A], &b[f_B], p, q));
+        }
+    }
+
+    return min_distance;
+}
+
+// uniform in [lo, hi] on every axis, or on one axis only when stretch is set
+glm::vec3 randomScale(std::mt19937& rng, float lo, float hi, bool stretch)
+{
+    glm::vec3 scale(uniform(rng, lo, hi));
+    if (stretch)
+        scale[rng() % 3] = uniform(rng, lo, hi);
+
+    return scale;
+}
+
+float maxScale(const glm::vec3& scale)
+{
+    return std::max(scale.x, std::max(scale.y, scale.z));
+}
+
+// signed volume of the tetrahedron a b c d times 6, in double so the
+// reference below does not share the rounding of the float tests
+double orient(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& d)
+{
+    Eigen::Vector3d o(a.x, a.y, a.z);
+    Eigen::Vector3d u = Eigen::Vector3d(b.x, b.y, b.z) - o;
+    Eigen::Vector3d v = Eigen::Vector3d(c.x, c.y, c.z) - o;
+    Eigen::Vector3d w = Eigen::Vector3d(d.x, d.y, d.z) - o;
+    return u.dot(v.cross(w));
+}
+
+// true if segment p q meets triangle tri, is_close is set if one of
+// the signs it was decided by is too close to zero to trust
+bool isSegmentCrossing(const glm::vec3& p, const glm::vec3& q, const glm::vec3 tri[3], bool& is_close)
+{
+    const double EPSILON = 1e-6;
+
+    double d_p = orient(tri[0], tri[1], tri[2], p);
+    double d_q = orient(tri[0], tri[1], tri[2], q);
+    is_close = is_close || std::abs(d_p) < EPSILON || std::abs(d_q) < EPSILON;
+    if ((d_p > 0 && d_q > 0) || (d_p < 0 && d_q < 0))
+        return false;
+
+    double s[3];
+    for (int e = 0; e < 3; e++)
+    {
+        s[e] = orient(p, q, tri[e], tri[(e + 1) % 3]);
+        is_close = is_close || std::abs(s[e]) < EPSILON;
+    }
+
+    return (s[0] >= 0 && s[1] >= 0 && s[2] >= 0) || (s[0] <= 0 && s[1] <= 0 && s[2] <= 0);
+}
+
+// two triangles in different planes meet exactly when an edge of one
+// meets the other, the segment they share ends on an edge of each
+bool isCrossingReference(const glm::vec3 a[3], const glm::vec3 b[3], bool& is_close)
+{
+    bool is_crossing = false;
+    for (int e = 0; e < 3; e++)
+    {
+        is_crossing = isSegmentCrossing(a[e], a[(e + 1) % 3], b, is_close) || is_crossing;
+        is_crossing = isSegmentCrossing(b[e], b[(e + 1) % 3], a, is_close) || is_crossing;
+    }
+
+    return is_crossing;
+}
+
+glm::vec3 randomPoint(std::mt19937& rng, float size)
+{
+    return glm::vec3(uniform(rng, -size, size), uniform(rng, -size, size), uniform(rng, -size, size));
+}
+
+// triangleIntersect() and triangleIntersectBatch() against edge
+// crossings counted in double, pairs too close to touching to
+// decide in float are left out
+void checkTriangleIntersect()
+{
+    std::mt19937 rng(2);
+
+    const int NUM_BATCHES = 4000;
+    int num_pairs = 0;
+    int num_hits = 0;
+    int num_close = 0;
+
+    for (int n = 0; n < NUM_BATCHES; n++)
+    {
+        glm::vec3 a[3];
+        for (int c = 0; c < 3; c++)
+            a[c] = randomPoint(rng, 1);
+
+        int num_b = 1 + n % glr::TRIANGLE_BATCH_SIZE;
+        glm::vec3 b[glr::TRIANGLE_BATCH_SIZE][3];
+        float packed[3][3][glr::TRIANGLE_BATCH_SIZE] = {};
+        int expected = 0;
+        int decided = 0;
+        for (int k = 0; k < num_b; k++)
+        {
+            glm::vec3 center = randomPoint(rng, 1);
+            float size = uniform(rng, 0.1f, 1.5f);
+            for (int c = 0; c < 3; c++)
+            {
+                b[k][c] = center + randomPoint(rng, size);
+                for (int i = 0; i < 3; i++)
+                    packed[c][i][k] = b[k][c][i];
+            }
+
+            bool is_close = false;
+            bool is_crossing = isCrossingReference(a, b[k], is_close);
+            if (is_close)
+            {
+                num_close += 1;
+                continue;
+            }
+
+            bool is_intersect = glr::triangleIntersect(a, b[k]);
+            check(is_intersect == is_crossing, "triangle intersect batch %d triangle %d: hit %d, reference %d", n, k, (int) is_intersect, (int) is_crossing);
+
+            decided |= 1 << k;
+            expected |= is_crossing << k;
+            num_pairs += 1;
+            num_hits += is_crossing;
+        }
+
+        int mask = glr::triangleIntersectBatch(a, packed, num_b, true);
+        check((mask & decided) == expected && (mask >> num_b) == 0, "triangle intersect batch %d: mask %x, reference %x", n, mask, expected);
+
+        // without find_all one of the hits, if any
+        int first = glr::triangleIntersectBatch(a, packed, num_b);
+        bool is_one_hit = first == 0 ? mask == 0 : (first & (first - 1)) == 0 && (first & mask) == first;
+        check(is_one_hit, "triangle intersect batch %d: first hit %x of %x", n, first, mask);
+    }
+
+    std::printf("triangle intersect: %d pairs, %d hits, %d too close to call\n", num_pairs, num_hits, num_close);
+}
+
+// how the trees of both objects are built
+struct treeConfig
+{
+    bool is_obb_;
+    glr::treeBuildType build_type_;
+    glr::obbFitType fit_type_;
+    int branch_width_;
+    uint32_t max_leaf_size_;
+};
+
+const treeConfig TREES[] = {
+    {false, glr::MEDIAN_SPLIT, glr::COVARIANCE_FIT, 2, 1},
+    {false, glr::MEDIAN_SPLIT, glr::COVARIANCE_FIT, 4, 1},
+    {false, glr::SAH_SPLIT, glr::COVARIANCE_FIT, 2, 1},
+    {false, glr::SAH_SPLIT, glr::COVARIANCE_FIT, 4, 1},
+    {false, glr::SAH_SPLIT, glr::COVARIANCE_FIT, 2, 4},
+    {false, glr::SAH_SPLIT, glr::COVARIANCE_FIT, 4, 4},
+    {false, glr::MORTON_SPLIT, glr::COVARIANCE_FIT, 2, 1},
+    {false, glr::MORTON_SPLIT, glr::COVARIANCE_FIT, 4, 1},
+    {false, glr::MORTON_SPLIT, glr::COVARIANCE_FIT, 2, 4},
+    {true, glr::MEDIAN_SPLIT, glr::COVARIANCE_FIT, 2, 1},
+    {true, glr::MEDIAN_SPLIT, glr::COVARIANCE_FIT, 2, 4},
+    {true, glr::MEDIAN_SPLIT, glr::DITO_FIT, 2, 1},
+    {true, glr::MEDIAN_SPLIT, glr::DITO_FIT, 2, 4},
+};
+
+const int NUM_TREES = sizeof(TREES) / sizeof(TREES[0]);
+
+void useTree(glr::OBJ& obj, int tree)
+{
+    const treeConfig& config = TREES[tree];
+    obj.aabb_tree_.branchWidth(config.branch_width_);
+    obj.aabb_tree_.maxLeafSize(config.max_leaf_size_);
+    obj.obb_tree_.maxLeafSize(config.max_leaf_size_);
+    if (config.is_obb_)
+        obj.enableOBB(true, config.fit_type_);
+    else
+        obj.enableAABB(true, config.build_type_);
+}
+
+// isIntersect() against every triangle pair, for every tree config
+// under uniform and single axis scales
+void checkIntersect()
+{
+    std::mt19937 rng(1);
+
+    glr::OBJ sphere;
+    glr::OBJ other;
+    makeBumpySphere(sphere, 20, 21);
+    makeBumpySphere(other, 10, 11);
+
+    const int NUM_POSES = 25;
+    int num_hits = 0;
+
+    for (int tree = 0; tree < NUM_TREES; tree++)
+    {
+        useTree(sphere, tree);
+        useTree(other, tree);
+
+        for (int p = 0; p < NUM_POSES; p++)
+        {
+            glm::vec3 scale_A = randomScale(rng, 0.5f, 2.0f, p % 2 == 1);
+            glm::vec3 scale_B = randomScale(rng, 0.3f, 1.2f, p % 3 == 1);
+            float reach = 1.2f * (maxScale(scale_A) + maxScale(scale_B));
+            glm::mat4 model_A = randomPose(rng, glm::vec3(0.0f), scale_A);
+            glm::mat4 model_B = randomPose(rng, uniform(rng, 0, reach) * randomDirection(rng), scale_B);
+            sphere.modelMatrix(model_A);
+            other.modelMatrix(model_B);
+
+            bool is_intersect = sphere.isIntersect(&other);
+            facePairs expected = intersectingPairs(worldTriangles(sphere, model_A), worldTriangles(other, model_B));
+
+            check(is_intersect == !expected.empty(), "intersect tree %d pose %d: hit %d, brute force %zu pairs", tree, p, (int) is_intersect, expected.size());
+
+            // a hit comes from a triangle pair, not just overlapping leaves
+            int N_p = TREES[tree].is_obb_ ? sphere.obb_tree_.N_p_ : sphere.aabb_tree_.N_p_;
+            check(!is_intersect || N_p > 0, "intersect tree %d pose %d: hit without a triangle pair test", tree, p);
+            num_hits += is_intersect;
+        }
+    }
+
+    std::printf("intersect: %d poses, %d hits\n", NUM_TREES * NUM_POSES, num_hits);
+}
+
+// distance() against the closest triangle pair, for every tree config
+// under uniform and single axis scales, with separations around the
+// node sizes
+void checkDistance()
+{
+    std::mt19937 rng(10);
+
+    glr::OBJ sphere;
+    glr::OBJ other;
+    makeBumpySphere(sphere, 20, 21);
+    makeBumpySphere(other, 8, 9);
+
+    const int NUM_POSES = 10;
+    float max_error = 0;
+    glr::distanceQuery query;
+
+    for (int tree = 0; tree < NUM_TREES; tree++)
+    {
+        useTree(sphere, tree);
+        useTree(other, tree);
+
+        for (int p = 0; p < NUM_POSES; p++)
+        {
+            glm::vec3 scale_A = randomScale(rng, 0.5f, 3.0f, p % 2 == 1);
+            glm::vec3 scale_B = randomScale(rng, 0.2f, 1.5f, p % 3 == 1);
+            float reach = 1.2f * (maxScale(scale_A) + maxScale(scale_B));
+            glm::mat4 model_A = randomPose(rng, glm::vec3(0.0f), scale_A);
+            glm::mat4 model_B = randomPose(rng, uniform(rng, 0.5f, 1.5f) * reach * randomDirection(rng), scale_B);
+            sphere.modelMatrix(model_A);
+            other.modelMatrix(model_B);
+
+            float distance = sphere.distance(&other, query);
+            float expected = minDistance(worldTriangles(sphere, model_A), worldTriangles(other, model_B));
+
+            float error = std::abs(distance - expected);
+            check(error <= 1e-4f * (1 + expected), "distance tree %d pose %d: %g, brute force %g", tree, p, distance, expected);
+            max_error = std::max(max_error, error);
+        }
+    }
+
+    std::printf("distance: %d poses, max error %g\n", NUM_TREES * NUM_POSES, max_error);
+}
+
+// translation, rotation and scale at the start and the end of a frame
+struct sweep
+{
+    glm::vec3 trans_[2];
+    glm::quat rot_[2];
+    glm::vec3 scale_[2];
+};
+
+glm::quat randomRotation(std::mt19937& rng)
+{
+    return glm::quat_cast(glm::mat3(glm::rotate(glm::mat4(1.0f), uniform(rng, 0, 6.2832f), randomDirection(rng))));
+}
+
+// the pose OBJ::timeOfImpact() passes through at t, translation and
+// scale lerped and rotation slerped the short way round
+glm::mat4 sweepPose(const sweep& motion, float t)
+{
+    glm::quat rot_end = (glm::dot(motion.rot_[0], motion.rot_[1]) < 0) ? -motion.rot_[1] : motion.rot_[1];
+    glm::mat4 model = glm::mat4_cast(glm::slerp(motion.rot_[0], rot_end, t));
+    for (int i = 0; i < 3; i++)
+        model[i] *= motion.scale_[0][i] + (motion.scale_[1][i] - motion.scale_[0][i]) * t;
+    model[3] = glm::vec4(motion.trans_[0] + (motion.trans_[1] - motion.trans_[0]) * t, 1.0f);
+
+    return model;
+}
+
+bool isAnyIntersect(const std::vector<glm::vec3>& a, const std::vector<glm::vec3>& b)
+{
+    for (size_t f_A = 0; f_A < a.size(); f_A += 3)
+    {
+        for (size_t f_B = 0; f_B < b.size(); f_B += 3)
+        {
+            if (boxGap(&a[f_A], &b[f_B]) <= 0 && glr::triangleIntersect(&a[f_A], &b[f_B]))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+// timeOfImpact() against the first of 200 evenly spaced poses at which
+// any triangles intersect, a scaled cube sweeping past or through a
+// sphere that turns and scales itself, for every tree config
+void checkTimeOfImpact()
+{
+    std::mt19937 rng(16);
+
+    glr::OBJ cube;
+    glr::OBJ sphere;
+    makeCube(cube);
+    makeBumpySphere(sphere, 20, 21);
+
+    const int NUM_SWEEPS = 10;
+    const int NUM_SAMPLES = 200;
+    int num_hits = 0;
+    int num_capped = 0;
+    glr::impactQuery query;
+
+    for (int tree = 0; tree < NUM_TREES; tree++)
+    {
+        useTree(cube, tree);
+        useTree(sphere, tree);
+
+        for (int p = 0; p < NUM_SWEEPS; p++)
+        {
+            // the cube starts outside and ends near or past the far
+            // side, on a path up to 4.5 off the center so some miss
+            sweep cube_motion;
+            glm::vec3 dir = randomDirection(rng);
+            glm::vec3 side = uniform(rng, 0, 4.5f) * glm::normalize(glm::cross(dir, randomDirection(rng)));
+            cube_motion.trans_[0] = uniform(rng, 5.0f, 6.0f) * dir + side;
+            cube_motion.trans_[1] = -uniform(rng, 0.5f, 6.0f) * dir + side;
+            for (int k = 0; k < 2; k++)
+            {
+                cube_motion.rot_[k] = randomRotation(rng);
+                cube_motion.scale_[k] = randomScale(rng, 1.0f, 3.0f, p % 2 == 1);
+            }
+
+            sweep sphere_motion;
+            for (int k = 0; k < 2; k++)
+            {
+                sphere_motion.trans_[k] = uniform(rng, 0, 0.3f) * randomDirection(rng);
+                sphere_motion.rot_[k] = randomRotation(rng);
+                sphere_motion.scale_[k] = randomScale(rng, 0.8f, 1.5f, p % 3 == 1);
+            }
+
+            float toi = cube.timeOfImpact(&sphere, sweepPose(cube_motion, 0), sweepPose(cube_motion, 1), sweepPose(sphere_motion, 0), sweepPose(sphere_motion, 1), query);
+
+            float first_contact = FLT_MAX;
+            for (int k = 0; k <= NUM_SAMPLES; k++)
+            {
+                float t = (float) k / NUM_SAMPLES;
+                if (isAnyIntersect(worldTriangles(cube, sweepPose(cube_motion, t)), worldTriangles(sphere, sweepPose(sphere_motion, t))))
+                {
+                    first_contact = t;
+                    break;
+                }
+            }
+
+            check(toi <= first_contact, "time of impact tree %d sweep %d: %g, first sampled contact at %g", tree, p, toi, first_contact);
+            if (toi == FLT_MAX)
+                continue;
+
+            // a query out of steps stops early, short of tolerance_
+            bool is_capped = (query.num_iterations_ == query.max_iterations_);
+            float distance = minDistance(worldTriangles(cube, sweepPose(cube_motion, toi)), worldTriangles(sphere, sweepPose(sphere_motion, toi)));
+            check(is_capped || distance <= query.tolerance_ * 1.01f, "time of impact tree %d sweep %d: %g apart at %g", tree, p, distance, toi);
+
+            num_hits += 1;
+            num_capped += is_capped;
+        }
+    }
+
+    std::printf("time of impact: %d sweeps, %d hits, %d out of steps\n", NUM_TREES * NUM_SWEEPS, num_hits, num_capped);
+}
+
+// closest triangle hit by origin + t * dir with t <= t_max, face is
+// set to its index and t to FLT_MAX if none is hit
+float closestHit(const std::vector<glm::vec3>& tris, const glm::vec3& origin, const glm::vec3& dir, float t_max, uint32_t& face)
+{
+    float t_best = FLT_MAX;
+    face = UINT32_MAX;
+    for (uint32_t f = 0; f < tris.size() / 3; f++)
+    {
+        float t, u, v;
+        if (glr::rayTriangleIntersect(origin, dir, &tris[3 * f], t_max, t, u, v) && t < t_best)
+        {
+            t_best = t;
+            face = f;
+        }
+    }
+
+    return t_best;
+}
+
+// a hit at the distance of the closest triangle, on the face it names
+// at the point its u and v give, the face may be another one sharing
+// the hit point when the ray goes through an edge
+bool isSameHit(const std::vector<glm::vec3>& tris, const glm::vec3& origin, const glm::vec3& dir, const glr::rayHit& hit, float t_expected)
+{
+    if (hit.face_idx_ >= tris.size() / 3 || hit.shape_idx_ != 0)
+        return false;
+
+    const glm::vec3* tri = &tris[3 * hit.face_idx_];
+    glm::vec3 p = (1 - hit.u_ - hit.v_) * tri[0] + hit.u_ * tri[1] + hit.v_ * tri[2];
+    float tolerance = 1e-4f * (1 + t_expected);
+
+    return std::abs(hit.distance_ - t_expected) <= tolerance && glm::length(p - (origin + hit.distance_ * dir)) <= tolerance * glm::length(dir) &&
+           hit.u_ >= -1e-4f && hit.v_ >= -1e-4f && hit.u_ + hit.v_ <= 1 + 1e-4f;
+}
+
+// a ray towards a random point of the sphere of radius reach, or away
+// from it, or along the object axes, which makes the inverse direction
+// infinite on the other axes, starting on a face of the root box
+void randomRay(std::mt19937& rng, int kind, const glr::AABBNode& root, const glm::mat4& model, float reach, glm::vec3& origin, glm::vec3& dir)
+{
+    if (kind < 2)
+    {
+        origin = glm::vec3(model[3]) + 2.5f * reach * randomDirection(rng);
+        glm::vec3 target = glm::vec3(model[3]) + uniform(rng, 0, reach) * randomDirection(rng);
+        dir = (kind == 0 ? 1.0f : -1.0f) * (target - origin) * uniform(rng, 0.2f, 3.0f);
+        return;
+    }
+
+    // along one object axis, or in the plane of two
+    int axis = rng() % 3;
+    glm::vec3 local_dir(0.0f);
+    local_dir[axis] = (rng() % 2 == 0) ? 1.0f : -1.0f;
+    if (kind == 3)
+        local_dir[(axis + 1) % 3] = uniform(rng, -1, 1);
+
+    // from outside the box, on one of its faces parallel to the ray
+    glm::vec3 local_origin;
+    for (int i = 0; i < 3; i++)
+        local_origin[i] = root.center_[i] + uniform(rng, -1, 1) * root.extent_[i];
+    local_origin[axis] = root.center_[axis] - 2 * local_dir[axis] * root.extent_[axis];
+    int face_axis = (axis + 2) % 3;
+    if (rng() % 2 == 0)
+        local_origin[face_axis] = root.center_[face_axis] + ((rng() % 2 == 0) ? 1.0f : -1.0f) * root.extent_[face_axis];
+
+    origin = glm::vec3(model * glm::vec4(local_origin, 1.0f));
+    dir = glm::vec3(model * glm::vec4(local_dir, 0.0f));
+}
+
+// raycast() and raycastAny() against every triangle, for every AABB
+// tree config, with rays that hit, rays that miss, rays stopped short
+// by t_max and rays parallel to the box faces
+void checkRaycast()
+{
+    std::mt19937 rng(11);
+
+    glr::OBJ sphere;
+    makeBumpySphere(sphere, 20, 21);
+
+    const int NUM_POSES = 4;
+    const int NUM_RAYS = 200;
+    int num_rays = 0;
+    int num_hits = 0;
+    int num_parallel = 0;
+
+    for (int tree = 0; tree < NUM_TREES; tree++)
+    {
+        if (TREES[tree].is_obb_)
+            continue;
+
+        useTree(sphere, tree);
+
+        for (int p = 0; p < NUM_POSES; p++)
+        {
+            // the rays parallel to the box faces need a pose without rotation
+            glm::vec3 scale = randomScale(rng, 0.5f, 2.0f, p % 2 == 1);
+            glm::vec3 position = uniform(rng, 0, 3) * randomDirection(rng);
+            glm::mat4 model = (p < 2) ? randomPose(rng, position, scale) : glm::scale(glm::translate(glm::mat4(1.0f), position), scale);
+            sphere.modelMatrix(model);
+            std::vector<glm::vec3> tris = worldTriangles(sphere, model);
+            const glr::AABBNode& root = sphere.aabb_tree_.nodes_[0];
+
+            for (int r = 0; r < NUM_RAYS; r++)
+            {
+                int kind = (p < 2) ? r % 2 : r % 4;
+                glm::vec3 origin, dir;
+                randomRay(rng, kind, root, model, 1.2f * maxScale(scale), origin, dir);
+                num_parallel += kind >= 2;
+
+                // some rays end before the closest triangle
+                uint32_t face;
+                float t_max = FLT_MAX;
+                float t_expected = closestHit(tris, origin, dir, t_max, face);
+                if (r % 5 == 4 && t_expected < FLT_MAX)
+                {
+                    t_max = uniform(rng, 0.5f, 1.0f) * t_expected;
+                    t_expected = closestHit(tris, origin, dir, t_max, face);
+                }
+
+                glr::rayHit hit;
+                bool is_hit = sphere.raycast(origin, dir, t_max, hit);
+                bool is_any_hit = sphere.raycastAny(origin, dir, t_max);
+                bool expected = t_expected < FLT_MAX;
+
+                check(is_hit == expected, "raycast tree %d pose %d ray %d: hit %d, brute force %d", tree, p, r, (int) is_hit, (int) expected);
+                check(!is_hit || !expected || isSameHit(tris, origin, dir, hit, t_expected), "raycast tree %d pose %d ray %d: face %u at %g, brute force face %u at %g", tree, p, r, hit.face_idx_, hit.distance_, face, t_expected);
+                check(is_any_hit == expected, "raycast any tree %d pose %d ray %d: hit %d, brute force %d", tree, p, r, (int) is_any_hit, (int) expected);
+
+                num_rays += 1;
+                num_hits += expected;
+            }
+        }
+    }
+
+    std::printf("raycast: %d rays, %d hits, %d parallel to the box faces\n", num_rays, num_hits, num_parallel);
+}
+
+// raycastBatch() against raycast() and raycastAny() on each ray, for
+// every AABB tree config, with packets aimed across the silhouette so
+// they mix hits and misses, packets of unrelated rays that diverge
+// right away and a count that leaves a partial packet, on one thread
+// and on a pool
+void checkRaycastBatch()
+{
+    std::mt19937 rng(12);
+
+    glr::OBJ sphere;
+    makeBumpySphere(sphere, 20, 21);
+
+    glr::threadPool pool(4);
+
+    const int NUM_POSES = 3;
+    const int NUM_RAYS = 1001;
+    int num_rays = 0;
+    int num_hits = 0;
+    int num_diverged = 0;
+
+    for (int tree = 0; tree < NUM_TREES; tree++)
+    {
+        if (TREES[tree].is_obb_)
+            continue;
+
+        useTree(sphere, tree);
+
+        for (int p = 0; p < NUM_POSES; p++)
+        {
+            glm::vec3 scale = randomScale(rng, 0.5f, 2.0f, p % 2 == 1);
+            glm::mat4 model = randomPose(rng, uniform(rng, 0, 3) * randomDirection(rng), scale);
+            sphere.modelMatrix(model);
+            std::vector<glm::vec3> tris = worldTriangles(sphere, model);
+            glm::vec3 center(model[3]);
+            float radius = maxScale(scale);
+
+            glr::rayQuery query;
+            for (int r = 0; r < NUM_RAYS; r += 4)
+            {
+                // a packet from one point at a spot near the silhouette,
+                // or every 8th packet four unrelated rays
+                glm::vec3 origin = center + 3 * radius * randomDirection(rng);
+                glm::vec3 target = center + uniform(rng, 0.7f, 1.3f) * radius * randomDirection(rng);
+                for (int k = 0; k < 4 && r + k < NUM_RAYS; k++)
+                {
+                    if (r % 32 == 28)
+                    {
+                        origin = center + 3 * radius * randomDirection(rng);
+                        target = center + radius * randomDirection(rng);
+                    }
+                    query.origins_.push_back(origin);
+                    query.dirs_.push_back(glm::normalize(target + 0.1f * radius * randomDirection(rng) - origin));
+                }
+            }
+            query.t_max_ = uniform(rng, 2.5f, 4.0f) * radius;
+
+            int num_batch_hits = sphere.raycastBatch(query);
+            std::vector<glr::rayHit> hits = query.hits_;
+            num_diverged += query.num_diverged_;
+
+            int num_single_hits = 0;
+            int num_same = 0;
+            for (int r = 0; r < NUM_RAYS; r++)
+            {
+                glr::rayHit hit;
+                bool is_hit = sphere.raycast(query.origins_[r], query.dirs_[r], query.t_max_, hit);
+                bool is_batch_hit = hits[r].distance_ < FLT_MAX;
+                num_single_hits += is_hit;
+                num_same += is_hit == is_batch_hit && (!is_hit || isSameHit(tris, query.origins_[r], query.dirs_[r], hits[r], hit.distance_));
+            }
+
+            check(num_same == NUM_RAYS, "raycast batch tree %d pose %d: %d of %d rays differ from single rays", tree, p, NUM_RAYS - num_same, NUM_RAYS);
+            check(num_batch_hits == num_single_hits && query.num_hits_ == num_single_hits, "raycast batch tree %d pose %d: %d hits, single rays %d", tree, p, num_batch_hits, num_single_hits);
+            check(num_single_hits > 0 && num_single_hits < NUM_RAYS, "raycast batch tree %d pose %d: %d of %d rays hit, no mix of hits and misses", tree, p, num_single_hits, NUM_RAYS);
+
+            // the pool splits the packets but traces each the same way
+            query.pool_ = &pool;
+            sphere.raycastBatch(query);
+            check(isSameArray(hits, query.hits_), "raycast batch tree %d pose %d: the pool changed the hits", tree, p);
+            query.pool_ = NULL;
+
+            query.any_hit_ = true;
+            sphere.raycastBatch(query);
+            int num_same_any = 0;
+            for (int r = 0; r < NUM_RAYS; r++)
+                num_same_any += (query.hits_[r].distance_ < FLT_MAX) == sphere.raycastAny(query.origins_[r], query.dirs_[r], query.t_max_);
+            check(num_same_any == NUM_RAYS, "raycast batch any tree %d pose %d: %d of %d rays differ from single rays", tree, p, NUM_RAYS - num_same_any, NUM_RAYS);
+
+            num_rays += NUM_RAYS;
+            num_hits += num_single_hits;
+        }
+    }
+
+    std::printf("raycast batch: %d rays, %d hits, %d diverged\n", num_rays, num_hits, num_diverged);
+}
+
+// isIntersect() with a contact buffer lists every intersecting face
+// pair once, capped at max_contacts and reusing the buffer, for every
+// tree config
+void checkContacts()
+{
+    std::mt19937 rng(5);
+
+    glr::OBJ sphere;
+    glr::OBJ other;
+    makeBumpySphere(sphere, 20, 21);
+    makeBumpySphere(other, 10, 11);
+
+    const int NUM_POSES = 10;
+    const size_t MAX_CONTACTS = 1 << 20;
+    std::vector<glr::contactPair> contacts;
+    contacts.reserve(MAX_CONTACTS);
+    const glr::contactPair* buffer = contacts.data();
+    size_t num_contacts = 0;
+
+    for (int tree = 0; tree < NUM_TREES; tree++)
+    {
+        useTree(sphere, tree);
+        useTree(other, tree);
+
+        for (int p = 0; p < NUM_POSES; p++)
+        {
+            glm::mat4 model_A = randomPose(rng, glm::vec3(0.0f), glm::vec3(1.0f));
+            glm::mat4 model_B = randomPose(rng, uniform(rng, 0, 1.8f) * randomDirection(rng), glm::vec3(0.6f));
+            sphere.modelMatrix(model_A);
+            other.modelMatrix(model_B);
+
+            facePairs expected = intersectingPairs(worldTriangles(sphere, model_A), worldTriangles(other, model_B));
+
+            bool is_intersect = sphere.isIntersect(&other, contacts, MAX_CONTACTS);
+            facePairs found;
+            bool is_shape_0 = true;
+            for (const glr::contactPair& contact : contacts)
+            {
+                found.push_back(std::make_pair(contact.face_A_, contact.face_B_));
+                is_shape_0 = is_shape_0 && contact.shape_A_ == 0 && contact.shape_B_ == 0;
+            }
+            std::sort(found.begin(), found.end());
+
+            check(is_intersect == !expected.empty(), "contacts tree %d pose %d: hit %d, brute force %zu pairs", tree, p, (int) is_intersect, expected.size());
+            check(found == expected && is_shape_0, "contacts tree %d pose %d: %zu contacts, brute force %zu pairs", tree, p, found.size(), expected.size());
+            num_contacts += found.size();
+
+            // a full buffer stops the query with pairs that intersect
+            size_t max_contacts = 3;
+            is_intersect = sphere.isIntersect(&other, contacts, max_contacts);
+            bool is_subset = true;
+            for (const glr::contactPair& contact : contacts)
+                is_subset = is_subset && std::binary_search(expected.begin(), expected.end(), std::make_pair(contact.face_A_, contact.face_B_));
+
+            check(is_intersect == !expected.empty(), "contacts tree %d pose %d: hit %d with %zu contacts at most", tree, p, (int) is_intersect, max_contacts);
+            check(contacts.size() == std::min(max_contacts, expected.size()) && is_subset, "contacts tree %d pose %d: %zu of at most %zu contacts, brute force %zu pairs", tree, p, contacts.size(), max_contacts, expected.size());
+        }
+    }
+
+    check(contacts.data() == buffer, "contacts: the buffer was reallocated");
+
+    std::printf("contacts: %d poses, %zu contacts\n", NUM_TREES * NUM_POSES, num_contacts);
+}
+
+// contacts and node flags of one collisionQuery, in the order found
+struct queryResult
+{
+    bool is_intersect_;
+    facePairs contacts_;
+    std::vector<bool> is_intersect_A_;
+    std::vector<bool> is_intersect_B_;
+};
+
+queryResult runQuery(const glr::OBJ& obj, const glr::OBJ& other, glr::collisionQuery& query, size_t max_contacts = SIZE_MAX)
+{
+    std::vector<glr::contactPair> contacts;
+    query.contacts_ = &contacts;
+    query.max_contacts_ = max_contacts;
+    query.mark_nodes_ = true;
+
+    queryResult result;
+    result.is_intersect_ = obj.isIntersect(&other, query);
+    for (const glr::contactPair& contact : contacts)
+        result.contacts_.push_back(std::make_pair(contact.face_A_, contact.face_B_));
+    result.is_intersect_A_ = query.is_intersect_A_;
+    result.is_intersect_B_ = query.is_intersect_B_;
+    query.contacts_ = NULL;
+
+    return result;
+}
+
+bool operator==(const queryResult& a, const queryResult& b)
+{
+    return a.is_intersect_ == b.is_intersect_ && a.contacts_ == b.contacts_ &&
+           a.is_intersect_A_ == b.is_intersect_A_ && a.is_intersect_B_ == b.is_intersect_B_;
+}
+
+// queries of the same two trees run on several threads at once, each
+// with its own collisionQuery, match the same query run alone and
+// leave the trees as they were, for every tree config
+void checkConcurrentQueries()
+{
+    std::mt19937 rng(8);
+
+    glr::OBJ sphere;
+    glr::OBJ other;
+    makeBumpySphere(sphere, 20, 21);
+    makeBumpySphere(other, 10, 11);
+
+    const int NUM_POSES = 5;
+    const int NUM_THREADS = 4;
+    const int NUM_QUERIES = 20;
+
+    for (int tree = 0; tree < NUM_TREES; tree++)
+    {
+        useTree(sphere, tree);
+        useTree(other, tree);
+        std::vector<glr::AABBNode> aabb_nodes = sphere.aabb_tree_.nodes_;
+        std::vector<glr::OBBNode> obb_nodes = sphere.obb_tree_.nodes_;
+
+        for (int p = 0; p < NUM_POSES; p++)
+        {
+            sphere.modelMatrix(randomPose(rng, glm::vec3(0.0f), glm::vec3(1.0f)));
+            other.modelMatrix(randomPose(rng, uniform(rng, 0, 1.8f) * randomDirection(rng), glm::vec3(0.6f)));
+
+            glr::collisionQuery alone;
+            queryResult expected = runQuery(sphere, other, alone);
+
+            std::vector<int> num_same(NUM_THREADS, 0);
+            std::vector<std::thread> threads;
+            for (int t = 0; t < NUM_THREADS; t++)
+            {
+                threads.emplace_back([&, t] () {
+                    glr::collisionQuery query;
+                    for (int q = 0; q < NUM_QUERIES; q++)
+                        num_same[t] += runQuery(sphere, other, query) == expected;
+                });
+            }
+            for (std::thread& thread : threads)
+                thread.join();
+
+            for (int t = 0; t < NUM_THREADS; t++)
+                check(num_same[t] == NUM_QUERIES, "concurrent queries tree %d pose %d: %d of %d queries on thread %d differ", tree, p, NUM_QUERIES - num_same[t], NUM_QUERIES, t);
+        }
+
+        check(isSameArray(aabb_nodes, sphere.aabb_tree_.nodes_) && isSameArray(obb_nodes, sphere.obb_tree_.nodes_), "concurrent queries tree %d: the queries changed the tree", tree);
+    }
+
+    std::printf("concurrent queries: %d poses, %d threads\n", NUM_TREES * NUM_POSES, NUM_THREADS);
+}
+
+// queries split into tasks on a thread pool give the contacts in the
+// same order, the same node flags and the same capped contact lists
+// as the serial traversal, on meshes big enough to be split, for
+// every tree config
+void checkPoolQueries()
+{
+    std::mt19937 rng(9);
+
+    glr::OBJ sphere;
+    glr::OBJ other;
+    makeBumpySphere(sphere, 60, 61);
+    makeBumpySphere(other, 40, 41);
+
+    glr::threadPool pool(4);
+
+    const int NUM_POSES = 4;
+    const int NUM_RUNS = 5;
+    const size_t MAX_CONTACTS[] = {SIZE_MAX, 1, 7, 100};
+    size_t num_contacts = 0;
+
+    for (int tree = 0; tree < NUM_TREES; tree++)
+    {
+        useTree(sphere, tree);
+        useTree(other, tree);
+
+        for (int p = 0; p < NUM_POSES; p++)
+        {
+            sphere.modelMatrix(randomPose(rng, glm::vec3(0.0f), glm::vec3(1.0f)));
+            other.modelMatrix(randomPose(rng, uniform(rng, 0.5f, 1.2f) * randomDirection(rng), glm::vec3(0.7f)));
+
+            for (size_t max_contacts : MAX_CONTACTS)
+            {
+                glr::collisionQuery serial;
+                queryResult expected = runQuery(sphere, other, serial, max_contacts);
+                if (max_contacts == SIZE_MAX)
+                    num_contacts += expected.contacts_.size();
+
+                glr::collisionQuery query;
+                query.pool_ = &pool;
+                int num_same = 0;
+                for (int r = 0; r < NUM_RUNS; r++)
+                    num_same += runQuery(sphere, other, query, max_contacts) == expected;
+
+                check(num_same == NUM_RUNS, "pool queries tree %d pose %d: %d of %d runs with at most %zu contacts differ from the serial query", tree, p, NUM_RUNS - num_same, NUM_RUNS, max_contacts);
+            }
+        }
+    }
+
+    std::printf("pool queries: %d poses, %zu contacts\n", NUM_TREES * NUM_POSES, num_contacts);
+}
+
+// triangleCache against the tinyobj faces it was built from, two
+// shapes with a quad in the first one, which is skipped
+void checkTriangleCache()
+{
+    std::mt19937 rng(3);
+
+    glr::tinyobj::attrib_t attrib;
+    for (int v = 0; v < 3 * 12; v++)
+        attrib.vertices.push_back(uniform(rng, -1, 1));
+
+    // vertex indices and corner counts of the faces of each shape
+    const std::vector<int> FACES[2] = {{0, 1, 2, 3, 4, 5, 6, 7, 8, 9}, {10, 11, 0, 5, 2, 9}};
+    const std::vector<int> NUM_CORNERS[2] = {{3, 4, 3}, {3, 3}};
+
+    std::vector<glr::tinyobj::shape_t> shapes(2);
+    for (int s = 0; s < 2; s++)
+    {
+        for (int v : FACES[s])
+        {
+            glr::tinyobj::index_t idx;
+            idx.vertex_index = v;
+            idx.normal_index = -1;
+            idx.texcoord_index = -1;
+            shapes[s].mesh.indices.push_back(idx);
+        }
+        for (int n : NUM_CORNERS[s])
+            shapes[s].mesh.num_face_vertices.push_back(n);
+    }
+
+    glr::triangleCache cache;
+    cache.build(attrib, shapes);
+
+    // (shape, face, index of the first corner) of every triangle
+    const int TRIS[4][3] = {{0, 0, 0}, {0, 2, 7}, {1, 0, 0}, {1, 1, 3}};
+    check(cache.size() == 4, "triangle cache: %zu triangles, expected 4", cache.size());
+
+    for (uint32_t t = 0; t < cache.size() && t < 4; t++)
+    {
+        int s = TRIS[t][0];
+        check(cache.shape_idx_[t] == (uint32_t) s && cache.face_idx_[t] == (uint32_t) TRIS[t][1], "triangle cache: triangle %u is shape %u face %u", t, cache.shape_idx_[t], cache.face_idx_[t]);
+
+        glm::vec3 corners[3];
+        for (int c = 0; c < 3; c++)
+        {
+            int v = FACES[s][TRIS[t][2] + c];
+            corners[c] = glm::vec3(attrib.vertices[3 * v], attrib.vertices[3 * v + 1], attrib.vertices[3 * v + 2]);
+            check(cache.vertex(t, c) == corners[c], "triangle cache: corner %d of triangle %u", c, t);
+        }
+
+        glm::vec3 centroid = (corners[0] + corners[1] + corners[2]) / 3.f;
+        glm::vec3 min_p = glm::min(corners[0], glm::min(corners[1], corners[2]));
+        glm::vec3 max_p = glm::max(corners[0], glm::max(corners[1], corners[2]));
+        check(glm::length(cache.centroid(t) - centroid) < 1e-6f, "triangle cache: centroid of triangle %u", t);
+        check(cache.minP(t) == min_p && cache.maxP(t) == max_p, "triangle cache: bounds of triangle %u", t);
+    }
+
+    std::printf("triangle cache: %zu triangles\n", cache.size());
+}
+
+// trees built on 4 threads against the same trees built on one, on
+// a mesh big enough for the builders to hand subtrees to the pool
+void checkParallelBuild()
+{
+    glr::OBJ sphere;
+    makeBumpySphere(sphere, 100, 101);
+
+    for (int tree = 0; tree < NUM_TREES; tree++)
+    {
+        sphere.aabb_tree_.numBuildThreads(1);
+        sphere.obb_tree_.numBuildThreads(1);
+        useTree(sphere, tree);
+        std::vector<glr::AABBNode> aabb_nodes = sphere.aabb_tree_.nodes_;
+        std::vector<glr::OBBNode> obb_nodes = sphere.obb_tree_.nodes_;
+        std::vector<uint32_t> prim_idx = TREES[tree].is_obb_ ? sphere.obb_tree_.prim_idx_ : sphere.aabb_tree_.prim_idx_;
+
+        sphere.aabb_tree_.numBuildThreads(4);
+        sphere.obb_tree_.numBuildThreads(4);
+        useTree(sphere, tree);
+        bool is_same_nodes = isSameArray(aabb_nodes, sphere.aabb_tree_.nodes_) && isSameArray(obb_nodes, sphere.obb_tree_.nodes_);
+        bool is_same_prims = isSameArray(prim_idx, TREES[tree].is_obb_ ? sphere.obb_tree_.prim_idx_ : sphere.aabb_tree_.prim_idx_);
+
+        check(!aabb_nodes.empty() || !obb_nodes.empty(), "parallel build tree %d: no nodes", tree);
+        check(is_same_nodes, "parallel build tree %d: the nodes differ from the serial build", tree);
+        check(is_same_prims, "parallel build tree %d: the triangle order differs from the serial build", tree);
+    }
+
+    std::printf("parallel build: %d trees, %zu triangles\n", NUM_TREES, sphere.tri_cache_.size());
+}
+
+// node n and its subtree in depth first order from n, returns the
+// index after the subtree, the children split the range of their
+// parent and leaves hold 1 to max_leaf_size triangles
+template <class Node>
+uint32_t checkSubTree(const std::vector<Node>& nodes, uint32_t n, uint32_t max_leaf_size, bool& ok)
+{
+    const Node& node = nodes[n];
+    if (node.isLeaf())
+    {
+        ok = ok && node.begin_ < node.end_ && node.end_ - node.begin_ <= max_leaf_size;
+        return n + 1;
+    }
+
+    if (node.left_ != n + 1 || node.right_ >= nodes.size())
+    {
+        ok = false;
+        return nodes.size();
+    }
+
+    const Node& left = nodes[node.left_];
+    const Node& right = nodes[node.right_];
+    ok = ok && left.begin_ == node.begin_ && left.end_ == right.begin_ && right.end_ == node.end_;
+
+    uint32_t next = checkSubTree(nodes, node.left_, max_leaf_size, ok);
+    ok = ok && next == node.right_;
+
+    return ok ? checkSubTree(nodes, node.right_, max_leaf_size, ok) : nodes.size();
+}
+
+bool isInside(const glr::AABBNode& node, const glm::vec3& p)
+{
+    bool is_inside = true;
+    for (int i = 0; i < 3; i++)
+        is_inside = is_inside && std::abs(p[i] - node.center_[i]) <= node.extent_[i] + 1e-5f;
+
+    return is_inside;
+}
+
+// the center is stored along the node axes
+bool isInside(const glr::OBBNode& node, const glm::vec3& p)
+{
+    bool is_inside = true;
+    for (int j = 0; j < 3; j++)
+        is_inside = is_inside && std::abs(glm::dot(p, node.axes_[j]) - node.center_[j]) <= node.extent_[j] + 1e-5f;
+
+    return is_inside;
+}
+
+// prim_idx_ holds every triangle once and every node box holds the
+// corners of the triangles in its range
+template <class Node>
+bool isPartitioned(const std::vector<Node>& nodes, const std::vector<uint32_t>& prim_idx, const glr::triangleCache& tris)
+{
+    std::vector<uint32_t> sorted = prim_idx;
+    std::sort(sorted.begin(), sorted.end());
+    for (uint32_t t = 0; t < sorted.size(); t++)
+    {
+        if (sorted[t] != t)
+            return false;
+    }
+
+    for (const Node& node : nodes)
+    {
+        for (uint32_t f = node.begin_; f < node.end_; f++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                if (!isInside(node, tris.vertex(prim_idx[f], c)))
+                    return false;
+            }
+        }
+    }
+
+    return sorted.size() == tris.size();
+}
+
+// the wide nodes from the root reach every leaf of nodes_ once,
+// with the boxes of the binary nodes they were collapsed from
+bool isWideCollapsed(const glr::AABBTree& tree)
+{
+    const std::vector<glr::AABBNode>& nodes = tree.nodes_;
+    const std::vector<glr::AABBWideNode>& wide_nodes = tree.wide_nodes_;
+    if (nodes[0].isLeaf())
+        return wide_nodes.empty();
+
+    std::vector<int> num_reached(nodes.size(), 0);
+    std::vector<uint32_t> wide_stack = {0};
+    while (!wide_stack.empty())
+    {
+        uint32_t w = wide_stack.back();
+        wide_stack.pop_back();
+        if (w >= wide_nodes.size() || wide_nodes[w].num_children_ < 2 || wide_nodes[w].num_children_ > 4)
+            return false;
+
+        const glr::AABBWideNode& wide = wide_nodes[w];
+        for (uint32_t c = 0; c < wide.num_children_; c++)
+        {
+            const glr::AABBNode& child = nodes[wide.node_[c]];
+            for (int i = 0; i < 3; i++)
+            {
+                if (wide.center_[i][c] != child.center_[i] || wide.extent_[i][c] != child.extent_[i])
+                    return false;
+            }
+
+            if (child.isLeaf())
+                num_reached[wide.node_[c]] += 1;
+            else
+                wide_stack.push_back(wide.wide_[c]);
+        }
+    }
+
+    for (size_t n = 0; n < nodes.size(); n++)
+    {
+        if (num_reached[n] != (nodes[n].isLeaf() ? 1 : 0))
+            return false;
+    }
+
+    return true;
+}
+
+// nodes_ in depth first order with every left child right after its
+// parent, the root covering every triangle, prim_idx_ partitioned
+// under the nodes and the wide nodes collapsed from them, for every
+// tree config
+void checkTreeLayout()
+{
+    glr::OBJ sphere;
+    makeBumpySphere(sphere, 30, 31);
+    uint32_t num_tris = sphere.tri_cache_.size();
+
+    for (int tree = 0; tree < NUM_TREES; tree++)
+    {
+        useTree(sphere, tree);
+
+        bool ok = true;
+        bool is_partitioned;
+        uint32_t end;
+        if (TREES[tree].is_obb_)
+        {
+            const std::vector<glr::OBBNode>& nodes = sphere.obb_tree_.nodes_;
+            end = checkSubTree(nodes, 0, TREES[tree].max_leaf_size_, ok);
+            ok = ok && end == nodes.size() && nodes[0].begin_ == 0 && nodes[0].end_ == num_tris;
+            is_partitioned = isPartitioned(nodes, sphere.obb_tree_.prim_idx_, sphere.tri_cache_);
+        }
+        else
+        {
+            const std::vector<glr::AABBNode>& nodes = sphere.aabb_tree_.nodes_;
+            end = checkSubTree(nodes, 0, TREES[tree].max_leaf_size_, ok);
+            ok = ok && end == nodes.size() && nodes[0].begin_ == 0 && nodes[0].end_ == num_tris;
+            is_partitioned = isPartitioned(nodes, sphere.aabb_tree_.prim_idx_, sphere.tri_cache_);
+            if (TREES[tree].branch_width_ == 4)
+                check(isWideCollapsed(sphere.aabb_tree_), "tree layout tree %d: the wide nodes do not match nodes_", tree);
+        }
+
+        check(ok, "tree layout tree %d: the nodes are not in depth first order, their ranges do not nest or a leaf is too big", tree);
+        check(is_partitioned, "tree layout tree %d: prim_idx_ is not a permutation or a box misses its triangles", tree);
+    }
+
+    // the fit type is kept when none is passed
+    sphere.enableOBB(true, glr::DITO_FIT);
+    sphere.enableAABB(true);
+    sphere.enableOBB(true);
+    check(sphere.obb_tree_.fitType() == glr::DITO_FIT, "tree layout: enableOBB(true) dropped the fit type");
+
+    std::printf("tree layout: %d trees\n", NUM_TREES);
+}
+
+// refit() after the vertices moved, the topology is kept with the
+// rebuild threshold out of reach, the boxes hold the moved triangles
+// and isIntersect() still matches every triangle pair
+void checkRefit()
+{
+    std::mt19937 rng(4);
+
+    glr::OBJ sphere;
+    glr::OBJ other;
+    makeBumpySphere(other, 10, 11);
+
+    const int NUM_POSES = 10;
+    int num_hits = 0;
+
+    for (int tree = 0; tree < NUM_TREES; tree++)
+    {
+        makeBumpySphere(sphere, 20, 21);
+        useTree(sphere, tree);
+        useTree(other, tree);
+        sphere.aabb_tree_.rebuildThreshold(FLT_MAX);
+        sphere.obb_tree_.rebuildThreshold(FLT_MAX);
+
+        bool is_obb = TREES[tree].is_obb_;
+        std::vector<uint32_t> prim_idx = is_obb ? sphere.obb_tree_.prim_idx_ : sphere.aabb_tree_.prim_idx_;
+        size_t num_nodes = is_obb ? sphere.obb_tree_.nodes_.size() : sphere.aabb_tree_.nodes_.size();
+
+        // squashed along z and every vertex moved a little
+        std::vector<float>& vertices = sphere.attrib_.vertices;
+        for (size_t v = 0; v < vertices.size(); v += 3)
+        {
+            vertices[v + 2] *= 0.5f;
+            for (int i = 0; i < 3; i++)
+                vertices[v + i] += uniform(rng, -0.05f, 0.05f);
+        }
+        sphere.refit();
+
+        bool is_same_topology;
+        bool is_partitioned;
+        if (is_obb)
+        {
+            is_same_topology = prim_idx == sphere.obb_tree_.prim_idx_ && num_nodes == sphere.obb_tree_.nodes_.size();
+            is_partitioned = isPartitioned(sphere.obb_tree_.nodes_, sphere.obb_tree_.prim_idx_, sphere.tri_cache_);
+        }
+        else
+        {
+            is_same_topology = prim_idx == sphere.aabb_tree_.prim_idx_ && num_nodes == sphere.aabb_tree_.nodes_.size();
+            is_partitioned = isPartitioned(sphere.aabb_tree_.nodes_, sphere.aabb_tree_.prim_idx_, sphere.tri_cache_);
+        }
+        check(is_same_topology, "refit tree %d: the tree was rebuilt", tree);
+        check(is_partitioned, "refit tree %d: a box misses its moved triangles", tree);
+
+        for (int p = 0; p < NUM_POSES; p++)
+        {
+            glm::mat4 model_A = randomPose(rng, glm::vec3(0.0f), glm::vec3(1.0f));
+            glm::mat4 model_B = randomPose(rng, uniform(rng, 0, 1.8f) * randomDirection(rng), glm::vec3(0.6f));
+            sphere.modelMatrix(model_A);
+            other.modelMatrix(model_B);
+
+            bool is_intersect = sphere.isIntersect(&other);
+            bool expected = !intersectingPairs(worldTriangles(sphere, model_A), worldTriangles(other, model_B)).empty();
+            check(is_intersect == expected, "refit tree %d pose %d: hit %d, brute force %d", tree, p, (int) is_intersect, (int) expected);
+            num_hits += is_intersect;
+        }
+    }
+
+    std::printf("refit: %d poses, %d hits\n", NUM_TREES * NUM_POSES, num_hits);
+}
+
+// a collisionQuery front kept across refit(), where A is stretched
+// until it reaches into B, and across frames that scale A into B a
+// little at a time, both of which a front trusting the gaps it
+// measured before would skip, for every binary tree config
+void checkKeptFront()
+{
+    glr::OBJ sphere;
+    glr::OBJ other;
+    makeBumpySphere(other, 10, 11);
+
+    const int NUM_FRAMES = 20;
+    int num_trees = 0;
+    int num_skipped = 0;
+
+    for (int tree = 0; tree < NUM_TREES; tree++)
+    {
+        // the front is only kept by the binary traversals
+        if (TREES[tree].branch_width_ != 2)
+            continue;
+
+        makeBumpySphere(sphere, 20, 21);
+        useTree(sphere, tree);
+        useTree(other, tree);
+        sphere.aabb_tree_.rebuildThreshold(FLT_MAX);
+        sphere.obb_tree_.rebuildThreshold(FLT_MAX);
+
+        glm::mat4 model_A(1.0f);
+        glm::mat4 model_B = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, 0.2f, 0.1f));
+        sphere.modelMatrix(model_A);
+        other.modelMatrix(model_B);
+
+        glr::collisionQuery query;
+        query.keep_front_ = true;
+        bool is_apart = !sphere.isIntersect(&other, query) && !sphere.isIntersect(&other, query);
+        check(is_apart, "kept front tree %d: hit before the refit", tree);
+
+        std::vector<float>& vertices = sphere.attrib_.vertices;
+        std::vector<float> rest = vertices;
+        for (size_t v = 0; v < vertices.size(); v += 3)
+        {
+            if (vertices[v] > 0)
+                vertices[v] += 1.6f;
+        }
+        sphere.refit();
+
+        bool is_intersect = sphere.isIntersect(&other, query);
+        bool expected = !intersectingPairs(worldTriangles(sphere, model_A), worldTriangles(other, model_B)).empty();
+        check(expected, "kept front tree %d: the stretched sphere should reach the other one", tree);
+        check(is_intersect == expected, "kept front tree %d: hit %d after the refit, brute force %d", tree, (int) is_intersect, (int) expected);
+
+        // back to the sphere, then scaled along x frame by frame
+        vertices = rest;
+        sphere.refit();
+        glr::collisionQuery frames;
+        frames.keep_front_ = true;
+        int num_wrong = 0;
+        int first_hit = -1;
+        for (int f = 0; f <= NUM_FRAMES; f++)
+        {
+            model_A = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f + 1.6f * f / NUM_FRAMES, 1.0f, 1.0f));
+            sphere.modelMatrix(model_A);
+
+            is_intersect = sphere.isIntersect(&other, frames);
+            expected = !intersectingPairs(worldTriangles(sphere, model_A), worldTriangles(other, model_B)).empty();
+            num_wrong += is_intersect != expected;
+            if (expected && first_hit < 0)
+                first_hit = f;
+            num_skipped += frames.num_front_skipped_;
+        }
+
+        check(num_wrong == 0, "kept front tree %d: %d of %d frames scaling A into B differ from brute force", tree, num_wrong, NUM_FRAMES + 1);
+        check(first_hit > 0, "kept front tree %d: A should only reach B after some frames", tree);
+        num_trees += 1;
+    }
+
+    check(num_skipped > 0, "kept front: no pair was skipped, the front was never used");
+
+    std::printf("kept front: %d trees, %d pairs skipped\n", num_trees, num_skipped);
+}
+
+std::vector<char> readFile(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+void writeFile(const std::string& path, const std::vector<char>& bytes)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(bytes.data(), bytes.size());
+}
+
+// a field of the header of a cached tree file overwritten by value
+void patchHeader(const std::string& path, size_t offset, uint32_t value)
+{
+    std::vector<char> bytes = readFile(path);
+    std::memcpy(&bytes[offset], &value, sizeof(value));
+    writeFile(path, bytes);
+}
+
+// trees saved to the cache and loaded back match the built ones, and
+// files written with another version, node size or mesh hash, or cut
+// short, are turned down, for every tree config
+void checkTreeCache()
+{
+    glr::OBJ sphere;
+    makeBumpySphere(sphere, 20, 21);
+    uint64_t mesh_hash = glr::treeCache::meshHash(sphere.tri_cache_);
+
+    // the test runs in its build directory
+    glr::treeCache::directory(".");
+
+    for (int tree = 0; tree < NUM_TREES; tree++)
+    {
+        bool is_obb = TREES[tree].is_obb_;
+        uint32_t tree_type = is_obb ? glr::treeCache::OBB_TREE : glr::treeCache::AABB_TREE;
+        uint32_t build_type = is_obb ? (uint32_t) TREES[tree].fit_type_ : (uint32_t) TREES[tree].build_type_;
+        std::string path = glr::treeCache::filePath(mesh_hash, tree_type, build_type, TREES[tree].max_leaf_size_);
+        std::remove(path.c_str());
+
+        // the first build writes the file
+        useTree(sphere, tree);
+        std::vector<glr::AABBNode> aabb_nodes = sphere.aabb_tree_.nodes_;
+        std::vector<glr::AABBWideNode> wide_nodes = sphere.aabb_tree_.wide_nodes_;
+        std::vector<glr::OBBNode> obb_nodes = sphere.obb_tree_.nodes_;
+        std::vector<uint32_t> prim_idx = is_obb ? sphere.obb_tree_.prim_idx_ : sphere.aabb_tree_.prim_idx_;
+        std::vector<char> saved = readFile(path);
+
+        auto load = [&] (uint64_t hash) {return is_obb ? sphere.obb_tree_.loadTree(path, hash) : sphere.aabb_tree_.loadTree(path, hash);};
+
+        bool is_loaded = load(mesh_hash);
+        bool is_same = isSameArray(aabb_nodes, sphere.aabb_tree_.nodes_) && isSameArray(wide_nodes, sphere.aabb_tree_.wide_nodes_) &&
+                       isSameArray(obb_nodes, sphere.obb_tree_.nodes_) &&
+                       isSameArray(prim_idx, is_obb ? sphere.obb_tree_.prim_idx_ : sphere.aabb_tree_.prim_idx_);
+        check(!saved.empty() && is_loaded, "tree cache tree %d: the tree was not saved or not loaded back", tree);
+        check(is_same, "tree cache tree %d: the loaded tree differs from the built one", tree);
+
+        check(!load(mesh_hash + 1), "tree cache tree %d: loaded for another mesh hash", tree);
+
+        patchHeader(path, offsetof(glr::treeCacheHeader, version_), glr::treeCache::VERSION - 1);
+        check(!load(mesh_hash), "tree cache tree %d: loaded a file of an older version", tree);
+        writeFile(path, saved);
+
+        patchHeader(path, offsetof(glr::treeCacheHeader, node_size_), (uint32_t) (is_obb ? sizeof(glr::AABBNode) : sizeof(glr::OBBNode)));
+        check(!load(mesh_hash), "tree cache tree %d: loaded a file of another node size", tree);
+        writeFile(path, saved);
+
+        patchHeader(path, offsetof(glr::treeCacheHeader, mesh_hash_), (uint32_t) (mesh_hash + 1));
+        check(!load(mesh_hash), "tree cache tree %d: loaded a file of another mesh", tree);
+
+        writeFile(path, std::vector<char>(saved.begin(), saved.end() - 4));
+        check(!load(mesh_hash), "tree cache tree %d: loaded a file cut short", tree);
+
+        std::remove(path.c_str());
+    }
+
+    glr::treeCache::directory("");
+
+    std::printf("tree cache: %d trees\n", NUM_TREES);
+}
+
+// boxes stretched along a tilted axis and off their origin, a third
+// each with an AABB tree, an OBB tree and no tree, spread over a cube
+// of side size
+void makeScene(std::vector<glr::OBJ>& objs, std::mt19937& rng, float size)
+{
+    for (size_t o = 0; o < objs.size(); o++)
+    {
+        glm::mat4 shape = glm::translate(glm::mat4(1.0f), uniform(rng, 0, 1.0f) * randomDirection(rng));
+        shape = glm::rotate(shape, uniform(rng, 0, 6.2832f), randomDirection(rng));
+        shape = glm::scale(shape, glm::vec3(uniform(rng, 0.2f, 1.0f), 0.2f, 0.3f));
+        makeCube(objs[o], shape);
+
+        if (o % 3 == 0)
+            objs[o].enableAABB(true);
+        else if (o % 3 == 1)
+            objs[o].enableOBB(true);
+
+        glm::vec3 position(uniform(rng, 0, size), uniform(rng, 0, size), uniform(rng, 0, size));
+        objs[o].modelMatrix(randomPose(rng, position, randomScale(rng, 0.5f, 2.0f, o % 2 == 1)));
+    }
+}
+
+// moves every object a little, as between two frames
+void moveScene(std::vector<glr::OBJ>& objs, std::mt19937& rng, float step)
+{
+    for (glr::OBJ& obj : objs)
+    {
+        glm::mat4 model = obj.modelMatrix();
+        glm::vec3 offset = uniform(rng, 0, step) * randomDirection(rng);
+        obj.modelMatrix(glm::translate(glm::mat4(1.0f), offset) * model);
+    }
+}
+
+// every pair of overlapping worldBounds(), lower index first, in order
+objPairs overlappingBounds(const std::vector<glr::OBJ>& objs)
+{
+    std::vector<glm::vec3> min_p(objs.size());
+    std::vector<glm::vec3> max_p(objs.size());
+    for (size_t o = 0; o < objs.size(); o++)
+        objs[o].worldBounds(min_p[o], max_p[o]);
+
+    objPairs pairs;
+    for (uint32_t a = 0; a < objs.size(); a++)
+    {
+        for (uint32_t b = a + 1; b < objs.size(); b++)
+        {
+            bool is_overlap = true;
+            for (int i = 0; i < 3; i++)
+                is_overlap = is_overlap && min_p[a][i] <= max_p[b][i] && min_p[b][i] <= max_p[a][i];
+
+            if (is_overlap)
+                pairs.push_back(std::make_pair(a, b));
+        }
+    }
+
+    return pairs;
+}
+
+// object pairs as indices into objs, lower index first, in order
+objPairs toIndices(const std::vector<std::pair<glr::OBJ*, glr::OBJ*>>& obj_pairs, std::vector<glr::OBJ>& objs)
+{
+    objPairs pairs;
+    for (const std::pair<glr::OBJ*, glr::OBJ*>& pair : obj_pairs)
+    {
+        uint32_t a = pair.first - objs.data();
+        uint32_t b = pair.second - objs.data();
+        pairs.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+    }
+    std::sort(pairs.begin(), pairs.end());
+
+    return pairs;
+}
+
+// worldBounds() around the triangles, and dynamicTree pairs of fat
+// boxes and region queries holding every overlapping box, over frames
+// of motion with objects removed and inserted back in between
+void checkDynamicTree()
+{
+    std::mt19937 rng(14);
+
+    // the tree is declared after the objects so it is gone first
+    std::vector<glr::OBJ> objs(300);
+    makeScene(objs, rng, 12.0f);
+    glr::dynamicTree tree;
+
+    int num_outside = 0;
+    for (size_t o = 0; o < objs.size(); o++)
+    {
+        glm::vec3 min_p, max_p;
+        objs[o].worldBounds(min_p, max_p);
+        std::vector<glm::vec3> tris = worldTriangles(objs[o], objs[o].modelMatrix());
+
+        bool is_inside = true;
+        for (const glm::vec3& v : tris)
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                float tolerance = 1e-5f * (1 + std::abs(v[i]));
+                is_inside = is_inside && v[i] >= min_p[i] - tolerance && v[i] <= max_p[i] + tolerance;
+            }
+        }
+        num_outside += !is_inside;
+    }
+    check(num_outside == 0, "world bounds: %d of %zu objects have triangles outside", num_outside, objs.size());
+
+    for (glr::OBJ& obj : objs)
+        tree.insert(&obj);
+
+    // every 5th object is out of the tree from frame 4 to 6
+    const int NUM_FRAMES = 10;
+    const int NUM_REGIONS = 20;
+    size_t num_pairs = 0;
+    std::vector<std::pair<glr::OBJ*, glr::OBJ*>> obj_pairs;
+    std::vector<glr::OBJ*> region_objs;
+    for (int frame = 0; frame < NUM_FRAMES; frame++)
+    {
+        bool is_removed = (frame >= 4 && frame < 7);
+        for (size_t o = 0; o < objs.size(); o += 5)
+        {
+            if (frame == 4)
+                tree.remove(&objs[o]);
+            else if (frame == 7)
+                tree.insert(&objs[o]);
+        }
+
+        tree.overlappingPairs(obj_pairs);
+        objPairs found = toIndices(obj_pairs, objs);
+        objPairs expected;
+        for (const std::pair<uint32_t, uint32_t>& pair : overlappingBounds(objs))
+        {
+            if (!is_removed || (pair.first % 5 != 0 && pair.second % 5 != 0))
+                expected.push_back(pair);
+        }
+        num_pairs += expected.size();
+
+        check(std::includes(found.begin(), found.end(), expected.begin(), expected.end()), "dynamic tree frame %d: %zu fat pairs miss some of %zu pairs", frame, found.size(), expected.size());
+        check(std::adjacent_find(found.begin(), found.end()) == found.end(), "dynamic tree frame %d: a pair is listed twice", frame);
+        check(tree.numObjects() == (int) objs.size() - (is_removed ? 60 : 0), "dynamic tree frame %d: %d objects", frame, tree.numObjects());
+
+        for (int r = 0; r < NUM_REGIONS; r++)
+        {
+            glm::vec3 min_r(uniform(rng, 0, 12), uniform(rng, 0, 12), uniform(rng, 0, 12));
+            glm::vec3 max_r = min_r + glm::vec3(uniform(rng, 0, 4), uniform(rng, 0, 4), uniform(rng, 0, 4));
+            tree.query(min_r, max_r, region_objs);
+
+            std::vector<uint32_t> found_objs;
+            for (glr::OBJ* obj : region_objs)
+                found_objs.push_back(obj - objs.data());
+            std::sort(found_objs.begin(), found_objs.end());
+
+            int num_missed = 0;
+            for (uint32_t o = 0; o < objs.size(); o++)
+            {
+                if (is_removed && o % 5 == 0)
+                    continue;
+
+                glm::vec3 min_p, max_p;
+                objs[o].worldBounds(min_p, max_p);
+                bool is_overlap = true;
+                for (int i = 0; i < 3; i++)
+                    is_overlap = is_overlap && min_p[i] <= max_r[i] && min_r[i] <= max_p[i];
+
+                num_missed += is_overlap && !std::binary_search(found_objs.begin(), found_objs.end(), o);
+            }
+            check(num_missed == 0, "dynamic tree frame %d region %d: %d objects missed", frame, r, num_missed);
+        }
+
+        moveScene(objs, rng, 0.3f);
+    }
+
+    std::printf("dynamic tree: %zu objects, %d frames, %zu pairs, height %d\n", objs.size(), NUM_FRAMES, num_pairs, tree.height());
+}
+
+// sweepAndPrune pairs against every pair of overlapping boxes, over
+// frames of motion with objects removed and added back in between
+void checkSweepAndPrune()
+{
+    std::mt19937 rng(13);
+
+    std::vector<glr::OBJ> objs(300);
+    makeScene(objs, rng, 12.0f);
+
+    glr::sweepAndPrune sap;
+    for (glr::OBJ& obj : objs)
+        sap.add(&obj);
+
+    // every 7th object is out of the sweep from frame 3 to 5
+    const int NUM_FRAMES = 10;
+    size_t num_pairs = 0;
+    std::vector<std::pair<glr::OBJ*, glr::OBJ*>> obj_pairs;
+    for (int frame = 0; frame < NUM_FRAMES; frame++)
+    {
+        bool is_removed = (frame >= 3 && frame < 6);
+        for (size_t o = 0; o < objs.size(); o += 7)
+        {
+            if (frame == 3)
+                sap.remove(&objs[o]);
+            else if (frame == 6)
+                sap.add(&objs[o]);
+        }
+
+        sap.update();
+        sap.overlappingPairs(obj_pairs);
+        objPairs found = toIndices(obj_pairs, objs);
+
+        objPairs expected;
+        for (const std::pair<uint32_t, uint32_t>& pair : overlappingBounds(objs))
+        {
+            if (!is_removed || (pair.first % 7 != 0 && pair.second % 7 != 0))
+                expected.push_back(pair);
+        }
+        num_pairs += expected.size();
+
+        check(found == expected, "sweep and prune frame %d: %zu pairs, brute force %zu", frame, found.size(), expected.size());
+        check(sap.num_pairs_ == (int) expected.size(), "sweep and prune frame %d: num_pairs_ is %d, brute force %zu", frame, sap.num_pairs_, expected.size());
+
+        moveScene(objs, rng, 0.3f);
+    }
+
+    std::printf("sweep and prune: %zu objects, %d frames, %zu pairs\n", objs.size(), NUM_FRAMES, num_pairs);
+}
+
+// spatialHashGrid pairs against every pair of overlapping boxes, with
+// a ground slab over the whole scene, two boxes past the range of the
+// cell coordinates and two flat squares in the plane x = 0.5, which
+// 0.5f / 0.1f puts in cell 5 and 0.5 / (double) 0.1f in cell 4, on
+// two cell sizes and with and without a pool
+void checkHashGrid()
+{
+    std::mt19937 rng(15);
+
+    std::vector<glr::OBJ> objs(300);
+    makeScene(objs, rng, 12.0f);
+
+    for (size_t o = 0; o < 5; o++)
+    {
+        objs[o].enableAABB(false);
+        objs[o].enableOBB(false);
+    }
+    makeCube(objs[0], glm::scale(glm::mat4(1.0f), glm::vec3(1000.0f, 0.1f, 1000.0f)));
+    objs[0].enableAABB(true);
+    objs[0].modelMatrix(glm::translate(glm::mat4(1.0f), glm::vec3(6.0f)));
+    for (size_t o = 1; o < 3; o++)
+    {
+        makeCube(objs[o]);
+        objs[o].modelMatrix(glm::translate(glm::mat4(1.0f), glm::vec3(1e12f, 0, 0)));
+    }
+    for (size_t o = 3; o < 5; o++)
+    {
+        makeMesh(objs[o], {glm::vec3(0, 0, 0), glm::vec3(0, 0.3f, 0), glm::vec3(0, 0, 0.3f), glm::vec3(0, 0.3f, 0.3f)}, {0, 1, 2, 2, 1, 3});
+        objs[o].enableAABB(true);
+        objs[o].modelMatrix(glm::translate(glm::mat4(1.0f), glm::vec3(0.5f, -20.0f + 0.1f * o, -20.0f)));
+    }
+
+    std::vector<glr::OBJ*> obj_ptrs;
+    for (glr::OBJ& obj : objs)
+        obj_ptrs.push_back(&obj);
+
+    glr::threadPool pool(4);
+    glr::spatialHashGrid grid;
+    objPairs expected = overlappingBounds(objs);
+    check(std::binary_search(expected.begin(), expected.end(), std::make_pair(3u, 4u)), "hash grid: the flat squares should overlap");
+    std::vector<std::pair<glr::OBJ*, glr::OBJ*>> obj_pairs;
+
+    for (float cell_size : {1.0f, 0.1f})
+    {
+        for (glr::threadPool* grid_pool : {(glr::threadPool*) NULL, &pool})
+        {
+            grid.cellSize(cell_size);
+            grid.pool_ = grid_pool;
+            grid.update(obj_ptrs);
+            grid.overlappingPairs(obj_pairs);
+            objPairs found = toIndices(obj_pairs, objs);
+
+            check(found == expected, "hash grid cell size %g pool %d: %zu pairs, brute force %zu", cell_size, (int) (grid_pool != NULL), found.size(), expected.size());
+        }
+        std::printf("hash grid: %zu objects, %zu pairs, cell size %g, %d objects out of the grid\n", objs.size(), expected.size(), cell_size, grid.num_large_);
+    }
+}
+
+// OBBTree::symmetricEigen() against Eigen::EigenSolver, the solver it
+// replaced, on matrices with random, repeated, nearly repeated and zero
+// eigenvalues and with eigenvalues 12 orders of magnitude apart, scaled
+// by up to 1e12 either way
+//
+// the axes are orthonormal and each reference eigenvector lies in the
+// span of the axes whose eigenvalue is within 1e-3 |C| of its own, so
+// the order and signs are free and so are the axes of a repeated
+// eigenvalue
+void checkSymmetricEigen()
+{
+    std::mt19937 rng(6);
+    auto uniform_d = [&rng] (double lo, double hi) {return std::uniform_real_distribution<double>(lo, hi)(rng);};
+
+    const char* KINDS[] = {"random", "double", "triple", "nearly double", "flat", "needle", "badly scaled"};
+    const int NUM_KINDS = sizeof(KINDS) / sizeof(KINDS[0]);
+    const int NUM_MATRICES = 2000;
+
+    double max_residual = 0;
+    double max_deviation = 0;
+
+    for (int kind = 0; kind < NUM_KINDS; kind++)
+    {
+        int num_failed = 0;
+        for (int m = 0; m < NUM_MATRICES; m++)
+        {
+            double l[3] = {uniform_d(0, 1), uniform_d(0, 1), uniform_d(0, 1)};
+            if (kind == 1)
+                l[1] = l[0];
+            else if (kind == 2)
+                l[1] = l[2] = l[0];
+            else if (kind == 3)
+                l[1] = l[0] * (1 + uniform_d(1e-7, 1e-3));
+            else if (kind == 4)
+                l[2] = 0;
+            else if (kind == 5)
+                l[1] = l[2] = uniform_d(0, 1e-7);
+            else if (kind == 6)
+            {
+                for (int i = 0; i < 3; i++)
+                    l[i] = std::pow(10.0, uniform_d(-6, 6));
+            }
+
+            double scale = std::pow(10.0, uniform_d(-12, 12));
+            Eigen::Quaterniond rot(uniform_d(-1, 1), uniform_d(-1, 1), uniform_d(-1, 1), uniform_d(-1, 1));
+            Eigen::Matrix3d Q = rot.normalized().toRotationMatrix();
+            Eigen::Matrix3d C_d = Q * (scale * Eigen::Vector3d(l[0], l[1], l[2])).asDiagonal() * Q.transpose();
+
+            // both solvers see the same float matrix
+            float cov[6] = {(float) C_d(0, 0), (float) C_d(1, 1), (float) C_d(2, 2), (float) C_d(0, 1), (float) C_d(0, 2), (float) C_d(1, 2)};
+            Eigen::Matrix3d C;
+            C << cov[0], cov[3], cov[4],
+                 cov[3], cov[1], cov[5],
+                 cov[4], cov[5], cov[2];
+            double norm = C.norm();
+
+            glm::vec3 axes[3];
+            glr::OBBTree::symmetricEigen(cov, axes);
+
+            Eigen::Vector3d a[3];
+            double lambda[3];
+            bool ok = true;
+            for (int k = 0; k < 3; k++)
+            {
+                a[k] = Eigen::Vector3d(axes[k].x, axes[k].y, axes[k].z);
+                lambda[k] = a[k].dot(C * a[k]);
+
+                double residual = (C * a[k] - lambda[k] * a[k]).norm() / norm;
+                max_residual = std::max(max_residual, residual);
+                ok = ok && residual <= 2e-6 && std::abs(a[k].norm() - 1) <= 1e-6;
+                for (int j = 0; j < k; j++)
+                    ok = ok && std::abs(a[k].dot(a[j])) <= 1e-6;
+            }
+
+            Eigen::EigenSolver<Eigen::Matrix3d> solver(C);
+            for (int j = 0; j < 3; j++)
+            {
+                double lambda_ref = solver.eigenvalues()[j].real();
+                Eigen::Vector3d v = solver.eigenvectors().col(j).real().normalized();
+
+                double in_span = 0;
+                for (int k = 0; k < 3; k++)
+                {
+                    if (std::abs(lambda[k] - lambda_ref) <= 1e-3 * norm)
+                        in_span += a[k].dot(v) * a[k].dot(v);
+                }
+
+                max_deviation = std::max(max_deviation, 1 - in_span);
+                ok = ok && 1 - in_span <= 1e-5;
+            }
+
+            num_failed += !ok;
+        }
+
+        check(num_failed == 0, "symmetric eigen %s: %d of %d matrices off", KINDS[kind], num_failed, NUM_MATRICES);
+    }
+
+    std::printf("symmetric eigen: %d matrices, max residual %g, max axis deviation %g\n", NUM_KINDS * NUM_MATRICES, max_residual, max_deviation);
+}
+
+} // namespace
+
+int main()
+{
+    disableGL();
+
+    checkTriangleCache();
+    checkTriangleIntersect();
+    checkIntersect();
+    checkDistance();
+    checkTimeOfImpact();
+    checkRaycast();
+    checkRaycastBatch();
+    checkContacts();
+    checkConcurrentQueries();
+    checkPoolQueries();
+    checkParallelBuild();
+    checkTreeLayout();
+    checkRefit();
+    checkKeptFront();
+    checkTreeCache();
+    checkDynamicTree();
+    checkSweepAndPrune();
+    checkHashGrid();
+    checkSymmetricEigen();
+
+    std::printf("%d checks, %d failed\n", num_checks, num_failures);
+    return (num_failures == 0) ? 0 : 1;
+}